@@ -13,6 +13,7 @@
 #ifdef __cplusplus
 
 #include <cstdint>
+#include <memory>
 #include <vector>
 #include <string>
 #include <stack>
@@ -52,7 +53,12 @@ namespace JSON_checker {
         bool pop(Modes mode);
 
         int state;
-        std::stack<Modes> stack;
+
+        /**
+         * The stack is backed by a vector so that the memory allocated
+         * for deeply nested documents is kept across calls to reset()
+         */
+        std::stack<Modes, std::vector<Modes> > stack;
     };
 
     class JSON_CHECKER_PUBLIC_API Validator {
@@ -93,6 +99,85 @@ namespace JSON_checker {
     private:
         Instance instance;
     };
+
+    /**
+     * A single document to validate as part of a batch
+     */
+    struct Document {
+        const uint8_t* data;
+        size_t size;
+    };
+
+    /**
+     * The BatchValidator validates a set of documents by spreading them
+     * across a pool of worker threads. Each worker owns its own Instance
+     * which is reused for every document it validates, so validating a
+     * document does not allocate memory (unless it is nested deeper than
+     * anything the worker has seen before).
+     *
+     * The BatchValidator object itself is not thread safe; only a single
+     * thread should call validate() at a time.
+     */
+    class JSON_CHECKER_PUBLIC_API BatchValidator {
+    public:
+        /**
+         * Create a new BatchValidator
+         *
+         * @param workers the number of worker threads to spawn. The calling
+         *                thread is used in addition to the workers, so 0
+         *                means that validate() runs serially in the caller
+         * @throws std::bad_alloc if we fail to create the worker threads
+         */
+        explicit BatchValidator(size_t workers);
+
+        /**
+         * Stop (and join) all of the worker threads
+         */
+        ~BatchValidator();
+
+        BatchValidator(const BatchValidator&) = delete;
+
+        /**
+         * Validate a batch of documents
+         *
+         * @param docs the documents to validate
+         * @param count the number of documents in docs
+         * @param result where to store the result. It is resized to hold
+         *               one bit per document (rounded up to a multiple of
+         *               64), and bit n is set if document n is valid
+         */
+        void validate(const Document* docs, size_t count,
+                      std::vector<uint64_t>& result);
+
+        /**
+         * Validate a batch of documents
+         *
+         * @param docs the documents to validate
+         * @param result see validate(const Document*, size_t, ...)
+         */
+        void validate(const std::vector<Document>& docs,
+                      std::vector<uint64_t>& result) {
+            validate(docs.data(), docs.size(), result);
+        }
+
+        /**
+         * Check if a given document was valid in the result returned
+         * from validate()
+         */
+        static bool isValid(const std::vector<uint64_t>& result,
+                            size_t index) {
+            return (result[index / 64] >> (index % 64)) & 1;
+        }
+
+        /**
+         * Get the number of worker threads in the pool
+         */
+        size_t getWorkers() const;
+
+    private:
+        struct Pool;
+        std::unique_ptr<Pool> pool;
+    };
 }
 
 extern "C" {
@@ -0,0 +1,208 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/cpu_relax.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#define CB_ATOMIC128_MSVC 1
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+// Use cmpxchg16b directly; the __sync builtins need -mcx16 and the
+// __atomic ones call into libatomic for 16 byte types
+#define CB_ATOMIC128_CMPXCHG16B 1
+#elif defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+#define CB_ATOMIC128_SYNC 1
+#endif
+
+namespace Couchbase {
+
+    /**
+     * A 16 byte atomic value, typically a {value, version} pair updated
+     * with compare and swap (to avoid the ABA problem) or two counters
+     * which must be updated together.
+     *
+     * It is lock free on x86-64 (using cmpxchg16b) and on other platforms
+     * where the compiler provides a 16 byte compare and swap. Elsewhere
+     * it falls back to a spinlock (see isLockFree()).
+     *
+     * All operations are sequentially consistent.
+     *
+     * cmpxchg16b requires the value to be 16 byte aligned. That is the
+     * case for static, stack and member variables, and for heap memory
+     * from the system allocators on 64 bit platforms.
+     */
+    template<typename T>
+    class Atomic128 {
+        static_assert(sizeof(T) == 16, "Atomic128 requires a 16 byte type");
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "Atomic128 requires a trivially copyable type");
+
+    public:
+        Atomic128() {
+            words[0] = 0;
+            words[1] = 0;
+#if !defined(CB_ATOMIC128_MSVC) && !defined(CB_ATOMIC128_CMPXCHG16B) && \
+    !defined(CB_ATOMIC128_SYNC)
+            spin.clear();
+#endif
+        }
+
+        explicit Atomic128(const T& initial)
+            : Atomic128() {
+            std::memcpy(words, &initial, sizeof(T));
+        }
+
+        Atomic128(const Atomic128&) = delete;
+
+        static bool isLockFree() {
+#if defined(CB_ATOMIC128_MSVC) || defined(CB_ATOMIC128_CMPXCHG16B) || \
+    defined(CB_ATOMIC128_SYNC)
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        T load() const {
+            // A compare and swap which only succeeds if the value is
+            // {0, 0} (in which case it writes {0, 0}) returns the current
+            // value. The value must therefore live in writable memory.
+            uint64_t expected[2] = {0, 0};
+            const uint64_t desired[2] = {0, 0};
+            const_cast<Atomic128*>(this)->cas(expected, desired);
+            T ret;
+            std::memcpy(&ret, expected, sizeof(T));
+            return ret;
+        }
+
+        void store(const T& value) {
+            uint64_t desired[2];
+            std::memcpy(desired, &value, sizeof(T));
+            // The first attempt fails unless the value is {0, 0}, but it
+            // gives us the current value
+            uint64_t expected[2] = {0, 0};
+            while (!cas(expected, desired)) {
+            }
+        }
+
+        /**
+         * Replace the value with desired if it is equal (bitwise) to
+         * expected.
+         *
+         * @param expected the expected value; updated with the current
+         *                 value if the exchange fails
+         * @param desired the new value
+         * @return true if the value was replaced
+         */
+        bool compareExchange(T& expected, const T& desired) {
+            uint64_t exp[2];
+            uint64_t des[2];
+            std::memcpy(exp, &expected, sizeof(T));
+            std::memcpy(des, &desired, sizeof(T));
+            if (cas(exp, des)) {
+                return true;
+            }
+            std::memcpy(&expected, exp, sizeof(T));
+            return false;
+        }
+
+        /**
+         * Update the value in place: f is called with a copy of the
+         * current value, and the result is stored if nobody changed the
+         * value in the meantime (f is called again if they did).
+         *
+         * @return the value stored
+         */
+        template<typename F>
+        T update(F f) {
+            T current = load();
+            while (true) {
+                T next = current;
+                f(next);
+                if (compareExchange(current, next)) {
+                    return next;
+                }
+                cpuRelax();
+            }
+        }
+
+    private:
+        /**
+         * Compare and swap the two words. On failure expected is updated
+         * with the current value
+         */
+        bool cas(uint64_t* expected, const uint64_t* desired) {
+#if defined(CB_ATOMIC128_MSVC)
+            return _InterlockedCompareExchange128(
+                       reinterpret_cast<volatile long long*>(words),
+                       static_cast<long long>(desired[1]),
+                       static_cast<long long>(desired[0]),
+                       reinterpret_cast<long long*>(expected)) != 0;
+#elif defined(CB_ATOMIC128_CMPXCHG16B)
+            bool ret;
+            __asm__ __volatile__("lock cmpxchg16b %1\n\t"
+                                 "sete %0"
+                                 : "=q"(ret), "+m"(words[0]),
+                                   "+m"(words[1]), "+a"(expected[0]),
+                                   "+d"(expected[1])
+                                 : "b"(desired[0]), "c"(desired[1])
+                                 : "memory", "cc");
+            return ret;
+#elif defined(CB_ATOMIC128_SYNC)
+            unsigned __int128 exp;
+            unsigned __int128 des;
+            std::memcpy(&exp, expected, sizeof(exp));
+            std::memcpy(&des, desired, sizeof(des));
+            const unsigned __int128 old = __sync_val_compare_and_swap(
+                reinterpret_cast<unsigned __int128*>(words), exp, des);
+            if (old == exp) {
+                return true;
+            }
+            std::memcpy(expected, &old, sizeof(old));
+            return false;
+#else
+            while (spin.test_and_set(std::memory_order_acquire)) {
+                cpuRelax();
+            }
+            bool ret;
+            if (words[0] == expected[0] && words[1] == expected[1]) {
+                words[0] = desired[0];
+                words[1] = desired[1];
+                ret = true;
+            } else {
+                expected[0] = words[0];
+                expected[1] = words[1];
+                ret = false;
+            }
+            spin.clear(std::memory_order_release);
+            return ret;
+#endif
+        }
+
+        alignas(16) uint64_t words[2];
+#if !defined(CB_ATOMIC128_MSVC) && !defined(CB_ATOMIC128_CMPXCHG16B) && \
+    !defined(CB_ATOMIC128_SYNC)
+        std::atomic_flag spin;
+#endif
+    };
+}
@@ -0,0 +1,79 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/futex.h>
+#include <platform/platform.h>
+
+#include <atomic>
+#include <cstdint>
+
+namespace Couchbase {
+
+    /**
+     * A single word mutex which spins (with a bounded exponential backoff)
+     * before it parks the thread on a futex. It is intended for short
+     * critical sections which are contended in bursts, where parking
+     * the thread right away (like a pthread mutex does) costs more than
+     * waiting for the owner to release the lock.
+     *
+     * The uncontended lock is a single CAS, and the uncontended unlock a
+     * single exchange. The word holds one of three states:
+     *
+     *     0 - unlocked
+     *     1 - locked, no waiters
+     *     2 - locked, there may be threads parked on the futex
+     *
+     * AdaptiveMutex satisfies the Lockable requirements so it may be used
+     * with std::lock_guard and std::unique_lock. It is not recursive.
+     */
+    class PLATFORM_PUBLIC_API AdaptiveMutex {
+    public:
+        AdaptiveMutex()
+            : word(0) {
+        }
+
+        AdaptiveMutex(const AdaptiveMutex&) = delete;
+
+        void lock() {
+            uint32_t expected = 0;
+            if (!word.compare_exchange_strong(expected, 1,
+                                              std::memory_order_acquire,
+                                              std::memory_order_relaxed)) {
+                lockSlow();
+            }
+        }
+
+        bool try_lock() {
+            uint32_t expected = 0;
+            return word.compare_exchange_strong(expected, 1,
+                                                std::memory_order_acquire,
+                                                std::memory_order_relaxed);
+        }
+
+        void unlock() {
+            if (word.exchange(0, std::memory_order_release) == 2) {
+                futexWake(word, 1);
+            }
+        }
+
+    private:
+        void lockSlow();
+
+        std::atomic<uint32_t> word;
+    };
+}
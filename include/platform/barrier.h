@@ -0,0 +1,209 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/cacheline.h>
+#include <platform/futex.h>
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace Couchbase {
+
+    /**
+     * Number of times to check the word before parking the thread.
+     * Spinning on a single CPU system only delays the thread we're
+     * waiting for.
+     */
+    inline int syncSpinCount() {
+        static const int count =
+            std::thread::hardware_concurrency() > 1 ? 2000 : 0;
+        return count;
+    }
+
+    /**
+     * The bit in the futex words of Latch and Barrier which is set when
+     * someone is (or is about to be) parked on the word. Keeping it in
+     * the same word means the thread releasing the waiters knows if it
+     * needs to wake them from the value its RMW returned, and doesn't
+     * touch the object after the release (a waiter may destroy it as
+     * soon as it sees the release). futexWake only uses the address.
+     */
+    const uint32_t SyncWaitersBit = 0x80000000;
+
+    /**
+     * A single use countdown: threads calling wait() block until
+     * countDown() has been called count times.
+     *
+     * The waiters spin for a short while before parking on a futex, and
+     * countDown() only makes a system call if someone is parked.
+     */
+    class Latch {
+    public:
+        /**
+         * @param count the number of countDown() calls to wait for (less
+         *              than SyncWaitersBit)
+         */
+        explicit Latch(uint32_t count)
+            : remaining(count) {
+        }
+
+        Latch(const Latch&) = delete;
+
+        /**
+         * Decrement the counter, and release the waiters if it reaches 0
+         */
+        void countDown(uint32_t n = 1) {
+            const uint32_t old =
+                remaining.fetch_sub(n, std::memory_order_acq_rel);
+            if ((old & ~SyncWaitersBit) == n && (old & SyncWaitersBit)) {
+                futexWakeAll(remaining);
+            }
+        }
+
+        /**
+         * Has the counter reached 0?
+         */
+        bool tryWait() const {
+            return (remaining.load(std::memory_order_acquire) &
+                    ~SyncWaitersBit) == 0;
+        }
+
+        /**
+         * Wait for the counter to reach 0
+         */
+        void wait() {
+            for (int ii = 0; ii < syncSpinCount(); ++ii) {
+                if (tryWait()) {
+                    return;
+                }
+                cpuRelax();
+            }
+
+            // Either countDown() sees the waiters bit, or the CAS fails
+            // and we see the new count
+            uint32_t value = remaining.load(std::memory_order_acquire);
+            while ((value & ~SyncWaitersBit) != 0) {
+                if ((value & SyncWaitersBit) == 0) {
+                    if (!remaining.compare_exchange_weak(
+                            value, value | SyncWaitersBit,
+                            std::memory_order_acquire)) {
+                        continue;
+                    }
+                    value |= SyncWaitersBit;
+                }
+                futexWait(remaining, value);
+                value = remaining.load(std::memory_order_acquire);
+            }
+        }
+
+        /**
+         * Count down and wait for the counter to reach 0
+         */
+        void arriveAndWait(uint32_t n = 1) {
+            countDown(n);
+            wait();
+        }
+
+    private:
+        /** The count, and SyncWaitersBit */
+        std::atomic<uint32_t> remaining;
+    };
+
+    /**
+     * A reusable barrier for a fixed number of threads: every call to
+     * arriveAndWait() blocks until all of the threads have arrived, and
+     * then the barrier is ready for the next phase.
+     *
+     * The arrival counter (written by every arriving thread) and the
+     * generation (polled by the waiting threads) live on separate cache
+     * lines, so the spinning threads don't slow down the arrivals.
+     */
+    class Barrier {
+    public:
+        explicit Barrier(uint32_t count_)
+            : count(count_),
+              arrived(0),
+              generation(0) {
+        }
+
+        Barrier(const Barrier&) = delete;
+
+        /**
+         * Wait for all of the threads to arrive
+         *
+         * @return true for exactly one of the threads in each phase (the
+         *         last one to arrive), which may be used to elect a thread
+         *         to do the serial work between two phases
+         */
+        bool arriveAndWait() {
+            const uint32_t gen = generation.load(std::memory_order_acquire) &
+                                 ~SyncWaitersBit;
+            if (arrived.fetch_add(1, std::memory_order_acq_rel) + 1 ==
+                count) {
+                // Nobody can arrive for the next phase before they see
+                // the new generation
+                arrived.store(0, std::memory_order_relaxed);
+                const uint32_t old = generation.exchange(
+                    (gen + 1) & ~SyncWaitersBit, std::memory_order_acq_rel);
+                if (old & SyncWaitersBit) {
+                    futexWakeAll(generation);
+                }
+                return true;
+            }
+
+            for (int ii = 0; ii < syncSpinCount(); ++ii) {
+                if ((generation.load(std::memory_order_acquire) &
+                     ~SyncWaitersBit) != gen) {
+                    return false;
+                }
+                cpuRelax();
+            }
+
+            // Either the last thread to arrive sees the waiters bit, or
+            // the CAS fails and we see the new generation
+            uint32_t value = generation.load(std::memory_order_acquire);
+            while ((value & ~SyncWaitersBit) == gen) {
+                if ((value & SyncWaitersBit) == 0) {
+                    if (!generation.compare_exchange_weak(
+                            value, value | SyncWaitersBit,
+                            std::memory_order_acquire)) {
+                        continue;
+                    }
+                    value |= SyncWaitersBit;
+                }
+                futexWait(generation, value);
+                value = generation.load(std::memory_order_acquire);
+            }
+            return false;
+        }
+
+    private:
+        const uint32_t count;
+
+        // Padded rather than aligned (see CacheLineSize)
+        CacheLinePad pad0;
+
+        std::atomic<uint32_t> arrived;
+        CacheLinePad pad1;
+
+        /** The phase (wrapping at SyncWaitersBit), and SyncWaitersBit */
+        std::atomic<uint32_t> generation;
+        CacheLinePad pad2;
+    };
+}
@@ -0,0 +1,150 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/cacheline.h>
+#include <platform/eventcount.h>
+#include <platform/futex.h>
+
+#include <cstddef>
+#include <thread>
+#include <utility>
+
+namespace Couchbase {
+
+    /**
+     * Blocking push and pop on top of one of the lock free queues
+     * (MPMCQueue or SPSCQueue).
+     *
+     * A consumer only parks when the queue is empty, and a producer only
+     * parks when it is full. Both spin for a short while before parking.
+     * As long as nobody is parked the only cost over the lock free queue
+     * is a fence and a load per operation.
+     *
+     * The single producer / single consumer restrictions of the
+     * underlying queue still apply.
+     */
+    template <typename Queue>
+    class BlockingQueue {
+    public:
+        typedef typename Queue::value_type value_type;
+
+        explicit BlockingQueue(size_t capacity)
+            : queue(capacity) {
+        }
+
+        BlockingQueue(const BlockingQueue&) = delete;
+
+        template <typename U>
+        bool tryPush(U&& element) {
+            if (queue.tryPush(std::forward<U>(element))) {
+                notEmpty.notify();
+                return true;
+            }
+            return false;
+        }
+
+        bool tryPop(value_type& element) {
+            if (queue.tryPop(element)) {
+                notFull.notify();
+                return true;
+            }
+            return false;
+        }
+
+        /**
+         * Push an element, waiting for room in the queue if it is full
+         */
+        template <typename U>
+        void push(U&& element) {
+            // The queue only moves from the element if the push succeeds,
+            // so it is safe to forward it more than once
+            for (int ii = 0; ii < spinCount(); ++ii) {
+                if (tryPush(std::forward<U>(element))) {
+                    return;
+                }
+                cpuRelax();
+            }
+            while (true) {
+                const auto key = notFull.prepareWait();
+                if (queue.tryPush(std::forward<U>(element))) {
+                    notFull.cancelWait();
+                    notEmpty.notify();
+                    return;
+                }
+                notFull.wait(key);
+                if (tryPush(std::forward<U>(element))) {
+                    return;
+                }
+            }
+        }
+
+        /**
+         * Pop an element, waiting for one to arrive if the queue is empty
+         */
+        void pop(value_type& element) {
+            for (int ii = 0; ii < spinCount(); ++ii) {
+                if (tryPop(element)) {
+                    return;
+                }
+                cpuRelax();
+            }
+            while (true) {
+                const auto key = notEmpty.prepareWait();
+                if (queue.tryPop(element)) {
+                    notEmpty.cancelWait();
+                    notFull.notify();
+                    return;
+                }
+                notEmpty.wait(key);
+                if (tryPop(element)) {
+                    return;
+                }
+            }
+        }
+
+        size_t capacity() const {
+            return queue.capacity();
+        }
+
+        size_t sizeGuess() const {
+            return queue.sizeGuess();
+        }
+
+        bool empty() const {
+            return queue.empty();
+        }
+
+    private:
+        /**
+         * Number of attempts before parking the thread. Spinning on a
+         * single CPU system only delays the thread we're waiting for.
+         */
+        static int spinCount() {
+            static const int count =
+                std::thread::hardware_concurrency() > 1 ? 64 : 0;
+            return count;
+        }
+
+        Queue queue;
+        // Consumers wait on notEmpty and producers on notFull; keep them
+        // on separate cache lines
+        EventCount notEmpty;
+        CacheLinePad pad0;
+        EventCount notFull;
+    };
+}
@@ -0,0 +1,42 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+
+namespace Couchbase {
+    /**
+     * The size of a cache line on the platforms we support. Use it to
+     * keep data written by different threads on separate cache lines
+     * (to avoid false sharing).
+     *
+     * Separate the members with CacheLineSize bytes of padding rather
+     * than using alignas: the objects are typically heap allocated, and
+     * operator new isn't required to honour extended alignment before
+     * C++17 (neither is std::allocator).
+     */
+    const size_t CacheLineSize = 64;
+
+    /**
+     * A full cache line of padding, for use as a member (or base class)
+     * in front of data which must not share a cache line with what
+     * precedes it
+     */
+    struct CacheLinePad {
+        char pad[CacheLineSize];
+    };
+}
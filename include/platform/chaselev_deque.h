@@ -0,0 +1,197 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/cacheline.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace Couchbase {
+
+    /**
+     * A Chase-Lev work stealing deque (using the memory orderings from
+     * "Correct and Efficient Work-Stealing for Weak Memory Models" by
+     * Lê, Pop, Cohen and Zappa Nardelli).
+     *
+     * The owner of the deque push() and take() elements at the bottom
+     * (LIFO), while any other thread may steal() elements from the top
+     * (FIFO). The deque grows as needed, and the old buffers are kept
+     * around until the deque is destroyed as a thief may still be reading
+     * from them.
+     *
+     * T must be trivially copyable (typically a pointer to the element).
+     */
+    template <typename T>
+    class ChaseLevDeque {
+    public:
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "ChaseLevDeque requires a trivially copyable type");
+
+        explicit ChaseLevDeque(size_t capacity = 64)
+            : top(0),
+              bottom(0) {
+            size_t size = 1;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            buffers.emplace_back(new Buffer(size));
+            buffer.store(buffers.back().get(), std::memory_order_relaxed);
+        }
+
+        ChaseLevDeque(const ChaseLevDeque&) = delete;
+
+        /**
+         * Push an element to the bottom of the deque. Only to be called
+         * by the owner of the deque.
+         *
+         * @throws std::bad_alloc if we need to grow the deque and fail
+         *                        to allocate memory
+         */
+        void push(T element) {
+            const int64_t b = bottom.load(std::memory_order_relaxed);
+            const int64_t t = top.load(std::memory_order_acquire);
+            Buffer* a = buffer.load(std::memory_order_relaxed);
+            if (b - t > int64_t(a->mask)) {
+                a = grow(a, t, b);
+            }
+            a->put(b, element);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        /**
+         * Take the element from the bottom of the deque. Only to be called
+         * by the owner of the deque.
+         *
+         * @param element where to store the element
+         * @return true if an element was returned, false if the deque was
+         *         empty
+         */
+        bool take(T& element) {
+            const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+            Buffer* a = buffer.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = top.load(std::memory_order_relaxed);
+
+            if (t > b) {
+                // The deque was empty
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return false;
+            }
+
+            element = a->get(b);
+            if (t == b) {
+                // Last element; race against the thieves
+                const bool won = top.compare_exchange_strong(
+                    t, t + 1, std::memory_order_seq_cst,
+                    std::memory_order_relaxed);
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return won;
+            }
+            return true;
+        }
+
+        /**
+         * Steal the element from the top of the deque. May be called from
+         * any thread.
+         *
+         * @param element where to store the element
+         * @return true if an element was returned, false if the deque was
+         *         empty or we lost the race for the element
+         */
+        bool steal(T& element) {
+            int64_t t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const int64_t b = bottom.load(std::memory_order_acquire);
+            if (t >= b) {
+                return false;
+            }
+
+            Buffer* a = buffer.load(std::memory_order_acquire);
+            T ret = a->get(t);
+            if (!top.compare_exchange_strong(t, t + 1,
+                                             std::memory_order_seq_cst,
+                                             std::memory_order_relaxed)) {
+                return false;
+            }
+            element = ret;
+            return true;
+        }
+
+        /**
+         * Get a snapshot of the number of elements in the deque. The value
+         * may be stale by the time the method returns unless called by the
+         * owner without any thieves around.
+         */
+        size_t size() const {
+            const int64_t b = bottom.load(std::memory_order_relaxed);
+            const int64_t t = top.load(std::memory_order_relaxed);
+            return b > t ? size_t(b - t) : 0;
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+    private:
+        struct Buffer {
+            explicit Buffer(size_t size)
+                : mask(size - 1),
+                  elements(new std::atomic<T>[size]) {
+            }
+
+            T get(int64_t index) const {
+                return elements[index & mask].load(std::memory_order_relaxed);
+            }
+
+            void put(int64_t index, T element) {
+                elements[index & mask].store(element,
+                                             std::memory_order_relaxed);
+            }
+
+            const size_t mask;
+            std::unique_ptr<std::atomic<T>[]> elements;
+        };
+
+        Buffer* grow(Buffer* old, int64_t t, int64_t b) {
+            std::unique_ptr<Buffer> next(new Buffer((old->mask + 1) * 2));
+            for (int64_t ii = t; ii < b; ++ii) {
+                next->put(ii, old->get(ii));
+            }
+            Buffer* ret = next.get();
+            buffers.emplace_back(std::move(next));
+            buffer.store(ret, std::memory_order_release);
+            return ret;
+        }
+
+        // Keep top (written by the thieves) and bottom (written by the
+        // owner) on separate cache lines (see CacheLineSize)
+        std::atomic<int64_t> top;
+        CacheLinePad pad0;
+        std::atomic<int64_t> bottom;
+        CacheLinePad pad1;
+        std::atomic<Buffer*> buffer;
+
+        /** All buffers ever used (only accessed by the owner) */
+        std::vector<std::unique_ptr<Buffer> > buffers;
+    };
+}
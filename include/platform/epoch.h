@@ -0,0 +1,116 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/platform.h>
+
+namespace Couchbase {
+
+    /**
+     * Epoch based memory reclamation, for data structures which are
+     * published with an atomic pointer and read without locks.
+     *
+     * Readers access the structure inside an EpochGuard. A writer
+     * replaces the pointer and retires the old object, which is deleted
+     * once every reader which might still see it has left its guard:
+     *
+     *     std::atomic<Config*> config;
+     *
+     *     // reader
+     *     {
+     *         Couchbase::EpochGuard guard;
+     *         Config* current = config.load(std::memory_order_acquire);
+     *         ... use current ...
+     *     }
+     *
+     *     // writer
+     *     Config* old = config.exchange(new Config(...));
+     *     Couchbase::Epoch::retire(old);
+     *
+     * Entering and leaving a guard costs a thread local lookup, a store
+     * and a fence. The retired objects are kept in a per thread list and
+     * deleted in batches, so a retire is cheap as well.
+     *
+     * The bookkeeping for a thread is released when it exits (see
+     * ThreadLocalBase::threadExit); objects it retired which can't be
+     * deleted yet are handed over to the remaining threads.
+     */
+    namespace Epoch {
+
+        /**
+         * Enter a read side critical section (may be nested)
+         */
+        PLATFORM_PUBLIC_API
+        void enter();
+
+        /**
+         * Leave a read side critical section
+         */
+        PLATFORM_PUBLIC_API
+        void exit();
+
+        /**
+         * Delete the object (by calling deleter(ptr)) once all of the
+         * readers currently in a critical section have left it.
+         *
+         * It may be called from within a critical section.
+         */
+        PLATFORM_PUBLIC_API
+        void retire(void* ptr, void (*deleter)(void*));
+
+        template <typename T>
+        void retire(T* ptr) {
+            retire(ptr, [](void* p) { delete static_cast<T*>(p); });
+        }
+
+        /**
+         * Delete the calling thread's retired objects (and those left by
+         * exited threads) which are no longer visible to any reader.
+         * Doesn't block.
+         */
+        PLATFORM_PUBLIC_API
+        void reclaim();
+
+        /**
+         * Wait for all of the readers currently in a critical section to
+         * leave it, and delete the calling thread's retired objects (and
+         * those left by exited threads).
+         *
+         * @throws std::logic_error if called from within a critical
+         *                          section (it would never return)
+         */
+        PLATFORM_PUBLIC_API
+        void synchronize();
+    }
+
+    /**
+     * Holds a read side critical section for its lifetime
+     */
+    class EpochGuard {
+    public:
+        EpochGuard() {
+            Epoch::enter();
+        }
+
+        ~EpochGuard() {
+            Epoch::exit();
+        }
+
+        EpochGuard(const EpochGuard&) = delete;
+        EpochGuard& operator=(const EpochGuard&) = delete;
+    };
+}
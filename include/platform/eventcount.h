@@ -0,0 +1,119 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/futex.h>
+
+#include <atomic>
+#include <cstdint>
+
+namespace Couchbase {
+
+    /**
+     * An event count lets a thread block until a condition (typically
+     * "the lock free queue isn't empty") becomes true, without a mutex.
+     * The notifying side only pays for a fence and a load as long as
+     * nobody is waiting.
+     *
+     * The waiter must use the following protocol:
+     *
+     *     if (tryPop(item)) return;
+     *     auto key = eventCount.prepareWait();
+     *     if (tryPop(item)) {
+     *         eventCount.cancelWait();
+     *         return;
+     *     }
+     *     eventCount.wait(key);
+     *     // retry
+     *
+     * and the notifier calls notify() (or notifyAll()) after it made the
+     * condition true.
+     */
+    class EventCount {
+    public:
+        typedef uint32_t Key;
+
+        EventCount()
+            : epoch(0),
+              waiters(0) {
+        }
+
+        EventCount(const EventCount&) = delete;
+
+        /**
+         * Announce that we're about to wait. Must be followed by
+         * either cancelWait() or wait().
+         *
+         * @return the key to pass to wait()
+         */
+        Key prepareWait() {
+            waiters.fetch_add(1, std::memory_order_seq_cst);
+            return epoch.load(std::memory_order_acquire);
+        }
+
+        /**
+         * The condition became true after prepareWait(); don't wait.
+         */
+        void cancelWait() {
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        /**
+         * Block until someone calls notify after our prepareWait()
+         *
+         * @param key the key returned from prepareWait()
+         */
+        void wait(Key key) {
+            while (epoch.load(std::memory_order_acquire) == key) {
+                futexWait(epoch, key);
+            }
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        /**
+         * Wake up one of the waiting threads (if any)
+         */
+        void notify() {
+            if (hasWaiters()) {
+                epoch.fetch_add(1, std::memory_order_release);
+                futexWake(epoch, 1);
+            }
+        }
+
+        /**
+         * Wake up all of the waiting threads
+         */
+        void notifyAll() {
+            if (hasWaiters()) {
+                epoch.fetch_add(1, std::memory_order_release);
+                futexWakeAll(epoch);
+            }
+        }
+
+    private:
+        bool hasWaiters() {
+            // Pairs with the increment in prepareWait(). Either we see
+            // the waiter, or the waiter sees the condition we just made
+            // true when it re-checks it.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return waiters.load(std::memory_order_relaxed) != 0;
+        }
+
+        std::atomic<uint32_t> epoch;
+        std::atomic<uint32_t> waiters;
+    };
+}
@@ -0,0 +1,123 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/platform.h>
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+namespace Couchbase {
+
+    /**
+     * The priority of a task scheduled on the Executor. A worker always
+     * looks for High priority work (in its own deque, the shared queue and
+     * by stealing from the other workers) before it looks for Normal
+     * priority work and so on.
+     */
+    enum class TaskPriority {
+        High = 0,
+        Normal = 1,
+        Low = 2
+    };
+
+    /**
+     * The Executor is a pool of worker threads which run tasks.
+     *
+     * Each worker owns a Chase-Lev deque per priority. Tasks scheduled from
+     * a worker (e.g. a task splitting its work into smaller tasks) are
+     * pushed to the worker's own deque, whereas tasks scheduled from
+     * other threads are put in a shared queue. An idle worker steals tasks
+     * from the other workers before it goes to sleep.
+     */
+    class PLATFORM_PUBLIC_API Executor {
+    public:
+        /**
+         * Create a new Executor and start all of its workers
+         *
+         * @param name the prefix for the thread names of the workers (the
+         *             worker number is appended, and the result is
+         *             truncated to 15 characters)
+         * @param workers the number of worker threads to create
+         * @throws std::invalid_argument if workers is 0
+         * @throws std::bad_alloc if we fail to create the worker threads
+         */
+        Executor(const std::string& name, size_t workers);
+
+        /**
+         * Run all of the scheduled tasks and stop the workers
+         */
+        ~Executor();
+
+        Executor(const Executor&) = delete;
+
+        /**
+         * Schedule a task to be run.
+         *
+         * The task should not throw any exceptions (any exception thrown
+         * is silently ignored). Use submit() if you need the result.
+         *
+         * @param task the task to run
+         * @param priority the priority of the task
+         * @throws std::logic_error if the executor is shutting down
+         */
+        void post(std::function<void()> task,
+                  TaskPriority priority = TaskPriority::Normal);
+
+        /**
+         * Schedule a task to be run, and get a future for its result (or
+         * the exception it throws).
+         *
+         * @param task the task to run
+         * @param priority the priority of the task
+         * @throws std::logic_error if the executor is shutting down
+         */
+        template <typename F>
+        std::future<typename std::result_of<F()>::type> submit(
+                F task, TaskPriority priority = TaskPriority::Normal) {
+            typedef typename std::result_of<F()>::type R;
+            auto packaged = std::make_shared<std::packaged_task<R()> >(
+                std::move(task));
+            auto ret = packaged->get_future();
+            post([packaged]() { (*packaged)(); }, priority);
+            return ret;
+        }
+
+        /**
+         * Get the number of worker threads
+         */
+        size_t getWorkers() const;
+
+        /**
+         * Is the calling thread one of this executor's workers?
+         */
+        bool isWorkerThread() const;
+
+        /**
+         * Get the number of tasks which have been scheduled but not yet
+         * started (only a snapshot; intended for statistics)
+         */
+        size_t getPendingTasks() const;
+
+    private:
+        struct Impl;
+        std::unique_ptr<Impl> impl;
+    };
+}
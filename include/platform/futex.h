@@ -0,0 +1,61 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/cpu_relax.h>
+#include <platform/platform.h>
+
+#include <atomic>
+#include <cstdint>
+
+namespace Couchbase {
+
+    /**
+     * Block the calling thread while word contains the expected value.
+     *
+     * On Linux this is a thin wrapper around the futex system call.
+     * On other platforms the threads are parked in a hashed table of
+     * condition variables.
+     *
+     * The wait may return spuriously, so the caller must always re-check
+     * the condition it is waiting for.
+     *
+     * @param word the word to wait on
+     * @param expected block only if word contains this value
+     * @param timeout the maximum number of nanoseconds to wait
+     *                (UINT64_MAX means wait forever)
+     * @return false if the wait timed out, true otherwise
+     */
+    PLATFORM_PUBLIC_API
+    bool futexWait(std::atomic<uint32_t>& word, uint32_t expected,
+                   uint64_t timeout = UINT64_MAX);
+
+    /**
+     * Wake up to count threads blocked in futexWait on word
+     *
+     * @param word the word the threads are waiting on
+     * @param count the maximum number of threads to wake
+     */
+    PLATFORM_PUBLIC_API
+    void futexWake(std::atomic<uint32_t>& word, int count);
+
+    /**
+     * Wake up all threads blocked in futexWait on word
+     */
+    PLATFORM_PUBLIC_API
+    void futexWakeAll(std::atomic<uint32_t>& word);
+}
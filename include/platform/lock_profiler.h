@@ -0,0 +1,109 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/platform.h>
+
+#include <string>
+
+namespace Couchbase {
+
+    /**
+     * Contention profiling of the cb_mutex_t and cb_rwlock_t locks.
+     *
+     * When profiling is disabled (the default) the lock functions only
+     * pay for a relaxed load of a global flag. When it is enabled every
+     * acquisition is timed and recorded in a registry keyed by the
+     * address of the lock:
+     *
+     *   * the number of acquisitions, and how many of them had to wait
+     *   * a histogram of the time spent waiting for the lock (in usec)
+     *   * a histogram of the time the lock was held (in usec)
+     *   * backtraces of a sample of the contended acquisitions
+     *
+     * The statistics for a lock are dropped when the lock is destroyed.
+     */
+    namespace LockProfiler {
+
+        /**
+         * Start profiling lock acquisitions. Locks already held when
+         * profiling is enabled don't get their hold time recorded.
+         */
+        PLATFORM_PUBLIC_API
+        void enable();
+
+        /**
+         * Stop profiling lock acquisitions. The collected statistics are
+         * kept until reset() is called.
+         */
+        PLATFORM_PUBLIC_API
+        void disable();
+
+        PLATFORM_PUBLIC_API
+        bool isEnabled();
+
+        /**
+         * Capture a backtrace for every n'th contended acquisition
+         * (per thread). 0 disables the backtrace collection.
+         * The default is 100.
+         */
+        PLATFORM_PUBLIC_API
+        void setBacktraceSampleRate(unsigned int n);
+
+        /**
+         * Give a lock a name to use in the dump instead of its address.
+         *
+         * @param lock pointer to the cb_mutex_t or cb_rwlock_t
+         * @param name the name to use
+         */
+        PLATFORM_PUBLIC_API
+        void setName(const void* lock, const std::string& name);
+
+        /**
+         * Clear all of the collected statistics (the names are kept)
+         */
+        PLATFORM_PUBLIC_API
+        void reset();
+
+        /**
+         * Get the collected statistics as a JSON document. The locks are
+         * listed with the most contended lock first:
+         *
+         *     {
+         *       "enabled": true,
+         *       "locks": [
+         *         {
+         *           "name": "bucket lock",
+         *           "address": "0x7f2c3c0010a0",
+         *           "type": "mutex",
+         *           "acquisitions": 1024,
+         *           "contended": 12,
+         *           "wait_usec": {"total": 344, "max": 128,
+         *                         "histogram": [[0, 1, 1012], ...]},
+         *           "hold_usec": { ... },
+         *           "backtraces": [{"count": 1, "backtrace": "..."}]
+         *         }
+         *       ]
+         *     }
+         *
+         * The histogram entries are [start, end, count] and empty bins
+         * are left out.
+         */
+        PLATFORM_PUBLIC_API
+        std::string toJSON();
+    }
+}
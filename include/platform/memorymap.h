@@ -21,16 +21,153 @@
 
 #include <inttypes.h>
 #include <stddef.h>
+#include <cstdint>
 #include <cstdio>
+#include <future>
+#include <map>
+#include <mutex>
 #include <string>
 
 namespace Couchbase {
     class PLATFORM_PUBLIC_API MemoryMappedFile {
     public:
+        /**
+         * The expected access pattern for (a range of) the mapping, used
+         * by the kernel to tune readahead and page reclaim
+         */
+        enum class Advice {
+            /** No special treatment (the default) */
+            Normal,
+            /** Pages will be accessed in sequential order */
+            Sequential,
+            /** Pages will be accessed in random order (no readahead) */
+            Random,
+            /** The pages will be accessed soon; start reading them in */
+            WillNeed,
+            /** The pages won't be accessed soon; they may be dropped */
+            DontNeed
+        };
+
+        /**
+         * The kind of huge pages to back the mapping with
+         */
+        enum class HugePages {
+            /** Use the normal page size (the default) */
+            None,
+            /**
+             * Ask for transparent huge pages (MADV_HUGEPAGE). The kernel
+             * only uses them for anonymous memory and the file systems
+             * supporting them (e.g. tmpfs)
+             */
+            Transparent,
+            /**
+             * Use pages reserved in hugetlbfs: MAP_HUGETLB for anonymous
+             * mappings, or a file stored in a hugetlbfs mount. Falls back
+             * to transparent huge pages if none are available
+             */
+            HugeTLB
+        };
+
+        /**
+         * How sync() waits for the data to be written
+         */
+        enum class SyncMode {
+            /** Start writing the dirty pages back and return */
+            Async,
+            /** Wait until the dirty pages are written to the file */
+            Sync
+        };
+
+#ifdef WIN32
+        typedef HANDLE FileHandle;
+#else
+        typedef int FileHandle;
+#endif
+
         ~MemoryMappedFile();
 
         MemoryMappedFile(const char *fname, bool share, bool rdonly);
 
+        /**
+        * Create an anonymous (private, writable and zero filled) mapping
+        * of the given size instead of mapping a file
+        */
+        explicit MemoryMappedFile(size_t length);
+
+        /**
+        * Set the access pattern advice applied to the whole mapping by
+        * open(). Must be called before open().
+        */
+        void setOpenAdvice(Advice advice) {
+            openAdvice = advice;
+        }
+
+        /**
+        * Read the whole file into the page cache and map it in open()
+        * (MAP_POPULATE where supported), so that the first accesses
+        * don't page fault. Must be called before open().
+        */
+        void setPopulate(bool enable) {
+            populate = enable;
+        }
+
+        /**
+        * Request huge pages for the mapping (to reduce the TLB misses
+        * of random access to a large mapping). Huge pages are a hint;
+        * the mapping falls back to normal pages if they're not available
+        * (see getMappingPageSize). Must be called before open().
+        */
+        void setHugePages(HugePages mode) {
+            hugePages = mode;
+        }
+
+        /**
+        * Make the mapping growable (see grow()). Address space for
+        * maxSize bytes is reserved by open(), so the root pointer stays
+        * the same as the file grows. Only shared mappings may grow, and
+        * the file is created by open() if it doesn't exist. Huge pages
+        * aren't used for growable mappings. Must be called before open().
+        *
+        * @param maxSize the size the file may grow to (0 to disable)
+        */
+        void setGrowable(size_t maxSize_) {
+            maxSize = maxSize_;
+        }
+
+        /**
+        * Only map part of the file. getRoot() then points at the byte at
+        * offset in the file, and getSize() returns the size of the part
+        * mapped. Can't be combined with setGrowable(). Must be called
+        * before open().
+        *
+        * @param offset the start of the part to map (a multiple of
+        *               getAllocationGranularity())
+        * @param length the number of bytes to map (clipped to the end of
+        *               the file)
+        */
+        void setRange(uint64_t offset, size_t length) {
+            rangeOffset = offset;
+            rangeLength = length;
+        }
+
+        /**
+        * Map a file the caller already has open instead of opening fname
+        * (which is then only used in error messages), so that many
+        * mappings of one file don't have to look it up and open it again.
+        * The handle must be opened in a mode matching the share and
+        * rdonly arguments, and isn't closed by close(); it must stay open
+        * until the mapping is closed. Can't be combined with
+        * setGrowable(). Must be called before open().
+        *
+        * @param handle the open file
+        * @param fileSize_ the size of the file
+        */
+        void setFileHandle(FileHandle handle, uint64_t fileSize_) {
+            filehandle = handle;
+            externalHandle = true;
+            fileSize = fileSize_;
+        }
+
         /**
         * Open the mapping. Throws an std::string with a reason why
         * in case of a failure.
@@ -64,19 +201,178 @@ namespace Couchbase {
             return size;
         }
 
+        /**
+        * Grow the file (and the mapping) in place. The new part of the
+        * file is allocated up front, so running out of disk space is
+        * reported here rather than when the memory is written to. The
+        * caller must make sure nobody accesses the mapping beyond the
+        * old size until grow() returns.
+        *
+        * @param newSize the new size of the file (nothing happens if the
+        *                file is already at least that big)
+        * @throws std::string if the mapping isn't growable, newSize is
+        *         bigger than its max size or the file couldn't be grown
+        */
+        void grow(size_t newSize);
+
+        /**
+        * Give the kernel advice about how a range of the mapping will be
+        * accessed. The range is extended to page boundaries and clipped
+        * to the size of the mapping. Platforms which don't support a
+        * kind of advice ignore it.
+        *
+        * @param advice the expected access pattern
+        * @param offset the start of the range
+        * @param length the length of the range (the default is the rest
+        *               of the mapping)
+        * @throws std::string if the advice was rejected
+        */
+        void advise(Advice advice, size_t offset = 0,
+                    size_t length = SIZE_MAX);
+
+        /**
+        * Fault in a range of the mapping from another thread (touching a
+        * byte in every page), so that the caller may warm up the mapping
+        * while it does other work. The mapping must not be closed before
+        * the returned future is ready.
+        *
+        * @param offset the start of the range
+        * @param length the length of the range (the default is the rest
+        *               of the mapping)
+        * @return a future which is ready once the range is resident
+        */
+        std::future<void> prefetchAsync(size_t offset = 0,
+                                        size_t length = SIZE_MAX);
+
+        /**
+        * Flush a range of a shared mapping to the file (msync). The range
+        * is extended to page boundaries and clipped to the size of the
+        * mapping. Private mappings aren't written back, so this is a
+        * no-op for them.
+        *
+        * @param offset the start of the range
+        * @param length the length of the range (the default is the rest
+        *               of the mapping)
+        * @param mode if the call should wait for the data to be written
+        * @throws std::string if the flush failed
+        */
+        void sync(size_t offset = 0, size_t length = SIZE_MAX,
+                  SyncMode mode = SyncMode::Sync);
+
+        /**
+        * Record that a range of the mapping has been modified, so that
+        * flushDirty() only needs to flush the modified parts of a large
+        * mapping. Overlapping and adjacent ranges are merged. May be
+        * called from multiple threads.
+        */
+        void markDirty(size_t offset, size_t length);
+
+        /**
+        * Flush the ranges recorded by markDirty() and forget about them.
+        * If a flush fails the ranges not yet flushed are kept (so the
+        * call may be retried).
+        *
+        * @param mode if the call should wait for the data to be written
+        * @throws std::string if the flush failed
+        */
+        void flushDirty(SyncMode mode = SyncMode::Sync);
+
+        /**
+        * Get the number of bytes (in whole pages) recorded as dirty
+        */
+        size_t getDirtySize() const;
+
+        /**
+        * Get the size of the pages used by the mapping
+        */
+        static size_t getPageSize();
+
+        /**
+        * Get the alignment required for the offset passed to setRange()
+        * (the page size, or 64k on Windows)
+        */
+        static size_t getAllocationGranularity();
+
+        /**
+        * Get the default size of the huge pages on this system (0 if
+        * huge pages aren't supported)
+        */
+        static size_t getHugePageSize();
+
+        /**
+        * Get the size of the pages actually backing the mapping: the
+        * huge page size if huge pages were obtained, otherwise the
+        * normal page size. Transparent huge pages are assembled by the
+        * kernel as the memory is used, so this reports that the mapping
+        * is eligible for them.
+        */
+        size_t getMappingPageSize() const {
+            if (root == NULL) {
+                throw std::string("Internal error, open() not called");
+            }
+            return mappingPageSize;
+        }
+
     private:
         MemoryMappedFile(MemoryMappedFile &) = delete;
 
+        /**
+        * Extend the range to page boundaries and clip it to the size of
+        * the mapping
+        *
+        * @return false if the range is empty
+        */
+        bool alignRange(size_t& offset, size_t& length) const;
+
+        /**
+        * Apply the advice to a page aligned range (platform specific)
+        */
+        void doAdvise(Advice advice, size_t offset, size_t length);
+
+        /**
+        * Flush a page aligned range (platform specific)
+        */
+        void doSync(size_t offset, size_t length, SyncMode mode);
+
+#ifdef WIN32
+        /**
+        * Create the anonymous mapping (with large pages if requested)
+        */
+        void openAnonymous();
+#else
+        /**
+        * Fault in a mapping which is aligned for transparent huge pages
+        * (after asking for them)
+        */
+        void populateHugePages();
+#endif
+
         std::string filename;
+        FileHandle filehandle;
 #ifdef WIN32
-        HANDLE filehandle;
         HANDLE maphandle;
-#else
-        int filehandle;
 #endif
+        /** Was filehandle provided by setFileHandle()? */
+        bool externalHandle;
+        /** The size of the file (if externalHandle is set) */
+        uint64_t fileSize;
         void *root;
         size_t size;
         bool sharedMapping;
         bool readonly;
+        bool anonymous;
+        Advice openAdvice;
+        bool populate;
+        HugePages hugePages;
+        size_t maxSize;
+        uint64_t rangeOffset;
+        size_t rangeLength;
+        /** The alignment of ranges in the mapping (and its length) */
+        size_t pageSize;
+        size_t mappingPageSize;
+
+        /** The dirty page aligned ranges of the mapping (start -> end) */
+        std::map<size_t, size_t> dirtyRanges;
+        mutable std::mutex dirtyMutex;
     };
 }
@@ -0,0 +1,175 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/cacheline.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace Couchbase {
+
+    /**
+     * A bounded lock free multi producer / multi consumer queue (the
+     * ring buffer described by Dmitry Vyukov).
+     *
+     * Each cell carries a sequence number telling if it is ready to be
+     * written or read for a given lap around the ring, so producers and
+     * consumers only contend on their own position counter. The two
+     * counters are kept on separate cache lines.
+     *
+     * T must be default constructible and move assignable. The element
+     * is only moved from in tryPush if the push succeeds.
+     */
+    template <typename T>
+    class MPMCQueue {
+    public:
+        typedef T value_type;
+
+        /**
+         * @param capacity the number of elements the queue can hold
+         *                 (rounded up to a power of two, minimum 2)
+         */
+        explicit MPMCQueue(size_t capacity)
+            : enqueuePos(0),
+              dequeuePos(0) {
+            size_t size = 2;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            mask = size - 1;
+            cells.reset(new Cell[size]);
+            for (size_t ii = 0; ii < size; ++ii) {
+                cells[ii].sequence.store(ii, std::memory_order_relaxed);
+            }
+        }
+
+        MPMCQueue(const MPMCQueue&) = delete;
+
+        bool tryPush(const T& element) {
+            size_t pos;
+            Cell* cell = claimPush(pos);
+            if (cell == nullptr) {
+                return false;
+            }
+            cell->data = element;
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool tryPush(T&& element) {
+            size_t pos;
+            Cell* cell = claimPush(pos);
+            if (cell == nullptr) {
+                return false;
+            }
+            cell->data = std::move(element);
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * Pop the oldest element from the queue
+         *
+         * @param element where to store the element
+         * @return true if an element was returned, false if the queue
+         *         was empty
+         */
+        bool tryPop(T& element) {
+            size_t pos = dequeuePos.load(std::memory_order_relaxed);
+            Cell* cell;
+            while (true) {
+                cell = &cells[pos & mask];
+                const size_t seq = cell->sequence.load(std::memory_order_acquire);
+                const intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+                if (diff == 0) {
+                    if (dequeuePos.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = dequeuePos.load(std::memory_order_relaxed);
+                }
+            }
+            element = std::move(cell->data);
+            cell->sequence.store(pos + mask + 1, std::memory_order_release);
+            return true;
+        }
+
+        size_t capacity() const {
+            return mask + 1;
+        }
+
+        /**
+         * Get an estimate of the number of elements in the queue
+         */
+        size_t sizeGuess() const {
+            const size_t enq = enqueuePos.load(std::memory_order_relaxed);
+            const size_t deq = dequeuePos.load(std::memory_order_relaxed);
+            return enq > deq ? enq - deq : 0;
+        }
+
+        bool empty() const {
+            return sizeGuess() == 0;
+        }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        /**
+         * Claim the cell for the next push
+         *
+         * @param pos set to the position of the claimed cell
+         * @return the cell, or nullptr if the queue is full
+         */
+        Cell* claimPush(size_t& pos) {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+            while (true) {
+                Cell* cell = &cells[pos & mask];
+                const size_t seq = cell->sequence.load(std::memory_order_acquire);
+                const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+                if (diff == 0) {
+                    if (enqueuePos.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed)) {
+                        return cell;
+                    }
+                } else if (diff < 0) {
+                    return nullptr;
+                } else {
+                    pos = enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Padded rather than aligned (see CacheLineSize)
+        CacheLinePad pad0;
+        std::atomic<size_t> enqueuePos;
+        CacheLinePad pad1;
+        std::atomic<size_t> dequeuePos;
+        CacheLinePad pad2;
+        size_t mask;
+        std::unique_ptr<Cell[]> cells;
+    };
+}
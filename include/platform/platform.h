@@ -125,6 +125,179 @@ extern "C" {
     int cb_create_named_thread(cb_thread_t *id, cb_thread_main_func func,
                                void *arg, int detached, const char* name);
 
+    /**
+     * The maximum number of CPUs a cb_cpuset_t may represent
+     */
+#define CB_MAX_CPUS 1024
+
+    /**
+     * A set of CPUs (used for thread affinity)
+     */
+    typedef struct {
+        uint64_t bits[CB_MAX_CPUS / 64];
+    } cb_cpuset_t;
+
+    /**
+     * Clear all CPUs in the set
+     */
+    PLATFORM_PUBLIC_API
+    void cb_cpuset_zero(cb_cpuset_t *set);
+
+    /**
+     * Add a CPU to the set
+     *
+     * @return 0 for success, -1 if cpu is out of range
+     */
+    PLATFORM_PUBLIC_API
+    int cb_cpuset_set(cb_cpuset_t *set, int cpu);
+
+    /**
+     * Check if a CPU is a member of the set
+     */
+    PLATFORM_PUBLIC_API
+    bool cb_cpuset_isset(const cb_cpuset_t *set, int cpu);
+
+    /**
+     * Get the number of CPUs in the set
+     */
+    PLATFORM_PUBLIC_API
+    int cb_cpuset_count(const cb_cpuset_t *set);
+
+    /**
+     * The scheduling policies a thread may be created with. Not all
+     * platforms support all policies (batch and idle are Linux specific)
+     */
+    typedef enum {
+        /** Inherit the scheduling policy from the creating thread */
+        CB_SCHED_DEFAULT = 0,
+        CB_SCHED_OTHER,
+        CB_SCHED_BATCH,
+        CB_SCHED_IDLE,
+        CB_SCHED_FIFO,
+        CB_SCHED_RR
+    } cb_sched_policy_t;
+
+    /**
+     * Options used when creating a thread with cb_create_named_thread_ex.
+     * Use cb_thread_options_initialize to get the default values.
+     */
+    typedef struct {
+        /** The size of the stack. 0 means the platform default */
+        size_t stack_size;
+        /** The scheduling policy for the thread */
+        cb_sched_policy_t sched_policy;
+        /** The scheduling priority (for CB_SCHED_FIFO and CB_SCHED_RR) */
+        int sched_priority;
+        /**
+         * Bind the thread to the CPUs of the given NUMA node (and prefer
+         * allocating memory from the node where supported). -1 means no
+         * NUMA binding
+         */
+        int numa_node;
+        /**
+         * The CPUs the thread may run on. An empty set means no affinity.
+         * If numa_node is set as well the thread is bound to the
+         * intersection of the two.
+         */
+        cb_cpuset_t affinity;
+    } cb_thread_options_t;
+
+    /**
+     * Initialize the thread options to the default values (no affinity,
+     * inherited scheduling and the default stack size)
+     */
+    PLATFORM_PUBLIC_API
+    void cb_thread_options_initialize(cb_thread_options_t *options);
+
+    /**
+     * Create a new thread (in a running state), with a name and options
+     * for stack size, scheduling, CPU affinity and NUMA placement.
+     *
+     * The affinity and NUMA binding is applied by the new thread before
+     * it calls func.
+     *
+     * @param id The thread identifier (returned)
+     * @param func The entry point for the newly created thread
+     * @param arg Arguments passed to the newly created thread
+     * @param detached Set to non-null if the thread should be
+     *                 created in a detached state (which you
+     *                 can't call cb_join_thread on).
+     * @param name Name of the thread (may be NULL). Maximum of 16
+     *             characters in length, including terminating '\0'.
+     * @param options The options for the thread (NULL for the defaults)
+     * @return 0 for success, -1 (or the error from the underlying thread
+     *         library) if the options are invalid, request a placement
+     *         the platform can't apply (an affinity where thread affinity
+     *         isn't supported) or the thread could not be created
+     */
+    PLATFORM_PUBLIC_API
+    int cb_create_named_thread_ex(cb_thread_t *id, cb_thread_main_func func,
+                                  void *arg, int detached, const char* name,
+                                  const cb_thread_options_t *options);
+
+    /**
+     * Set the CPU affinity for the calling thread. On Windows a thread
+     * runs within a single processor group (CPUs 64n to 64n + 63), so
+     * only the CPUs of the first group in the set are used.
+     *
+     * @param set the CPUs the thread may run on
+     * @return 0 for success, -1 if an error occurred (or the platform
+     *         doesn't support thread affinity)
+     */
+    PLATFORM_PUBLIC_API
+    int cb_set_thread_affinity(const cb_cpuset_t *set);
+
+    /**
+     * Get the CPU affinity for the calling thread
+     *
+     * @param set where to store the CPUs the thread may run on
+     * @return 0 for success, -1 if an error occurred (or the platform
+     *         doesn't support thread affinity)
+     */
+    PLATFORM_PUBLIC_API
+    int cb_get_thread_affinity(cb_cpuset_t *set);
+
+    /**
+     * Bind the calling thread to the CPUs of a NUMA node, and (if the
+     * platform supports it) prefer allocating memory from that node.
+     *
+     * @param node the NUMA node to bind to
+     * @return 0 for success, -1 if an error occurred
+     */
+    PLATFORM_PUBLIC_API
+    int cb_bind_thread_to_numa_node(int node);
+
+    /**
+     * Get the number of online CPUs
+     */
+    PLATFORM_PUBLIC_API
+    int cb_get_num_cpus(void);
+
+    /**
+     * Get the number of NUMA nodes (1 on platforms without NUMA support)
+     */
+    PLATFORM_PUBLIC_API
+    int cb_get_num_numa_nodes(void);
+
+    /**
+     * Get the CPUs belonging to a NUMA node
+     *
+     * @param node the NUMA node
+     * @param set where to store the CPUs
+     * @return 0 for success, -1 if the node doesn't exist, isn't online
+     *         or has no CPUs
+     */
+    PLATFORM_PUBLIC_API
+    int cb_get_numa_node_cpus(int node, cb_cpuset_t *set);
+
+    /**
+     * Get the NUMA node a CPU belongs to
+     *
+     * @return the node, or -1 if the CPU is unknown
+     */
+    PLATFORM_PUBLIC_API
+    int cb_get_cpu_numa_node(int cpu);
+
     /**
      * Wait for a thread to complete
      *
@@ -229,6 +402,60 @@ extern "C" {
     PLATFORM_PUBLIC_API
     void cb_mutex_exit(cb_mutex_t *mutex);
 
+    /**
+     * An adaptive mutex is a single word mutex which spins for a short
+     * while (with exponential backoff) before it parks the thread on a
+     * futex. Use it for short critical sections which see bursts of
+     * contention. It cannot be used with the cb_cond_* functions.
+     *
+     * See Couchbase::AdaptiveMutex in platform/adaptive_mutex.h for the
+     * C++ interface.
+     */
+    typedef struct {
+        uint32_t word;
+    } cb_adaptive_mutex_t;
+
+    /**
+     * Initialize an adaptive mutex (it must be initialized before use)
+     *
+     * @param mutex the mutex object to initialize
+     */
+    PLATFORM_PUBLIC_API
+    void cb_adaptive_mutex_initialize(cb_adaptive_mutex_t *mutex);
+
+    /**
+     * Destroy an adaptive mutex
+     *
+     * @param mutex the mutex object to destroy
+     */
+    PLATFORM_PUBLIC_API
+    void cb_adaptive_mutex_destroy(cb_adaptive_mutex_t *mutex);
+
+    /**
+     * Enter a section locked by an adaptive mutex
+     *
+     * @param mutex the mutex protecting this section
+     */
+    PLATFORM_PUBLIC_API
+    void cb_adaptive_mutex_enter(cb_adaptive_mutex_t *mutex);
+
+    /**
+     * Try to enter a section locked by an adaptive mutex
+     *
+     * @param mutex the mutex protecting this section
+     * @return 0 if the mutex was obtained, -1 otherwise
+     */
+    PLATFORM_PUBLIC_API
+    int cb_adaptive_mutex_try_enter(cb_adaptive_mutex_t *mutex);
+
+    /**
+     * Exit a section locked by an adaptive mutex
+     *
+     * @param mutex the mutex protecting this section
+     */
+    PLATFORM_PUBLIC_API
+    void cb_adaptive_mutex_exit(cb_adaptive_mutex_t *mutex);
+
     /***********************************************************************
      *                 Condition variable related functions                *
      **********************************************************************/
@@ -278,6 +505,42 @@ extern "C" {
     PLATFORM_PUBLIC_API
     void cb_cond_timedwait(cb_cond_t *cond, cb_mutex_t *mutex, unsigned int ms);
 
+    /**
+     * Wait for a condition variable to be signaled, but give up after a
+     * given number of nanoseconds.
+     *
+     * The timeout is measured on the monotonic clock, so it isn't
+     * affected by changes to the wall clock. Windows only supports
+     * millisecond timeouts, and rounds the timeout up to the next
+     * millisecond.
+     *
+     * @param cond the condition variable to wait for
+     * @param mutex the locked mutex protecting the critical section
+     * @param ns the number of nanoseconds to wait
+     * @return 0 if the thread was woken up (or the wakeup was spurious),
+     *         -1 if the wait timed out
+     */
+    PLATFORM_PUBLIC_API
+    int cb_cond_timedwait_ns(cb_cond_t *cond, cb_mutex_t *mutex, uint64_t ns);
+
+    /**
+     * Wait for a condition variable to be signaled, but give up when the
+     * monotonic clock (see cb_get_monotonic_ns) reaches the deadline.
+     *
+     * Using a deadline lets a caller loop on spurious wakeups without
+     * having to recalculate the remaining time.
+     *
+     * @param cond the condition variable to wait for
+     * @param mutex the locked mutex protecting the critical section
+     * @param deadline the absolute time (from cb_get_monotonic_ns) to
+     *                 give up at
+     * @return 0 if the thread was woken up (or the wakeup was spurious),
+     *         -1 if the deadline passed
+     */
+    PLATFORM_PUBLIC_API
+    int cb_cond_wait_until(cb_cond_t *cond, cb_mutex_t *mutex,
+                           uint64_t deadline);
+
     /**
      * Singal a single thread waiting for a condition variable
      *
@@ -338,6 +601,57 @@ extern "C" {
     PLATFORM_PUBLIC_API
     int cb_rw_writer_exit(cb_rwlock_t *rw);
 
+    /**
+     * A read-mostly reader/writer lock keeps a reader count per CPU (on
+     * separate cache lines) so that readers don't contend with each
+     * other. Taking the write lock is considerably more expensive than
+     * with cb_rwlock_t, so use it for data which is rarely modified.
+     *
+     * See Couchbase::ReadMostlyRWLock in platform/readmostly_rwlock.h for
+     * the C++ interface.
+     */
+    typedef struct cb_rm_rwlock_st* cb_rm_rwlock_t;
+
+    /**
+     * Initialize a read-mostly read/write lock
+     */
+    PLATFORM_PUBLIC_API
+    void cb_rm_rw_lock_initialize(cb_rm_rwlock_t *rw);
+
+    /**
+     * Destroy a read-mostly read/write lock
+     */
+    PLATFORM_PUBLIC_API
+    void cb_rm_rw_lock_destroy(cb_rm_rwlock_t *rw);
+
+    /*
+     * Obtain reader access to the read-mostly lock
+     * Return 0 if succesfully entered the critical section.
+     */
+    PLATFORM_PUBLIC_API
+    int cb_rm_rw_reader_enter(cb_rm_rwlock_t *rw);
+
+    /*
+     * Exit the read-mostly lock if previously entered as a reader.
+     * Return 0 if succesfully exited the critical section.
+     */
+    PLATFORM_PUBLIC_API
+    int cb_rm_rw_reader_exit(cb_rm_rwlock_t *rw);
+
+    /*
+     * Obtain writer access to the read-mostly lock
+     * Return 0 if succesfully entered the critical section.
+     */
+    PLATFORM_PUBLIC_API
+    int cb_rm_rw_writer_enter(cb_rm_rwlock_t *rw);
+
+    /*
+     * Exit the read-mostly lock if previously entered as a writer.
+     * Return 0 if succesfully exited the critical section.
+     */
+    PLATFORM_PUBLIC_API
+    int cb_rm_rw_writer_exit(cb_rm_rwlock_t *rw);
+
 #ifndef CB_DONT_NEED_GETHRTIME
     /**
      * Get a high resolution time
@@ -420,6 +734,14 @@ extern "C" {
     PLATFORM_PUBLIC_API
     uint64_t cb_get_monotonic_seconds(void);
 
+    /*
+        return a monotonically increasing value with a nanosecond
+        frequency. This is the clock used for the deadlines passed to
+        cb_cond_wait_until.
+    */
+    PLATFORM_PUBLIC_API
+    uint64_t cb_get_monotonic_ns(void);
+
     /*
         obtain a timeval structure containing the current time since EPOCH.
     */
@@ -0,0 +1,97 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/adaptive_mutex.h>
+#include <platform/platform.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace Couchbase {
+
+    /**
+     * A reader/writer lock for data which is almost only read (a "big
+     * reader" lock).
+     *
+     * Instead of a single reader count (where every reader writes to the
+     * same cache line) each lock has an array of reader counters, each on
+     * its own cache line. A thread always uses the same counter so
+     * readers on different CPUs don't interfere with each other.
+     *
+     * The price is paid by the writer which has to wait for every reader
+     * counter to drain. Writers have preference: once a writer announces
+     * itself new readers back off and wait until it is done.
+     *
+     * ReadMostlyRWLock satisfies the Lockable and SharedLockable
+     * requirements (lock/unlock and lock_shared/unlock_shared).
+     */
+    class PLATFORM_PUBLIC_API ReadMostlyRWLock {
+    public:
+        ReadMostlyRWLock();
+
+        ReadMostlyRWLock(const ReadMostlyRWLock&) = delete;
+
+        void lock_shared();
+
+        bool try_lock_shared();
+
+        void unlock_shared();
+
+        void lock();
+
+        bool try_lock();
+
+        void unlock();
+
+    private:
+        struct Slot {
+            std::atomic<uint32_t> readers;
+        };
+
+        Slot& slotAt(size_t index);
+
+        /** Get the slot used by the calling thread */
+        Slot& getSlot();
+
+        void waitForWriter();
+
+        void readerDone(Slot& slot);
+
+        bool readersActive();
+
+        /** The memory holding the (cache line aligned) slots */
+        std::unique_ptr<char[]> storage;
+        /** The first slot. Each slot is CacheLineSize bytes apart */
+        char* slots;
+        size_t mask;
+
+        /**
+         * 0 - no writer
+         * 1 - a writer holds (or is waiting for) the lock
+         * 2 - as 1, and there may be readers parked on the word
+         */
+        std::atomic<uint32_t> writer;
+
+        /** Bumped by readers leaving while a writer is waiting for them */
+        std::atomic<uint32_t> drained;
+
+        /** Serialize the writers */
+        AdaptiveMutex writerMutex;
+    };
+}
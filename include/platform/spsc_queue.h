@@ -0,0 +1,135 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/cacheline.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace Couchbase {
+
+    /**
+     * A bounded lock free single producer / single consumer queue.
+     *
+     * Only one thread may push and only one thread may pop. Each side
+     * keeps a cached copy of the other side's position on its own cache
+     * line, so it only reads the shared position when the cached one says
+     * the queue is full (or empty).
+     *
+     * The interface is the same as MPMCQueue so it may be used with
+     * BlockingQueue.
+     */
+    template <typename T>
+    class SPSCQueue {
+    public:
+        typedef T value_type;
+
+        /**
+         * @param capacity the number of elements the queue can hold
+         *                 (rounded up to a power of two)
+         */
+        explicit SPSCQueue(size_t capacity)
+            : tail(0),
+              headCache(0),
+              head(0),
+              tailCache(0) {
+            size_t size = 1;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            mask = size - 1;
+            cells.reset(new T[size]);
+        }
+
+        SPSCQueue(const SPSCQueue&) = delete;
+
+        bool tryPush(const T& element) {
+            const size_t pos = tail.load(std::memory_order_relaxed);
+            if (full(pos)) {
+                return false;
+            }
+            cells[pos & mask] = element;
+            tail.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool tryPush(T&& element) {
+            const size_t pos = tail.load(std::memory_order_relaxed);
+            if (full(pos)) {
+                return false;
+            }
+            cells[pos & mask] = std::move(element);
+            tail.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool tryPop(T& element) {
+            const size_t pos = head.load(std::memory_order_relaxed);
+            if (pos == tailCache) {
+                tailCache = tail.load(std::memory_order_acquire);
+                if (pos == tailCache) {
+                    return false;
+                }
+            }
+            element = std::move(cells[pos & mask]);
+            head.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        size_t capacity() const {
+            return mask + 1;
+        }
+
+        size_t sizeGuess() const {
+            const size_t t = tail.load(std::memory_order_relaxed);
+            const size_t h = head.load(std::memory_order_relaxed);
+            return t > h ? t - h : 0;
+        }
+
+        bool empty() const {
+            return sizeGuess() == 0;
+        }
+
+    private:
+        bool full(size_t pos) {
+            if (pos - headCache > mask) {
+                headCache = head.load(std::memory_order_acquire);
+                return pos - headCache > mask;
+            }
+            return false;
+        }
+
+        // Padded rather than aligned (see CacheLineSize)
+        CacheLinePad pad0;
+
+        // Written by the producer
+        std::atomic<size_t> tail;
+        size_t headCache;
+        CacheLinePad pad1;
+
+        // Written by the consumer
+        std::atomic<size_t> head;
+        size_t tailCache;
+        CacheLinePad pad2;
+
+        size_t mask;
+        std::unique_ptr<T[]> cells;
+    };
+}
@@ -18,7 +18,9 @@
 
 #include <atomic>
 #include <platform/platform.h>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
 #include <mutex>
 #include <string>
 
@@ -74,10 +76,38 @@ namespace Couchbase {
          * The start method will try to spawn the thread object and <b>block</b>
          * until the thread is running.
          *
-         * @throws std::bad_alloc if we're failing to spawn a new thread
+         * @throws std::bad_alloc if we're failing to spawn a new thread (or
+         *                        the thread options can't be satisfied)
          */
         void start();
 
+        /**
+         * Request to start the Thread without waiting for the run() method
+         * to call setRunning(). The state is Starting when the method
+         * returns; use waitForState() if you need to know when it runs.
+         *
+         * @throws std::bad_alloc if we're failing to spawn a new thread (or
+         *                        the thread options can't be satisfied)
+         */
+        void startAsync();
+
+        /**
+         * Set the number of idle threads to keep around for reuse (the
+         * default is 0, which disables the cache).
+         *
+         * Creating a thread costs a system call, a stack allocation and a
+         * couple of context switches. With the cache enabled a Thread
+         * created without explicit options runs on a parked thread from
+         * the cache (if there is one), and the thread is put back in the
+         * cache when its run() method returns instead of exiting.
+         *
+         * Note that the ThreadLocal elements are destroyed between each
+         * use of a cached thread, but thread_local variables are not.
+         *
+         * @param size the maximum number of idle threads in the cache
+         */
+        static void setThreadCacheSize(size_t size);
+
         /**
          * Get the current state of the thread
          */
@@ -97,6 +127,34 @@ namespace Couchbase {
          */
         const ThreadState waitForState(const ThreadState& state);
 
+        /**
+         * Ask the thread to stop. This only sets the stop token and wakes
+         * up the thread if it is blocked in waitForStop(); it is up to the
+         * subclass run() method to check the token and return.
+         *
+         * Requesting stop of many threads and then joining them is a lot
+         * faster than stopping them one by one.
+         */
+        void requestStop();
+
+        /**
+         * Has someone called requestStop() since the thread was started?
+         */
+        bool isStopRequested() const {
+            return stopToken.load(std::memory_order_acquire) != 0;
+        }
+
+        /**
+         * Wait for the thread to return from its run() method and reap it.
+         * The state is Stopped when the method returns true (and the
+         * thread may be started again).
+         *
+         * @param timeout the maximum time to wait for the thread
+         * @return true if the thread is stopped, false if the timeout
+         *         expired before run() returned
+         */
+        bool joinFor(std::chrono::nanoseconds timeout);
+
     protected:
         /**
          * Initialize a new Thread object
@@ -105,6 +163,16 @@ namespace Couchbase {
          */
         Thread(const std::string& name_);
 
+        /**
+         * Initialize a new Thread object which will be created with the
+         * given options (stack size, scheduling policy, CPU affinity and
+         * NUMA node)
+         *
+         * @param name_ the name of the thread
+         * @param options_ the options used when creating the thread
+         */
+        Thread(const std::string& name_, const cb_thread_options_t& options_);
+
         /**
          * It is not allowed to copy a Thread object
          */
@@ -112,7 +180,8 @@ namespace Couchbase {
 
         /**
          * This is the work the thread should be doing. If you want to be able
-         * to stop your thread you need to provide the mechanisms to do so.
+         * to stop your thread the method should return once
+         * isStopRequested() is true (see waitForStop()).
          *
          * In your subclass you must start by calling setRunning() so that
          * the client users of your subclass can utilize your class.
@@ -138,6 +207,25 @@ namespace Couchbase {
          */
         void setRunning();
 
+        /**
+         * Block the calling thread until stop is requested (or the timeout
+         * expires). Meant for the run() method of idle background threads,
+         * which then don't have to wake up periodically to poll for their
+         * shutdown flag:
+         *
+         *     void MyThread::run() override {
+         *         setRunning();
+         *         while (!waitForStop(std::chrono::seconds(10))) {
+         *             ... periodic work ...
+         *         }
+         *     }
+         *
+         * @param timeout the maximum time to wait (the default is forever)
+         * @return true if stop was requested, false if the wait timed out
+         */
+        bool waitForStop(std::chrono::nanoseconds timeout =
+                             std::chrono::nanoseconds::max());
+
     private:
 
         void setState(const ThreadState& st) {
@@ -148,6 +236,18 @@ namespace Couchbase {
 
         friend class StartThreadDelegator;
 
+        /**
+         * Spawn the thread (or hand it to a cached thread). The state must
+         * be Starting.
+         */
+        void spawn();
+
+        /**
+         * Wait for the thread to finish after it became a Zombie (and join
+         * it unless it ran on a cached thread)
+         */
+        void reap();
+
         /**
          * In order to synchronize the start of the thread we'll just use a
          * condition variable to block the caller until the thread is running
@@ -169,13 +269,41 @@ namespace Couchbase {
         std::string name;
 
         /**
-         * The thread id for the thread
+         * The options used when creating the thread
+         */
+        cb_thread_options_t options;
+
+        /**
+         * The thread id for the thread (not used if it runs on a cached
+         * thread)
          */
         cb_thread_t thread_id;
 
+        /**
+         * May the thread run on a thread from the cache? (it may if it was
+         * created without explicit options)
+         */
+        const bool cacheable;
+
+        /** Did the current run use a cached thread? */
+        bool cached;
+
+        /**
+         * Set to 1 when the thread is spawned, and cleared once the
+         * spawning thread has stored thread_id (or the cached thread is
+         * done with the object). Used as a futex word by reap().
+         */
+        std::atomic<uint32_t> attached;
+
         /**
          * The state of the thread
          */
         std::atomic<ThreadState> state;
+
+        /**
+         * Set to 1 by requestStop(). Used as a futex word so that
+         * waitForStop() blocks without polling.
+         */
+        std::atomic<uint32_t> stopToken;
     };
 }
@@ -0,0 +1,190 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/platform.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace Couchbase {
+
+    /**
+     * The type independent part of ThreadLocal (see below)
+     */
+    class PLATFORM_PUBLIC_API ThreadLocalBase {
+    public:
+        ThreadLocalBase(const ThreadLocalBase&) = delete;
+
+        /**
+         * Destroy all of the calling thread's ThreadLocal elements.
+         *
+         * This is called automatically when a thread created through
+         * cb_create_thread (or Couchbase::Thread) returns from its main
+         * function, and from a thread_local destructor for all other
+         * threads. A thread pool not using the platform threads may call
+         * it if it needs the elements destroyed at a specific point.
+         */
+        static void threadExit();
+
+        /**
+         * A thread's cached pointer to its element of one ThreadLocal, so
+         * that get() doesn't have to call into the library. It is only
+         * valid while serial matches the ThreadLocal's (serials, unlike
+         * ids, are never reused), and threadExit clears it.
+         */
+        struct Cache {
+            uint64_t serial;
+            void* element;
+            bool registered;
+        };
+
+    protected:
+        /**
+         * @param deleter destroys an element (called without any locks
+         *                held, possibly after the ThreadLocal is gone)
+         */
+        explicit ThreadLocalBase(void (*deleter)(void*));
+
+        virtual ~ThreadLocalBase();
+
+        /**
+         * Get the calling thread's element, creating it if it doesn't
+         * exist
+         */
+        void* getElement();
+
+        /**
+         * Get the calling thread's element (see getElement) and store it
+         * in the calling thread's cache
+         */
+        void* fillCache(Cache& cache);
+
+        /**
+         * Call the callback for every thread's element (with the registry
+         * locked, so threads can't create or destroy elements while the
+         * callback runs)
+         */
+        void forEachElement(const std::function<void(void*)>& callback);
+
+        /**
+         * Destroy the elements of all threads. Must be called from the
+         * destructor of the subclass (as createElement must not be called
+         * once the subclass is gone)
+         */
+        void destroyAll();
+
+        virtual void* createElement() = 0;
+
+        /** Identifies this instance in the thread caches */
+        const uint64_t serial;
+
+    private:
+        void* getElementSlow();
+
+        void (*const deleter)(void*);
+
+        /** This instance's index in every thread's slot vector */
+        const size_t id;
+    };
+
+    /**
+     * A thread local variable which (unlike thread_local) may be a member
+     * of an object, and which allows iterating over every thread's
+     * instance (typically to sum up per-thread counters).
+     *
+     *     Couchbase::ThreadLocal<uint64_t> counter;
+     *
+     *     // In the hot path; no sharing between threads
+     *     ++counter.get();
+     *
+     *     // When someone wants the total
+     *     uint64_t total = 0;
+     *     counter.forEach([&total](uint64_t& v) { total += v; });
+     *
+     * The element is default constructed the first time a thread accesses
+     * it, and destroyed when the thread exits (see
+     * ThreadLocalBase::threadExit) or when the ThreadLocal is destroyed,
+     * whichever happens first. Note that the values of threads which
+     * have exited are lost; fold them into a shared value from T's
+     * destructor if they must be kept.
+     *
+     * Access is inline as long as a thread keeps using the same
+     * ThreadLocal<T> (every thread caches its element of the ThreadLocal
+     * it used last for each T); otherwise it is a call into the platform
+     * library and an index into a compiler TLS backed vector.
+     */
+    template <typename T>
+    class ThreadLocal : public ThreadLocalBase {
+    public:
+        ThreadLocal()
+            : ThreadLocalBase(deleteElement) {
+        }
+
+        ~ThreadLocal() {
+            destroyAll();
+        }
+
+        /**
+         * Get the calling thread's instance
+         */
+        T& get() {
+            auto& cache = getCache();
+            if (cache.serial == serial) {
+                return *static_cast<T*>(cache.element);
+            }
+            return *static_cast<T*>(fillCache(cache));
+        }
+
+        T& operator*() {
+            return get();
+        }
+
+        T* operator->() {
+            return &get();
+        }
+
+        /**
+         * Call f(T&) for every thread's instance. The threads may modify
+         * their instances while f runs, so T must be safe to read
+         * concurrently (e.g. use RelaxedAtomic for counters)
+         */
+        template <typename F>
+        void forEach(F f) {
+            forEachElement([&f](void* element) {
+                f(*static_cast<T*>(element));
+            });
+        }
+
+    protected:
+        void* createElement() override {
+            return new T();
+        }
+
+    private:
+        static void deleteElement(void* element) {
+            delete static_cast<T*>(element);
+        }
+
+        static Cache& getCache() {
+            // Constant initialized, so there is no guard to check
+            static thread_local Cache cache;
+            return cache;
+        }
+    };
+}
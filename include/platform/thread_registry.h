@@ -0,0 +1,92 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/platform.h>
+#include <platform/thread.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Couchbase {
+
+    /**
+     * The runtime statistics of a thread
+     */
+    struct ThreadStats {
+        /** The name of the thread (empty if it has no name) */
+        std::string name;
+        /** The operating system's id for the thread */
+        uint64_t tid;
+        /** The CPU time (user and system) used by the thread, in ns */
+        uint64_t cpuTime;
+        /**
+         * The number of times the thread blocked or yielded the CPU
+         * (0 where the platform doesn't provide it)
+         */
+        uint64_t voluntaryContextSwitches;
+        /**
+         * The number of times the thread was preempted (0 where the
+         * platform doesn't provide it)
+         */
+        uint64_t involuntaryContextSwitches;
+        /** Is the thread running a Couchbase::Thread? */
+        bool hasState;
+        /** The state of the Couchbase::Thread (if hasState is set) */
+        ThreadState state;
+    };
+
+    /**
+     * A registry of all of the threads created through cb_create_thread
+     * (and friends) or Couchbase::Thread which are still alive, so that
+     * we can see which thread is using the CPU without attaching a
+     * profiler.
+     *
+     * Threads are added to the registry when they start and removed when
+     * they exit. Threads created by other means (including the main
+     * thread) are not tracked.
+     */
+    namespace ThreadRegistry {
+
+        /**
+         * Get the statistics of all of the registered threads
+         */
+        PLATFORM_PUBLIC_API
+        std::vector<ThreadStats> getStats();
+
+        /**
+         * Get the statistics of all of the registered threads as JSON:
+         *
+         *     {"threads":[{"name":"mc:worker_0","tid":1234,
+         *                  "cpu_time":123456,"voluntary_ctxt_switches":10,
+         *                  "involuntary_ctxt_switches":2,
+         *                  "state":"running"}, ...]}
+         *
+         * The threads are sorted by CPU time (highest first), and the
+         * state is only included for threads running a Couchbase::Thread.
+         */
+        PLATFORM_PUBLIC_API
+        std::string toJSON();
+
+        /**
+         * Get the textual representation of a ThreadState
+         */
+        PLATFORM_PUBLIC_API
+        const char* to_string(ThreadState state);
+    }
+}
@@ -0,0 +1,206 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/memorymap.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <string>
+
+namespace Couchbase {
+
+    /**
+     * Read a file (which may be much bigger than the address space we
+     * want to spend on it) through a small set of mapped windows.
+     *
+     * The file is split into fixed size windows, and at most maxWindows
+     * of them are mapped at the same time. The least recently used
+     * window is unmapped to make room for a new one. Use map() or read()
+     * for random access, and the iterator to scan the file:
+     *
+     *     Couchbase::WindowedFileReader reader("data.couch");
+     *     for (const auto& chunk : reader) {
+     *         crc = crc32c(chunk.data, chunk.size, crc);
+     *     }
+     *
+     * The file is opened once, and every window is mapped from that
+     * handle. The iterator maps its windows with sequential access
+     * advice (so the kernel reads ahead aggressively), asks for the
+     * next window to be read in while the current one is processed (if
+     * maxWindows allows two windows) and unmaps each window as soon as
+     * it moves on to the next, so a scan only keeps a couple of windows
+     * mapped.
+     *
+     * Pointers returned by map() are valid until maxWindows other
+     * windows have been mapped (the iterator never unmaps a window
+     * map() handed out early), and the pointers from the iterator until
+     * it moves on. The file must not be truncated while it is read, and
+     * the reader isn't thread safe.
+     */
+    class PLATFORM_PUBLIC_API WindowedFileReader {
+    public:
+        /**
+         * A contiguous part of the file (inside a single window)
+         */
+        struct Chunk {
+            /** The offset of the chunk in the file */
+            uint64_t offset;
+            const uint8_t* data;
+            size_t size;
+        };
+
+        /**
+         * Iterates over the file one window at a time
+         */
+        class PLATFORM_PUBLIC_API Iterator {
+        public:
+            typedef std::input_iterator_tag iterator_category;
+            typedef Chunk value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef const Chunk* pointer;
+            typedef const Chunk& reference;
+
+            const Chunk& operator*() const {
+                return chunk;
+            }
+
+            const Chunk* operator->() const {
+                return &chunk;
+            }
+
+            Iterator& operator++();
+
+            bool operator==(const Iterator& other) const {
+                return chunk.offset == other.chunk.offset;
+            }
+
+            bool operator!=(const Iterator& other) const {
+                return !(*this == other);
+            }
+
+        private:
+            friend class WindowedFileReader;
+
+            Iterator(WindowedFileReader* reader_, uint64_t offset);
+
+            WindowedFileReader* reader;
+            Chunk chunk;
+        };
+
+        /**
+         * @param fname the file to read
+         * @param windowSize the size of each window (rounded up to a
+         *                   multiple of the allocation granularity)
+         * @param maxWindows the max number of windows mapped at a time
+         * @throws std::string if the file can't be opened
+         */
+        WindowedFileReader(const std::string& fname,
+                           size_t windowSize = 64 * 1024 * 1024,
+                           size_t maxWindows = 4);
+
+        WindowedFileReader(const WindowedFileReader&) = delete;
+
+        ~WindowedFileReader();
+
+        uint64_t getFileSize() const {
+            return fileSize;
+        }
+
+        size_t getWindowSize() const {
+            return windowSize;
+        }
+
+        /**
+         * Get the number of windows currently mapped
+         */
+        size_t getMappedWindows() const {
+            return windows.size();
+        }
+
+        /**
+         * Get the contents of the file at offset, up to the end of the
+         * window containing it
+         *
+         * @param offset the offset in the file (less than the file size)
+         * @return the chunk of the file starting at offset
+         * @throws std::string if the offset is beyond the end of the
+         *         file or the window couldn't be mapped
+         */
+        Chunk map(uint64_t offset);
+
+        /**
+         * Copy part of the file (which may span multiple windows)
+         *
+         * @return the number of bytes copied (less than length if the
+         *         end of the file was reached)
+         * @throws std::string if a window couldn't be mapped
+         */
+        size_t read(uint64_t offset, void* buffer, size_t length);
+
+        /**
+         * Start scanning the file from the beginning
+         */
+        Iterator begin() {
+            return Iterator(this, 0);
+        }
+
+        Iterator end() {
+            return Iterator(nullptr, fileSize);
+        }
+
+    private:
+        struct Window {
+            uint64_t index;
+            std::unique_ptr<MemoryMappedFile> file;
+            /** Has map() handed out a pointer into the window? */
+            bool pinned;
+        };
+
+        /**
+         * Get the window with the given index (mapping it if needed),
+         * and make it the most recently used
+         */
+        Window& getWindow(uint64_t index, bool sequential);
+
+        /**
+         * Unmap the window with the given index, unless it isn't mapped
+         * or map() has handed out a pointer into it
+         */
+        void dropWindow(uint64_t index);
+
+        /**
+         * Start reading in the window with the given index (if it is in
+         * the file and there is room for it next to the current window)
+         */
+        void readAhead(uint64_t index);
+
+        Chunk getChunk(uint64_t offset, bool sequential);
+
+        const std::string filename;
+        const size_t windowSize;
+        const size_t maxWindows;
+        MemoryMappedFile::FileHandle file;
+        uint64_t fileSize;
+
+        /** The mapped windows, the most recently used first */
+        std::list<Window> windows;
+    };
+}
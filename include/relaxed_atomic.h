@@ -16,13 +16,24 @@
  */
 #pragma once
 
+#include <platform/cacheline.h>
+#include <platform/cpu_relax.h>
+
 #include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
 
 namespace Couchbase {
 
     /**
      * The RelaxedAtomic class wraps std::atomic<> and operates with
      * relaxed memory ordering.
+     *
+     * It may be used with float and double as well, in which case the
+     * arithmetic operators are implemented with a compare and swap loop
+     * (std::atomic has no fetch_add for floating point types before
+     * C++20).
      */
     template<typename T>
     class RelaxedAtomic {
@@ -54,41 +65,39 @@ namespace Couchbase {
         }
 
         RelaxedAtomic& operator+=(const T rhs) {
-            value.fetch_add(rhs, std::memory_order_relaxed);
+            fetchAdd(rhs);
             return *this;
         }
 
         RelaxedAtomic& operator+=(const RelaxedAtomic& rhs) {
-            value.fetch_add(rhs.value.load(std::memory_order_relaxed),
-                            std::memory_order_relaxed);
+            fetchAdd(rhs.value.load(std::memory_order_relaxed));
             return *this;
         }
 
         RelaxedAtomic& operator-=(const T rhs) {
-            value.fetch_sub(rhs, std::memory_order_relaxed);
+            fetchSub(rhs);
             return *this;
         }
 
         RelaxedAtomic& operator-=(const RelaxedAtomic& rhs) {
-            value.fetch_sub(rhs.value.load(std::memory_order_relaxed),
-                            std::memory_order_relaxed);
+            fetchSub(rhs.value.load(std::memory_order_relaxed));
             return *this;
         }
 
         T operator++() {
-            return value.fetch_add(1, std::memory_order_relaxed) + 1;
+            return fetchAdd(1) + 1;
         }
 
         T operator++(int) {
-            return value.fetch_add(1, std::memory_order_relaxed);
+            return fetchAdd(1);
         }
 
         T operator--() {
-            return value.fetch_sub(1, std::memory_order_relaxed) - 1;
+            return fetchSub(1) - 1;
         }
 
         T operator--(int) {
-            return value.fetch_sub(1, std::memory_order_relaxed);
+            return fetchSub(1);
         }
 
         RelaxedAtomic& operator=(T val) {
@@ -100,25 +109,193 @@ namespace Couchbase {
             value.store(0, std::memory_order_relaxed);
         }
 
+        /**
+         * Set the value to val if val is greater than the current value
+         * (typically used to track a maximum).
+         *
+         * The current value is checked with a plain load first, so the
+         * common case of val not being a new maximum doesn't write to the
+         * cache line. If the compare and swap fails because another
+         * thread updated the value we back off for a while before trying
+         * again.
+         */
         void setIfGreater(const T& val) {
-            do {
-                T currval = value.load(std::memory_order_relaxed);
-                if (val > currval) {
-                    if (value.compare_exchange_weak(currval, val,
-                                                    std::memory_order_relaxed)) {
-                        break;
-                    }
-                } else {
+            T currval = value.load(std::memory_order_relaxed);
+            unsigned int backoff = 1;
+            while (val > currval) {
+                if (value.compare_exchange_weak(currval, val,
+                                                std::memory_order_relaxed)) {
                     break;
                 }
-            } while (true);
+                backoff = pause(backoff);
+            }
         }
 
         void setIfGreater(const RelaxedAtomic& val) {
             setIfGreater(val.load());
         }
 
+        /**
+         * Set the value to val if val is less than the current value
+         * (typically used to track a minimum; see setIfGreater)
+         */
+        void setIfLess(const T& val) {
+            T currval = value.load(std::memory_order_relaxed);
+            unsigned int backoff = 1;
+            while (val < currval) {
+                if (value.compare_exchange_weak(currval, val,
+                                                std::memory_order_relaxed)) {
+                    break;
+                }
+                backoff = pause(backoff);
+            }
+        }
+
+        void setIfLess(const RelaxedAtomic& val) {
+            setIfLess(val.load());
+        }
+
     private:
+        T fetchAdd(T delta) {
+            return fetchAdd(delta, std::is_floating_point<T>());
+        }
+
+        T fetchSub(T delta) {
+            return fetchSub(delta, std::is_floating_point<T>());
+        }
+
+        T fetchAdd(T delta, std::false_type) {
+            return value.fetch_add(delta, std::memory_order_relaxed);
+        }
+
+        T fetchSub(T delta, std::false_type) {
+            return value.fetch_sub(delta, std::memory_order_relaxed);
+        }
+
+        T fetchAdd(T delta, std::true_type) {
+            T currval = value.load(std::memory_order_relaxed);
+            while (!value.compare_exchange_weak(currval, currval + delta,
+                                                std::memory_order_relaxed)) {
+            }
+            return currval;
+        }
+
+        T fetchSub(T delta, std::true_type) {
+            return fetchAdd(-delta, std::true_type());
+        }
+
+        /**
+         * Exponential backoff after a failed compare and swap (at most
+         * MaxBackoff iterations)
+         *
+         * @return the number of iterations to use next time
+         */
+        static unsigned int pause(unsigned int iterations) {
+            static const unsigned int MaxBackoff = 64;
+            for (unsigned int ii = 0; ii < iterations; ++ii) {
+                cpuRelax();
+            }
+            return iterations < MaxBackoff ? iterations * 2 : MaxBackoff;
+        }
+
         std::atomic <T> value;
     };
+
+    /**
+     * A RelaxedAtomic which occupies a cache line of its own, so that
+     * updating it doesn't invalidate the cache line of the surrounding
+     * data (false sharing). Use it for hot counters in structures
+     * updated by many threads:
+     *
+     *     struct Stats {
+     *         PaddedRelaxedAtomic<uint64_t> reads;
+     *         PaddedRelaxedAtomic<uint64_t> writes;
+     *     };
+     *
+     * The value is padded by a cache line on either side rather than
+     * aligned (see CacheLineSize), so it is isolated wherever the object
+     * is allocated, including in a std::vector.
+     */
+    template<typename T>
+    class PaddedRelaxedAtomic : private CacheLinePad,
+                                public RelaxedAtomic<T> {
+    public:
+        PaddedRelaxedAtomic() {
+        }
+
+        PaddedRelaxedAtomic(const T& initial)
+            : RelaxedAtomic<T>(initial) {
+        }
+
+        PaddedRelaxedAtomic(const PaddedRelaxedAtomic& other)
+            : RelaxedAtomic<T>(other.load()) {
+        }
+
+        PaddedRelaxedAtomic& operator=(const PaddedRelaxedAtomic& rhs) {
+            RelaxedAtomic<T>::operator=(rhs.load());
+            return *this;
+        }
+
+        PaddedRelaxedAtomic& operator=(T val) {
+            RelaxedAtomic<T>::operator=(val);
+            return *this;
+        }
+
+    private:
+        char pad[CacheLineSize - sizeof(RelaxedAtomic<T>)];
+    };
+
+    /**
+     * A fixed size array of counters with each counter on its own cache
+     * line. Typically used for per-thread (or per-core) counters which
+     * are summed up when read:
+     *
+     *     RelaxedAtomicArray<uint64_t> ops(numWorkers);
+     *
+     *     // worker n
+     *     ++ops[n];
+     *
+     *     // reader
+     *     uint64_t total = ops.sum();
+     */
+    template<typename T>
+    class RelaxedAtomicArray {
+    public:
+        explicit RelaxedAtomicArray(size_t size)
+            : counters(size) {
+        }
+
+        RelaxedAtomic<T>& operator[](size_t index) {
+            return counters[index];
+        }
+
+        const RelaxedAtomic<T>& operator[](size_t index) const {
+            return counters[index];
+        }
+
+        size_t size() const {
+            return counters.size();
+        }
+
+        /**
+         * Get the sum of all of the counters (the counters are read one
+         * by one, so it isn't a snapshot)
+         */
+        T sum() const {
+            T ret = 0;
+            for (const auto& counter : counters) {
+                ret += counter.load();
+            }
+            return ret;
+        }
+
+        void reset() {
+            for (auto& counter : counters) {
+                counter.reset();
+            }
+        }
+
+    private:
+        std::vector<PaddedRelaxedAtomic<T>> counters;
+    };
 }
@@ -0,0 +1,173 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/cpu_relax.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace Couchbase {
+
+    /**
+     * A sequence lock protecting a small trivially copyable value (like a
+     * group of statistics which must be read consistently: count, sum and
+     * max).
+     *
+     * Writers serialize on the sequence number, which is odd while a
+     * write is in progress. Readers never write to shared memory: they
+     * read the sequence number, copy the value and retry if the sequence
+     * number changed (or was odd) in the meantime. Reads are therefore
+     * cheap and don't slow down the writers, but a reader may have to
+     * retry (or in the worst case starve) if the value is written all the
+     * time.
+     *
+     * The value is stored as an array of atomic words so that the racy
+     * reads are well defined.
+     */
+    template<typename T>
+    class SeqLock {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "SeqLock requires a trivially copyable type");
+
+    public:
+        SeqLock()
+            : sequence(0) {
+            store(T());
+        }
+
+        explicit SeqLock(const T& initial)
+            : sequence(0) {
+            store(initial);
+        }
+
+        SeqLock(const SeqLock&) = delete;
+
+        /**
+         * Get a consistent copy of the value
+         */
+        T load() const {
+            uint64_t buffer[Words];
+            while (true) {
+                const uint64_t begin = sequence.load(std::memory_order_acquire);
+                if ((begin & 1) == 0) {
+                    for (size_t ii = 0; ii < Words; ++ii) {
+                        buffer[ii] = data[ii].load(std::memory_order_relaxed);
+                    }
+                    // Don't let the data loads move past the check
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (sequence.load(std::memory_order_relaxed) == begin) {
+                        break;
+                    }
+                }
+                cpuRelax();
+            }
+
+            T ret;
+            std::memcpy(&ret, buffer, sizeof(T));
+            return ret;
+        }
+
+        /**
+         * Replace the value
+         */
+        void store(const T& value) {
+            const uint64_t seq = lock();
+            write(value);
+            unlock(seq);
+        }
+
+        /**
+         * Update the value in place: f is called with a reference to a
+         * copy of the current value, and the result is stored. Writers
+         * are serialized, so no updates are lost.
+         *
+         *     struct Timings { uint64_t count; uint64_t sum; uint64_t max; };
+         *     SeqLock<Timings> timings;
+         *
+         *     timings.update([duration](Timings& t) {
+         *         ++t.count;
+         *         t.sum += duration;
+         *         t.max = std::max(t.max, duration);
+         *     });
+         */
+        template<typename F>
+        void update(F f) {
+            const uint64_t seq = lock();
+            T value = read();
+            f(value);
+            write(value);
+            unlock(seq);
+        }
+
+    private:
+        static const size_t Words = (sizeof(T) + sizeof(uint64_t) - 1) /
+                                    sizeof(uint64_t);
+
+        /**
+         * Wait for other writers and make the sequence number odd
+         *
+         * @return the (even) sequence number before the write
+         */
+        uint64_t lock() {
+            uint64_t seq = sequence.load(std::memory_order_relaxed);
+            while (true) {
+                if ((seq & 1) == 0 &&
+                    sequence.compare_exchange_weak(seq, seq + 1,
+                                                   std::memory_order_acquire,
+                                                   std::memory_order_relaxed)) {
+                    break;
+                }
+                cpuRelax();
+                seq = sequence.load(std::memory_order_relaxed);
+            }
+            // The readers must see the odd sequence number before they
+            // see any of the new data
+            std::atomic_thread_fence(std::memory_order_release);
+            return seq;
+        }
+
+        void unlock(uint64_t seq) {
+            sequence.store(seq + 2, std::memory_order_release);
+        }
+
+        /** Read the value (with the write lock held) */
+        T read() const {
+            uint64_t buffer[Words];
+            for (size_t ii = 0; ii < Words; ++ii) {
+                buffer[ii] = data[ii].load(std::memory_order_relaxed);
+            }
+            T ret;
+            std::memcpy(&ret, buffer, sizeof(T));
+            return ret;
+        }
+
+        /** Write the value (with the write lock held) */
+        void write(const T& value) {
+            uint64_t buffer[Words] = {};
+            std::memcpy(buffer, &value, sizeof(T));
+            for (size_t ii = 0; ii < Words; ++ii) {
+                data[ii].store(buffer[ii], std::memory_order_relaxed);
+            }
+        }
+
+        std::atomic<uint64_t> sequence;
+        std::atomic<uint64_t> data[Words];
+    };
+}
@@ -0,0 +1,256 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <relaxed_atomic.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <thread>
+
+namespace Couchbase {
+
+    /**
+     * Get the calling thread's stripe. Threads are given consecutive
+     * numbers the first time they ask, so as long as there are fewer
+     * threads than stripes each thread gets a stripe of its own.
+     */
+    inline size_t getThreadStripe() {
+        static std::atomic<size_t> next(0);
+        static thread_local size_t stripe =
+            next.fetch_add(1, std::memory_order_relaxed);
+        return stripe;
+    }
+
+    /**
+     * The number of stripes to use: one per CPU (rounded up to a power of
+     * two), but at most 64
+     */
+    inline size_t getDefaultStripes() {
+        static const size_t MaxStripes = 64;
+        const size_t cpus = std::thread::hardware_concurrency();
+        size_t ret = 1;
+        while (ret < cpus && ret < MaxStripes) {
+            ret <<= 1;
+        }
+        return ret;
+    }
+
+    /**
+     * A counter split into cache line padded stripes which are summed up
+     * when the counter is read. Every thread updates its own stripe, so
+     * the threads don't fight over a single cache line like they do with
+     * RelaxedAtomic.
+     *
+     * It offers the same interface as RelaxedAtomic for counting, so it
+     * may replace a hot RelaxedAtomic counter, with the following
+     * differences:
+     *
+     *   * the increment / decrement operators don't return the value (as
+     *     that would require summing up all the stripes)
+     *   * reading the counter costs a load per stripe, and a reader racing
+     *     with updates may see a sum of values from different points in
+     *     time (but never a torn value)
+     *   * every stripe is a PaddedRelaxedAtomic (two cache lines), so
+     *     don't use it for counters which are rarely updated
+     */
+    template<typename T>
+    class StripedCounter {
+    public:
+        StripedCounter()
+            : stripes(getDefaultStripes()),
+              mask(stripes.size() - 1) {
+        }
+
+        StripedCounter(const T& initial)
+            : StripedCounter() {
+            stripes[0] = initial;
+        }
+
+        // A copy couldn't be taken atomically; use load() explicitly
+        StripedCounter(const StripedCounter&) = delete;
+
+        operator T() const {
+            return load();
+        }
+
+        T load() const {
+            return stripes.sum();
+        }
+
+        StripedCounter& operator=(const StripedCounter&) = delete;
+
+        StripedCounter& operator=(T val) {
+            reset();
+            stripes[0] = val;
+            return *this;
+        }
+
+        StripedCounter& operator+=(const T rhs) {
+            local() += rhs;
+            return *this;
+        }
+
+        StripedCounter& operator-=(const T rhs) {
+            local() -= rhs;
+            return *this;
+        }
+
+        StripedCounter& operator++() {
+            ++local();
+            return *this;
+        }
+
+        void operator++(int) {
+            ++local();
+        }
+
+        StripedCounter& operator--() {
+            --local();
+            return *this;
+        }
+
+        void operator--(int) {
+            --local();
+        }
+
+        /**
+         * Set the counter to 0. Updates racing with the reset may or may
+         * not be included in the result.
+         */
+        void reset() {
+            stripes.reset();
+        }
+
+        /**
+         * Get the number of stripes
+         */
+        size_t size() const {
+            return stripes.size();
+        }
+
+    private:
+        RelaxedAtomic<T>& local() {
+            return stripes[getThreadStripe() & mask];
+        }
+
+        RelaxedAtomicArray<T> stripes;
+        const size_t mask;
+    };
+
+    /**
+     * A maximum (high watermark) gauge split into cache line padded
+     * stripes which are merged when the gauge is read. Use it instead of
+     * RelaxedAtomic::setIfGreater for gauges updated on every operation
+     * by many threads (peak memory usage, max latency etc), as it only
+     * writes to the calling thread's stripe.
+     */
+    template<typename T>
+    class StripedHighWatermark {
+    public:
+        StripedHighWatermark()
+            : stripes(getDefaultStripes()),
+              mask(stripes.size() - 1) {
+            reset();
+        }
+
+        StripedHighWatermark(const StripedHighWatermark&) = delete;
+
+        void setIfGreater(const T& val) {
+            stripes[getThreadStripe() & mask].setIfGreater(val);
+        }
+
+        /**
+         * Get the highest value seen since the last reset (or the lowest
+         * possible value of T if there hasn't been any updates)
+         */
+        T load() const {
+            T ret = stripes[0].load();
+            for (size_t ii = 1; ii < stripes.size(); ++ii) {
+                const T val = stripes[ii].load();
+                if (val > ret) {
+                    ret = val;
+                }
+            }
+            return ret;
+        }
+
+        operator T() const {
+            return load();
+        }
+
+        void reset() {
+            for (size_t ii = 0; ii < stripes.size(); ++ii) {
+                stripes[ii] = std::numeric_limits<T>::lowest();
+            }
+        }
+
+    private:
+        RelaxedAtomicArray<T> stripes;
+        const size_t mask;
+    };
+
+    /**
+     * A minimum (low watermark) gauge; see StripedHighWatermark
+     */
+    template<typename T>
+    class StripedLowWatermark {
+    public:
+        StripedLowWatermark()
+            : stripes(getDefaultStripes()),
+              mask(stripes.size() - 1) {
+            reset();
+        }
+
+        StripedLowWatermark(const StripedLowWatermark&) = delete;
+
+        void setIfLess(const T& val) {
+            stripes[getThreadStripe() & mask].setIfLess(val);
+        }
+
+        /**
+         * Get the lowest value seen since the last reset (or the highest
+         * possible value of T if there hasn't been any updates)
+         */
+        T load() const {
+            T ret = stripes[0].load();
+            for (size_t ii = 1; ii < stripes.size(); ++ii) {
+                const T val = stripes[ii].load();
+                if (val < ret) {
+                    ret = val;
+                }
+            }
+            return ret;
+        }
+
+        operator T() const {
+            return load();
+        }
+
+        void reset() {
+            for (size_t ii = 0; ii < stripes.size(); ++ii) {
+                stripes[ii] = std::numeric_limits<T>::max();
+            }
+        }
+
+    private:
+        RelaxedAtomicArray<T> stripes;
+        const size_t mask;
+    };
+}
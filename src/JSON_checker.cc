@@ -29,6 +29,14 @@ SOFTWARE.
 #include <stdlib.h>
 #include "JSON_checker.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <platform/platform.h>
+#include <string>
+
 #define __   -1     /* the universal error code */
 
 /*
@@ -416,8 +424,11 @@ JSON_checker::Instance::Instance() {
 
 void JSON_checker::Instance::reset() {
     state = VA;
-    std::stack<Modes> empty;
-    stack.swap(empty);
+    // Pop the elements rather than swapping in a new stack so that we
+    // keep the memory already allocated by the underlying vector
+    while (!stack.empty()) {
+        stack.pop();
+    }
     push(Modes::DONE);
 }
 
@@ -443,3 +454,159 @@ bool JSON_checker::Instance::pop(Modes mode)
 
     return true;
 }
+
+/**
+ * The pool of worker threads used by the BatchValidator. A batch is
+ * split into blocks of 64 documents (one word in the result bitmap) and
+ * the workers (and the calling thread) grab blocks until there is no
+ * more work left. Given that each block maps to its own word in the
+ * bitmap there is no need to synchronize the updates of the result.
+ */
+struct JSON_checker::BatchValidator::Pool {
+    struct Worker {
+        Worker(Pool& pool_) : pool(pool_) {}
+        Pool& pool;
+        cb_thread_t tid;
+        Instance instance;
+    };
+
+    Pool() : generation(0), shutdown(false), active(0),
+             docs(nullptr), count(0), bitmap(nullptr), next(0) {}
+
+    void process(Instance& instance) {
+        const size_t blocks = (count + 63) / 64;
+        size_t block;
+        while ((block = next.fetch_add(1, std::memory_order_relaxed)) < blocks) {
+            const size_t start = block * 64;
+            const size_t end = std::min(start + 64, count);
+            uint64_t word = 0;
+            for (size_t ii = start; ii < end; ++ii) {
+                bool valid;
+                try {
+                    valid = checkUTF8JSON(instance, docs[ii].data,
+                                          docs[ii].size);
+                } catch (std::bad_alloc&) {
+                    valid = false;
+                }
+                if (valid) {
+                    word |= uint64_t(1) << (ii - start);
+                }
+            }
+            bitmap[block] = word;
+        }
+    }
+
+    void run(Worker& worker) {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            while (!shutdown && generation == seen) {
+                cond.wait(lock);
+            }
+            if (shutdown) {
+                return;
+            }
+            seen = generation;
+            lock.unlock();
+            process(worker.instance);
+            lock.lock();
+            if (--active == 0) {
+                done.notify_one();
+            }
+        }
+    }
+
+    /**
+     * Tell all of the workers to stop, and wait for them to terminate
+     */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            shutdown = true;
+            cond.notify_all();
+        }
+        for (auto& worker : workers) {
+            cb_join_thread(worker->tid);
+        }
+        workers.clear();
+    }
+
+    static void thread_main(void* arg) {
+        auto* worker = reinterpret_cast<Worker*>(arg);
+        worker->pool.run(*worker);
+    }
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::condition_variable done;
+    uint64_t generation;
+    bool shutdown;
+    size_t active;
+
+    // The current batch
+    const Document* docs;
+    size_t count;
+    uint64_t* bitmap;
+    std::atomic<size_t> next;
+
+    Instance instance;
+    std::vector<std::unique_ptr<Worker> > workers;
+};
+
+JSON_checker::BatchValidator::BatchValidator(size_t workers)
+    : pool(new Pool) {
+    for (size_t ii = 0; ii < workers; ++ii) {
+        std::unique_ptr<Pool::Worker> worker(new Pool::Worker(*pool));
+        std::string name = "json_batch_" + std::to_string(ii);
+        if (name.length() > 15) {
+            name.resize(15);
+        }
+        if (cb_create_named_thread(&worker->tid, Pool::thread_main,
+                                   worker.get(), 0, name.c_str()) != 0) {
+            pool->stop();
+            throw std::bad_alloc();
+        }
+        pool->workers.emplace_back(std::move(worker));
+    }
+}
+
+JSON_checker::BatchValidator::~BatchValidator() {
+    pool->stop();
+}
+
+size_t JSON_checker::BatchValidator::getWorkers() const {
+    return pool->workers.size();
+}
+
+void JSON_checker::BatchValidator::validate(const Document* docs,
+                                            size_t count,
+                                            std::vector<uint64_t>& result) {
+    result.assign((count + 63) / 64, 0);
+    if (count == 0) {
+        return;
+    }
+
+    pool->docs = docs;
+    pool->count = count;
+    pool->bitmap = result.data();
+    pool->next.store(0, std::memory_order_relaxed);
+
+    if (pool->workers.empty() || count <= 64) {
+        // Not worth waking up the workers
+        pool->process(pool->instance);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->active = pool->workers.size();
+    ++pool->generation;
+    pool->cond.notify_all();
+    lock.unlock();
+
+    pool->process(pool->instance);
+
+    lock.lock();
+    while (pool->active != 0) {
+        pool->done.wait(lock);
+    }
+}
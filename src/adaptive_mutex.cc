@@ -0,0 +1,91 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+
+#include <platform/adaptive_mutex.h>
+
+#include <algorithm>
+#include <new>
+#include <thread>
+
+/**
+ * The number of times we try to grab the lock before parking the
+ * thread, and the maximum number of pause instructions between
+ * each attempt. With the exponential backoff this is a few
+ * microseconds of spinning on current hardware.
+ */
+static const int SpinAttempts = 12;
+static const unsigned int MaxBackoff = 256;
+
+/**
+ * Spinning on a single CPU system only delays the owner of the lock
+ */
+static const bool spinEnabled = std::thread::hardware_concurrency() > 1;
+
+void Couchbase::AdaptiveMutex::lockSlow() {
+    if (spinEnabled) {
+        unsigned int backoff = 4;
+        for (int ii = 0; ii < SpinAttempts; ++ii) {
+            uint32_t state = word.load(std::memory_order_relaxed);
+            if (state == 0 &&
+                word.compare_exchange_weak(state, 1,
+                                           std::memory_order_acquire,
+                                           std::memory_order_relaxed)) {
+                return;
+            }
+            for (unsigned int jj = 0; jj < backoff; ++jj) {
+                cpuRelax();
+            }
+            backoff = std::min(backoff * 2, MaxBackoff);
+        }
+    }
+
+    // Park the thread. Setting the state to 2 tells the owner that it
+    // must wake someone up when it releases the lock. Given that we
+    // don't know if there are other waiters we must keep it at 2 when we
+    // get the lock this way.
+    while (word.exchange(2, std::memory_order_acquire) != 0) {
+        futexWait(word, 2);
+    }
+}
+
+static_assert(sizeof(cb_adaptive_mutex_t) == sizeof(Couchbase::AdaptiveMutex),
+              "cb_adaptive_mutex_t must be the same size as AdaptiveMutex");
+
+static Couchbase::AdaptiveMutex& to_mutex(cb_adaptive_mutex_t* mutex) {
+    return *reinterpret_cast<Couchbase::AdaptiveMutex*>(mutex);
+}
+
+void cb_adaptive_mutex_initialize(cb_adaptive_mutex_t* mutex) {
+    new (mutex) Couchbase::AdaptiveMutex();
+}
+
+void cb_adaptive_mutex_destroy(cb_adaptive_mutex_t* mutex) {
+    to_mutex(mutex).~AdaptiveMutex();
+}
+
+void cb_adaptive_mutex_enter(cb_adaptive_mutex_t* mutex) {
+    to_mutex(mutex).lock();
+}
+
+int cb_adaptive_mutex_try_enter(cb_adaptive_mutex_t* mutex) {
+    return to_mutex(mutex).try_lock() ? 0 : -1;
+}
+
+void cb_adaptive_mutex_exit(cb_adaptive_mutex_t* mutex) {
+    to_mutex(mutex).unlock();
+}
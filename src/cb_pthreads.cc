@@ -15,8 +15,13 @@
  *   limitations under the License.
  */
 #include "config.h"
+#include "lock_profiler_private.h"
+#include "thread_registry_private.h"
+
+#include <platform/thread_local.h>
 
 #include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -25,6 +30,7 @@
 #include <new>
 #include <stdexcept>
 #include <string>
+#include <sched.h>
 #include <sys/time.h>
 #include <system_error>
 
@@ -36,7 +42,8 @@ class CouchbaseThread {
 public:
     CouchbaseThread(cb_thread_main_func func_,
                     void* argument_,
-                    const char* name_)
+                    const char* name_,
+                    const cb_thread_options_t* options_)
         : func(func_),
           argument(argument_) {
         if (name_) {
@@ -45,25 +52,69 @@ public:
                 throw std::logic_error("name exceeds 15 characters");
             }
         }
+        if (options_) {
+            options = *options_;
+        } else {
+            cb_thread_options_initialize(&options);
+        }
     }
 
     void run() {
         if (!name.empty()) {
             cb_set_thread_name(name.c_str());
         }
+        applyPlacement();
         func(argument);
     }
 
+    const char* getName() const {
+        return name.empty() ? nullptr : name.c_str();
+    }
+
 private:
+    /**
+     * Bind the thread to the requested NUMA node and CPUs. The options
+     * are validated before the thread is created so a failure here
+     * would only be caused by a race with CPU hotplug / cgroup changes,
+     * in which case we'll just run without the binding. Thread affinity
+     * is only supported on Linux; elsewhere the only placement accepted
+     * by validate_placement is the single NUMA node holding all CPUs,
+     * so there is nothing to apply.
+     */
+    void applyPlacement() {
+#ifdef __linux__
+        if (options.numa_node >= 0) {
+            cb_bind_thread_to_numa_node(options.numa_node);
+        }
+
+        if (cb_cpuset_count(&options.affinity) > 0) {
+            cb_cpuset_t set = options.affinity;
+            if (options.numa_node >= 0) {
+                cb_cpuset_t node;
+                if (cb_get_numa_node_cpus(options.numa_node, &node) == 0) {
+                    for (int ii = 0; ii < CB_MAX_CPUS / 64; ++ii) {
+                        set.bits[ii] &= node.bits[ii];
+                    }
+                }
+            }
+            cb_set_thread_affinity(&set);
+        }
+#endif
+    }
+
     cb_thread_main_func func;
     std::string name;
     void* argument;
+    cb_thread_options_t options;
 };
 
 static void *platform_thread_wrap(void *arg)
 {
     std::unique_ptr<CouchbaseThread> context(reinterpret_cast<CouchbaseThread*>(arg));
+    Couchbase::ThreadRegistry::registerThread(context->getName());
     context->run();
+    Couchbase::ThreadLocalBase::threadExit();
+    Couchbase::ThreadRegistry::unregisterThread();
     return NULL;
 }
 
@@ -79,10 +130,118 @@ int cb_create_thread(cb_thread_t *id,
 int cb_create_named_thread(cb_thread_t *id, cb_thread_main_func func, void *arg,
                            int detached, const char* name)
 {
+    return cb_create_named_thread_ex(id, func, arg, detached, name, NULL);
+}
+
+/**
+ * Check that the NUMA node and CPU affinity in the options may be
+ * satisfied
+ */
+static bool validate_placement(const cb_thread_options_t *options)
+{
+    const bool affinity = cb_cpuset_count(&options->affinity) > 0;
+#ifndef __linux__
+    if (affinity) {
+        // We can't set the affinity of a thread on this platform
+        errno = ENOTSUP;
+        return false;
+    }
+#endif
+    if (options->numa_node >= 0) {
+        cb_cpuset_t node;
+        if (cb_get_numa_node_cpus(options->numa_node, &node) != 0) {
+            return false;
+        }
+        if (affinity) {
+            for (int ii = 0; ii < CB_MAX_CPUS / 64; ++ii) {
+                if (options->affinity.bits[ii] & node.bits[ii]) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Apply the stack size and scheduling options to the thread attributes
+ */
+static int apply_attributes(pthread_attr_t *attr,
+                            const cb_thread_options_t *options)
+{
+    if (options->stack_size != 0) {
+        size_t size = options->stack_size;
+        const size_t minimum = size_t(PTHREAD_STACK_MIN);
+        if (size < minimum) {
+            size = minimum;
+        }
+        // Round up to the page size as some platforms require it
+        const size_t pagesize = size_t(sysconf(_SC_PAGESIZE));
+        size = (size + pagesize - 1) / pagesize * pagesize;
+        int rv = pthread_attr_setstacksize(attr, size);
+        if (rv != 0) {
+            return rv;
+        }
+    }
+
+    int policy;
+    switch (options->sched_policy) {
+    case CB_SCHED_DEFAULT:
+        return 0;
+    case CB_SCHED_OTHER:
+        policy = SCHED_OTHER;
+        break;
+    case CB_SCHED_BATCH:
+#ifdef SCHED_BATCH
+        policy = SCHED_BATCH;
+        break;
+#else
+        return ENOTSUP;
+#endif
+    case CB_SCHED_IDLE:
+#ifdef SCHED_IDLE
+        policy = SCHED_IDLE;
+        break;
+#else
+        return ENOTSUP;
+#endif
+    case CB_SCHED_FIFO:
+        policy = SCHED_FIFO;
+        break;
+    case CB_SCHED_RR:
+        policy = SCHED_RR;
+        break;
+    default:
+        return EINVAL;
+    }
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = options->sched_priority;
+
+    int rv = pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+    if (rv == 0) {
+        rv = pthread_attr_setschedpolicy(attr, policy);
+    }
+    if (rv == 0) {
+        rv = pthread_attr_setschedparam(attr, &param);
+    }
+    return rv;
+}
+
+int cb_create_named_thread_ex(cb_thread_t *id, cb_thread_main_func func,
+                              void *arg, int detached, const char* name,
+                              const cb_thread_options_t *options)
+{
+    if (options && !validate_placement(options)) {
+        return -1;
+    }
+
     int ret;
     CouchbaseThread* ctx;
     try {
-        ctx = new CouchbaseThread(func, arg, name);
+        ctx = new CouchbaseThread(func, arg, name, options);
     } catch (std::bad_alloc&) {
         return -1;
     } catch (std::logic_error&) {
@@ -97,6 +256,13 @@ int cb_create_named_thread(cb_thread_t *id, cb_thread_main_func func, void *arg,
 
     if (detached &&
         pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0) {
+        pthread_attr_destroy(&attr);
+        delete ctx;
+        return -1;
+    }
+
+    if (options && apply_attributes(&attr, options) != 0) {
+        pthread_attr_destroy(&attr);
         delete ctx;
         return -1;
     }
@@ -132,6 +298,7 @@ int cb_set_thread_name(const char* name)
     // No thread argument (implicit current thread).
     int ret = pthread_setname_np(name);
     if (ret == 0) {
+        Couchbase::ThreadRegistry::setName(name);
         return 0;
     } else if (errno == ENAMETOOLONG) {
         return 1;
@@ -140,6 +307,7 @@ int cb_set_thread_name(const char* name)
     errno = 0;
     int ret = pthread_setname_np(pthread_self(), name);
     if (ret == 0) {
+        Couchbase::ThreadRegistry::setName(name);
         return 0;
     } else if (errno == ERANGE || ret == ERANGE) {
         return 1;
@@ -180,6 +348,9 @@ void cb_mutex_initialize(cb_mutex_t *mutex)
 
 void cb_mutex_destroy(cb_mutex_t *mutex)
 {
+    if (Couchbase::LockProfiler::hasEntries()) {
+        Couchbase::LockProfiler::destroyed(mutex);
+    }
     int rv = pthread_mutex_destroy(mutex);
     if (rv != 0) {
         throw std::system_error(rv, std::system_category(),
@@ -189,7 +360,19 @@ void cb_mutex_destroy(cb_mutex_t *mutex)
 
 void cb_mutex_enter(cb_mutex_t *mutex)
 {
-    int rv = pthread_mutex_lock(mutex);
+    using namespace Couchbase::LockProfiler;
+    int rv;
+    if (active()) {
+        rv = profiledAcquire(mutex, LockType::Mutex,
+                             [mutex]() {
+                                 return pthread_mutex_trylock(mutex) == 0;
+                             },
+                             [mutex]() {
+                                 return pthread_mutex_lock(mutex);
+                             });
+    } else {
+        rv = pthread_mutex_lock(mutex);
+    }
     if (rv != 0) {
         throw std::system_error(rv, std::system_category(),
                                 "Failed to lock mutex");
@@ -197,11 +380,21 @@ void cb_mutex_enter(cb_mutex_t *mutex)
 }
 
 int cb_mutex_try_enter(cb_mutex_t *mutex) {
-    return pthread_mutex_trylock(mutex) == 0 ? 0 : -1;
+    if (pthread_mutex_trylock(mutex) != 0) {
+        return -1;
+    }
+    if (Couchbase::LockProfiler::active()) {
+        Couchbase::LockProfiler::acquired(
+            mutex, Couchbase::LockProfiler::LockType::Mutex, 0, false);
+    }
+    return 0;
 }
 
 void cb_mutex_exit(cb_mutex_t *mutex)
 {
+    if (Couchbase::LockProfiler::active()) {
+        Couchbase::LockProfiler::released(mutex);
+    }
     int rv = pthread_mutex_unlock(mutex);
     if (rv != 0) {
         throw std::system_error(rv, std::system_category(),
@@ -211,7 +404,21 @@ void cb_mutex_exit(cb_mutex_t *mutex)
 
 void cb_cond_initialize(cb_cond_t *cond)
 {
+#ifdef HAVE_PTHREAD_CONDATTR_SETCLOCK
+    // Use the monotonic clock for the timed waits so that they aren't
+    // affected by changes to the wall clock
+    pthread_condattr_t attr;
+    int rv = pthread_condattr_init(&attr);
+    if (rv == 0) {
+        rv = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        if (rv == 0) {
+            rv = pthread_cond_init(cond, &attr);
+        }
+        pthread_condattr_destroy(&attr);
+    }
+#else
     int rv = pthread_cond_init(cond, NULL);
+#endif
     if (rv != 0) {
         throw std::system_error(rv, std::system_category(),
                                 "Failed to initialize condition variable");
@@ -229,7 +436,14 @@ void cb_cond_destroy(cb_cond_t *cond)
 
 void cb_cond_wait(cb_cond_t *cond, cb_mutex_t *mutex)
 {
+    const bool profiled = Couchbase::LockProfiler::active();
+    if (profiled) {
+        Couchbase::LockProfiler::released(mutex);
+    }
     int rv = pthread_cond_wait(cond, mutex);
+    if (profiled) {
+        Couchbase::LockProfiler::reacquired(mutex);
+    }
     if (rv != 0) {
         throw std::system_error(rv, std::system_category(),
                                 "Failed to wait on condition variable");
@@ -254,34 +468,58 @@ void cb_cond_broadcast(cb_cond_t *cond)
     }
 }
 
-void cb_cond_timedwait(cb_cond_t *cond, cb_mutex_t *mutex, unsigned int ms)
+int cb_cond_wait_until(cb_cond_t *cond, cb_mutex_t *mutex, uint64_t deadline)
 {
     struct timespec ts;
+#ifdef HAVE_PTHREAD_CONDATTR_SETCLOCK
+    // The condition variable uses the same clock as cb_get_monotonic_ns
+    ts.tv_sec = deadline / 1000000000ULL;
+    ts.tv_nsec = deadline % 1000000000ULL;
+#else
+    // We can only wait for a wall clock time. Convert the deadline to
+    // the wall clock (and accept that clock changes affect the wait)
+    const uint64_t now = cb_get_monotonic_ns();
     struct timeval tp;
-    uint64_t wakeup;
-
-    memset(&ts, 0, sizeof(ts));
-
-    /*
-     * Unfortunately pthreads don't support relative sleeps so we need
-     * to convert back to an absolute time...
-     */
     gettimeofday(&tp, NULL);
-    wakeup = ((uint64_t)(tp.tv_sec) * 1000) + (tp.tv_usec / 1000) + ms;
-    /* Round up for sub ms */
-    if ((tp.tv_usec % 1000) > 499) {
-        ++wakeup;
+    const uint64_t wallclock = (uint64_t)(tp.tv_sec) * 1000000000ULL +
+                               (uint64_t)(tp.tv_usec) * 1000;
+    uint64_t timeout = deadline > now ? deadline - now : 0;
+    if (timeout > UINT64_MAX - wallclock) {
+        timeout = UINT64_MAX - wallclock;
     }
+    const uint64_t wakeup = wallclock + timeout;
+    ts.tv_sec = wakeup / 1000000000ULL;
+    ts.tv_nsec = wakeup % 1000000000ULL;
+#endif
 
-    ts.tv_sec = wakeup / 1000;
-    wakeup %= 1000;
-    ts.tv_nsec = wakeup * 1000000;
-
+    const bool profiled = Couchbase::LockProfiler::active();
+    if (profiled) {
+        Couchbase::LockProfiler::released(mutex);
+    }
     int rv = pthread_cond_timedwait(cond, mutex, &ts);
-    if (rv != 0 && rv != ETIMEDOUT) {
+    if (profiled) {
+        Couchbase::LockProfiler::reacquired(mutex);
+    }
+    if (rv == ETIMEDOUT) {
+        return -1;
+    }
+    if (rv != 0) {
         throw std::system_error(rv, std::system_category(),
                                 "Failed to do timed wait on condition variable");
     }
+    return 0;
+}
+
+int cb_cond_timedwait_ns(cb_cond_t *cond, cb_mutex_t *mutex, uint64_t ns)
+{
+    const uint64_t now = cb_get_monotonic_ns();
+    const uint64_t deadline = ns > UINT64_MAX - now ? UINT64_MAX : now + ns;
+    return cb_cond_wait_until(cond, mutex, deadline);
+}
+
+void cb_cond_timedwait(cb_cond_t *cond, cb_mutex_t *mutex, unsigned int ms)
+{
+    cb_cond_timedwait_ns(cond, mutex, uint64_t(ms) * 1000000);
 }
 
 #ifdef __APPLE__
@@ -379,6 +617,9 @@ void cb_rw_lock_initialize(cb_rwlock_t *rw)
 
 void cb_rw_lock_destroy(cb_rwlock_t *rw)
 {
+    if (Couchbase::LockProfiler::hasEntries()) {
+        Couchbase::LockProfiler::destroyed(rw);
+    }
     int rv = pthread_rwlock_destroy(rw);
     if (rv != 0) {
         throw std::system_error(rv, std::system_category(),
@@ -388,7 +629,19 @@ void cb_rw_lock_destroy(cb_rwlock_t *rw)
 
 int cb_rw_reader_enter(cb_rwlock_t *rw)
 {
-    int result = pthread_rwlock_rdlock(rw);
+    using namespace Couchbase::LockProfiler;
+    int result;
+    if (active()) {
+        result = profiledAcquire(rw, LockType::RWLock,
+                                 [rw]() {
+                                     return pthread_rwlock_tryrdlock(rw) == 0;
+                                 },
+                                 [rw]() {
+                                     return pthread_rwlock_rdlock(rw);
+                                 });
+    } else {
+        result = pthread_rwlock_rdlock(rw);
+    }
     if (result != 0) {
         char buffer[64];
         strerror_r(result, buffer, sizeof(buffer));
@@ -400,6 +653,9 @@ int cb_rw_reader_enter(cb_rwlock_t *rw)
 
 int cb_rw_reader_exit(cb_rwlock_t *rw)
 {
+    if (Couchbase::LockProfiler::active()) {
+        Couchbase::LockProfiler::released(rw);
+    }
     int result = pthread_rwlock_unlock(rw);
     if (result != 0) {
         char buffer[64];
@@ -412,7 +668,19 @@ int cb_rw_reader_exit(cb_rwlock_t *rw)
 
 int cb_rw_writer_enter(cb_rwlock_t *rw)
 {
-    int result = pthread_rwlock_wrlock(rw);
+    using namespace Couchbase::LockProfiler;
+    int result;
+    if (active()) {
+        result = profiledAcquire(rw, LockType::RWLock,
+                                 [rw]() {
+                                     return pthread_rwlock_trywrlock(rw) == 0;
+                                 },
+                                 [rw]() {
+                                     return pthread_rwlock_wrlock(rw);
+                                 });
+    } else {
+        result = pthread_rwlock_wrlock(rw);
+    }
     if (result != 0) {
         char buffer[64];
         strerror_r(result, buffer, sizeof(buffer));
@@ -424,6 +692,9 @@ int cb_rw_writer_enter(cb_rwlock_t *rw)
 
 int cb_rw_writer_exit(cb_rwlock_t *rw)
 {
+    if (Couchbase::LockProfiler::active()) {
+        Couchbase::LockProfiler::released(rw);
+    }
     int result = pthread_rwlock_unlock(rw);
     if (result != 0) {
         char buffer[64];
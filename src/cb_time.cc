@@ -67,6 +67,42 @@ uint64_t cb_get_monotonic_seconds() {
     return seconds;
 }
 
+/*
+    return a monotonically increasing value with a nanosecond frequency.
+*/
+uint64_t cb_get_monotonic_ns() {
+#if defined(WIN32)
+    static LARGE_INTEGER frequency;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    /* Split the conversion to avoid overflowing the multiplication */
+    const uint64_t seconds = counter.QuadPart / frequency.QuadPart;
+    const uint64_t rest = counter.QuadPart % frequency.QuadPart;
+    return seconds * 1000000000ULL +
+           (rest * 1000000000ULL) / frequency.QuadPart;
+#elif defined(__APPLE__)
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) {
+      mach_timebase_info(&timebase);
+    }
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+#elif defined(__linux__) || defined(__sun) || defined(__FreeBSD__)
+    struct timespec tm;
+    if (clock_gettime(CLOCK_MONOTONIC, &tm) == -1) {
+        fprintf(stderr, "clock_gettime failed, aborting program: %s",
+                strerror(errno));
+        fflush(stderr);
+        abort();
+    }
+    return uint64_t(tm.tv_sec) * 1000000000ULL + tm.tv_nsec;
+#else
+#error "Don't know how to build cb_get_monotonic_ns"
+#endif
+}
+
 /*
     obtain a timeval structure containing the current time since EPOCH.
 */
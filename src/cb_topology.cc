@@ -0,0 +1,331 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * CPU sets, thread affinity and the CPU / NUMA topology.
+ *
+ * On Linux the topology is read from sysfs so that we don't depend on
+ * libnuma; libnuma is only used (if available) to set the preferred
+ * memory node when binding a thread to a NUMA node.
+ */
+#include "config.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+void cb_cpuset_zero(cb_cpuset_t *set)
+{
+    memset(set, 0, sizeof(*set));
+}
+
+int cb_cpuset_set(cb_cpuset_t *set, int cpu)
+{
+    if (cpu < 0 || cpu >= CB_MAX_CPUS) {
+        return -1;
+    }
+    set->bits[cpu / 64] |= uint64_t(1) << (cpu % 64);
+    return 0;
+}
+
+bool cb_cpuset_isset(const cb_cpuset_t *set, int cpu)
+{
+    if (cpu < 0 || cpu >= CB_MAX_CPUS) {
+        return false;
+    }
+    return (set->bits[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+int cb_cpuset_count(const cb_cpuset_t *set)
+{
+    int ret = 0;
+    for (int cpu = 0; cpu < CB_MAX_CPUS; ++cpu) {
+        if (cb_cpuset_isset(set, cpu)) {
+            ++ret;
+        }
+    }
+    return ret;
+}
+
+void cb_thread_options_initialize(cb_thread_options_t *options)
+{
+    options->stack_size = 0;
+    options->sched_policy = CB_SCHED_DEFAULT;
+    options->sched_priority = 0;
+    options->numa_node = -1;
+    cb_cpuset_zero(&options->affinity);
+}
+
+#ifdef WIN32
+
+/*
+ * Windows splits the CPUs into processor groups of (up to) 64 CPUs, and
+ * a thread only runs within one group. CPU n in a cb_cpuset_t is CPU
+ * n % 64 in group n / 64, so every word of the set is one group.
+ */
+
+int cb_set_thread_affinity(const cb_cpuset_t *set)
+{
+    // A thread can't span processor groups; use the first group with
+    // any CPUs in the set
+    for (int group = 0; group < CB_MAX_CPUS / 64; ++group) {
+        if (set->bits[group] != 0) {
+            GROUP_AFFINITY affinity;
+            memset(&affinity, 0, sizeof(affinity));
+            affinity.Mask = static_cast<KAFFINITY>(set->bits[group]);
+            affinity.Group = static_cast<WORD>(group);
+            return SetThreadGroupAffinity(GetCurrentThread(), &affinity,
+                                          NULL) ? 0 : -1;
+        }
+    }
+    return -1;
+}
+
+int cb_get_thread_affinity(cb_cpuset_t *set)
+{
+    GROUP_AFFINITY affinity;
+    if (!GetThreadGroupAffinity(GetCurrentThread(), &affinity) ||
+        affinity.Group >= CB_MAX_CPUS / 64) {
+        return -1;
+    }
+    cb_cpuset_zero(set);
+    set->bits[affinity.Group] = affinity.Mask;
+    return 0;
+}
+
+int cb_get_num_cpus(void)
+{
+    DWORD ret = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    return ret < 1 ? 1 : static_cast<int>(ret);
+}
+
+int cb_get_num_numa_nodes(void)
+{
+    ULONG highest;
+    if (!GetNumaHighestNodeNumber(&highest)) {
+        return 1;
+    }
+    return static_cast<int>(highest) + 1;
+}
+
+int cb_get_numa_node_cpus(int node, cb_cpuset_t *set)
+{
+    GROUP_AFFINITY affinity;
+    if (node < 0 || node >= cb_get_num_numa_nodes() ||
+        !GetNumaNodeProcessorMaskEx(static_cast<USHORT>(node), &affinity) ||
+        affinity.Group >= CB_MAX_CPUS / 64 || affinity.Mask == 0) {
+        return -1;
+    }
+    cb_cpuset_zero(set);
+    set->bits[affinity.Group] = affinity.Mask;
+    return 0;
+}
+
+#else
+
+#ifdef __linux__
+static int set_affinity(const cb_cpuset_t *set)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu = 0; cpu < CB_MAX_CPUS && cpu < CPU_SETSIZE; ++cpu) {
+        if (cb_cpuset_isset(set, cpu)) {
+            CPU_SET(cpu, &cpus);
+        }
+    }
+    return sched_setaffinity(0, sizeof(cpus), &cpus) == 0 ? 0 : -1;
+}
+
+/**
+ * Parse a CPU list as used by sysfs (ex: "0-3,8,10-11")
+ */
+static bool parse_cpulist(const std::string& list, cb_cpuset_t *set)
+{
+    cb_cpuset_zero(set);
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+        int first;
+        int last;
+        char dash;
+        std::stringstream rs(range);
+        if (!(rs >> first)) {
+            return false;
+        }
+        last = first;
+        if (rs >> dash) {
+            if (dash != '-' || !(rs >> last)) {
+                return false;
+            }
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cb_cpuset_set(set, cpu);
+        }
+    }
+    return true;
+}
+
+static bool read_sysfs(const std::string& path, std::string& content)
+{
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    std::getline(file, content);
+    return true;
+}
+#endif
+
+int cb_set_thread_affinity(const cb_cpuset_t *set)
+{
+#ifdef __linux__
+    return set_affinity(set);
+#else
+    (void)set;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int cb_get_thread_affinity(cb_cpuset_t *set)
+{
+#ifdef __linux__
+    cpu_set_t cpus;
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0) {
+        return -1;
+    }
+    cb_cpuset_zero(set);
+    for (int cpu = 0; cpu < CB_MAX_CPUS && cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &cpus)) {
+            cb_cpuset_set(set, cpu);
+        }
+    }
+    return 0;
+#else
+    (void)set;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int cb_get_num_cpus(void)
+{
+    long ret = sysconf(_SC_NPROCESSORS_ONLN);
+    return ret < 1 ? 1 : static_cast<int>(ret);
+}
+
+int cb_get_num_numa_nodes(void)
+{
+#ifdef __linux__
+    std::string online;
+    cb_cpuset_t nodes;
+    if (read_sysfs("/sys/devices/system/node/online", online) &&
+        parse_cpulist(online, &nodes)) {
+        // The node numbers may be sparse; report the highest + 1 so that
+        // all nodes may be addressed
+        for (int node = CB_MAX_CPUS - 1; node >= 0; --node) {
+            if (cb_cpuset_isset(&nodes, node)) {
+                return node + 1;
+            }
+        }
+    }
+#endif
+    return 1;
+}
+
+int cb_get_numa_node_cpus(int node, cb_cpuset_t *set)
+{
+    if (node < 0 || node >= cb_get_num_numa_nodes()) {
+        return -1;
+    }
+#ifdef __linux__
+    if (access("/sys/devices/system/node", F_OK) == 0) {
+        // The node numbers may be sparse, and a node may have memory but
+        // no CPUs
+        std::string online;
+        std::string cpulist;
+        cb_cpuset_t nodes;
+        if (!read_sysfs("/sys/devices/system/node/online", online) ||
+            !parse_cpulist(online, &nodes) ||
+            !cb_cpuset_isset(&nodes, node) ||
+            !read_sysfs("/sys/devices/system/node/node" +
+                        std::to_string(node) + "/cpulist", cpulist) ||
+            !parse_cpulist(cpulist, set) ||
+            cb_cpuset_count(set) == 0) {
+            return -1;
+        }
+        return 0;
+    }
+#endif
+    // No NUMA information; all CPUs belong to node 0
+    if (node != 0) {
+        return -1;
+    }
+    cb_cpuset_zero(set);
+    const int cpus = cb_get_num_cpus();
+    for (int cpu = 0; cpu < cpus; ++cpu) {
+        cb_cpuset_set(set, cpu);
+    }
+    return 0;
+}
+
+#endif
+
+int cb_get_cpu_numa_node(int cpu)
+{
+    const int nodes = cb_get_num_numa_nodes();
+    cb_cpuset_t set;
+    for (int node = 0; node < nodes; ++node) {
+        if (cb_get_numa_node_cpus(node, &set) == 0 &&
+            cb_cpuset_isset(&set, cpu)) {
+            return node;
+        }
+    }
+    return -1;
+}
+
+int cb_bind_thread_to_numa_node(int node)
+{
+    cb_cpuset_t set;
+    if (cb_get_numa_node_cpus(node, &set) != 0 ||
+        cb_cpuset_count(&set) == 0) {
+        return -1;
+    }
+    if (cb_set_thread_affinity(&set) != 0) {
+        return -1;
+    }
+#ifdef HAVE_LIBNUMA
+    if (numa_available() != -1) {
+        numa_set_preferred(node);
+    }
+#endif
+    return 0;
+}
@@ -15,25 +15,101 @@
  *   limitations under the License.
  */
 #include "config.h"
+#include "lock_profiler_private.h"
+#include "thread_registry_private.h"
 
 #include <platform/strerror.h>
+#include <platform/thread_local.h>
 #include <assert.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <io.h>
+#include <string>
 #include <vector>
 
 struct thread_execute {
     cb_thread_main_func func;
     void *argument;
+    cb_thread_options_t options;
+    /** Only used by the thread registry (thread naming isn't supported) */
+    std::string name;
 };
 
+/**
+ * Apply the scheduling and placement options from within the new thread.
+ * Windows don't have scheduling policies so we map them to the
+ * corresponding thread priority.
+ */
+static void apply_thread_options(const cb_thread_options_t& options)
+{
+    switch (options.sched_policy) {
+    case CB_SCHED_BATCH:
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+        break;
+    case CB_SCHED_IDLE:
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+        break;
+    case CB_SCHED_FIFO:
+    case CB_SCHED_RR:
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+        break;
+    default:
+        break;
+    }
+
+    cb_cpuset_t set = options.affinity;
+    if (options.numa_node >= 0) {
+        cb_cpuset_t node;
+        if (cb_get_numa_node_cpus(options.numa_node, &node) == 0) {
+            if (cb_cpuset_count(&set) == 0) {
+                set = node;
+            } else {
+                for (int ii = 0; ii < CB_MAX_CPUS / 64; ++ii) {
+                    set.bits[ii] &= node.bits[ii];
+                }
+            }
+        }
+    }
+    if (cb_cpuset_count(&set) > 0) {
+        cb_set_thread_affinity(&set);
+    }
+}
+
+/**
+ * Check that the NUMA node and CPU affinity in the options may be
+ * satisfied
+ */
+static bool validate_placement(const cb_thread_options_t *options)
+{
+    if (options->numa_node < 0) {
+        return true;
+    }
+    cb_cpuset_t node;
+    if (cb_get_numa_node_cpus(options->numa_node, &node) != 0) {
+        return false;
+    }
+    if (cb_cpuset_count(&options->affinity) == 0) {
+        return true;
+    }
+    for (int ii = 0; ii < CB_MAX_CPUS / 64; ++ii) {
+        if (options->affinity.bits[ii] & node.bits[ii]) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static DWORD WINAPI platform_thread_wrap(LPVOID arg)
 {
     auto *ctx = reinterpret_cast<struct thread_execute*>(arg);
     assert(ctx);
+    Couchbase::ThreadRegistry::registerThread(
+        ctx->name.empty() ? nullptr : ctx->name.c_str());
+    apply_thread_options(ctx->options);
     ctx->func(ctx->argument);
     delete ctx;
+    Couchbase::ThreadLocalBase::threadExit();
+    Couchbase::ThreadRegistry::unregisterThread();
     return 0;
 }
 
@@ -43,9 +119,21 @@ int cb_create_thread(cb_thread_t *id,
                      void (*func)(void *arg),
                      void *arg,
                      int detached)
+{
+    return cb_create_named_thread_ex(id, func, arg, detached, NULL, NULL);
+}
+
+__declspec(dllexport)
+int cb_create_named_thread_ex(cb_thread_t *id, cb_thread_main_func func,
+                              void *arg, int detached, const char* name,
+                              const cb_thread_options_t *options)
 {
     HANDLE handle;
 
+    if (options && !validate_placement(options)) {
+        return -1;
+    }
+
     struct thread_execute *ctx;
     try {
         ctx = new struct thread_execute;
@@ -55,8 +143,17 @@ int cb_create_thread(cb_thread_t *id,
 
     ctx->func = func;
     ctx->argument = arg;
+    if (name) {
+        ctx->name.assign(name);
+    }
+    if (options) {
+        ctx->options = *options;
+    } else {
+        cb_thread_options_initialize(&ctx->options);
+    }
 
-    handle = CreateThread(NULL, 0, platform_thread_wrap, ctx, 0, id);
+    handle = CreateThread(NULL, ctx->options.stack_size,
+                          platform_thread_wrap, ctx, 0, id);
     if (handle == NULL) {
         delete ctx;
         return -1;
@@ -73,9 +170,9 @@ __declspec(dllexport)
 int cb_create_named_thread(cb_thread_t *id, void (*func)(void *arg), void *arg,
                      int detached, const char* name)
 {
-    // Thread naming not supported on WIN32, just call down to non-named
-    // variant.
-    return cb_create_thread(id, func, arg, detached);
+    // Thread naming not supported on WIN32, but the name is kept in the
+    // thread registry
+    return cb_create_named_thread_ex(id, func, arg, detached, name, NULL);
 }
 
 __declspec(dllexport)
@@ -103,9 +200,10 @@ int cb_thread_equal(const cb_thread_t a, const cb_thread_t b)
 }
 
 __declspec(dllexport)
-int cb_set_thread_name(const char*)
+int cb_set_thread_name(const char* name)
 {
-    // Not implemented on WIN32
+    // Not implemented on WIN32, but keep the name for the thread registry
+    Couchbase::ThreadRegistry::setName(name);
     return -1;
 }
 
@@ -130,24 +228,49 @@ void cb_mutex_initialize(cb_mutex_t *mutex)
 __declspec(dllexport)
 void cb_mutex_destroy(cb_mutex_t *mutex)
 {
+    if (Couchbase::LockProfiler::hasEntries()) {
+        Couchbase::LockProfiler::destroyed(mutex);
+    }
     DeleteCriticalSection(mutex);
 }
 
 __declspec(dllexport)
 void cb_mutex_enter(cb_mutex_t *mutex)
 {
-    EnterCriticalSection(mutex);
+    using namespace Couchbase::LockProfiler;
+    if (active()) {
+        profiledAcquire(mutex, LockType::Mutex,
+                        [mutex]() {
+                            return TryEnterCriticalSection(mutex) != 0;
+                        },
+                        [mutex]() {
+                            EnterCriticalSection(mutex);
+                            return 0;
+                        });
+    } else {
+        EnterCriticalSection(mutex);
+    }
 }
 
 __declspec(dllexport)
 int cb_mutex_try_enter(cb_mutex_t *mutex)
 {
-    return TryEnterCriticalSection(mutex) ? 0 : -1;
+    if (!TryEnterCriticalSection(mutex)) {
+        return -1;
+    }
+    if (Couchbase::LockProfiler::active()) {
+        Couchbase::LockProfiler::acquired(
+            mutex, Couchbase::LockProfiler::LockType::Mutex, 0, false);
+    }
+    return 0;
 }
 
 __declspec(dllexport)
 void cb_mutex_exit(cb_mutex_t *mutex)
 {
+    if (Couchbase::LockProfiler::active()) {
+        Couchbase::LockProfiler::released(mutex);
+    }
     LeaveCriticalSection(mutex);
 }
 
@@ -166,12 +289,56 @@ void cb_cond_destroy(cb_cond_t *cond)
 __declspec(dllexport)
 void cb_cond_wait(cb_cond_t *cond, cb_mutex_t *mutex)
 {
+    const bool profiled = Couchbase::LockProfiler::active();
+    if (profiled) {
+        Couchbase::LockProfiler::released(mutex);
+    }
     SleepConditionVariableCS(cond, mutex, INFINITE);
+    if (profiled) {
+        Couchbase::LockProfiler::reacquired(mutex);
+    }
+}
+
+__declspec(dllexport)
+int cb_cond_wait_until(cb_cond_t *cond, cb_mutex_t *mutex, uint64_t deadline)
+{
+    const uint64_t now = cb_get_monotonic_ns();
+    const uint64_t timeout = deadline > now ? deadline - now : 0;
+    return cb_cond_timedwait_ns(cond, mutex, timeout);
+}
+
+__declspec(dllexport)
+int cb_cond_timedwait_ns(cb_cond_t *cond, cb_mutex_t *mutex, uint64_t ns)
+{
+    // Windows only supports ms resolution; round up so that we never
+    // return before the timeout expired. INFINITE is 0xFFFFFFFF, so
+    // cap the timeout just below it.
+    uint64_t ms = ns / 1000000;
+    if (ns % 1000000) {
+        ++ms;
+    }
+    if (ms >= INFINITE) {
+        ms = INFINITE - 1;
+    }
+
+    const bool profiled = Couchbase::LockProfiler::active();
+    if (profiled) {
+        Couchbase::LockProfiler::released(mutex);
+    }
+    BOOL ret = SleepConditionVariableCS(cond, mutex, DWORD(ms));
+    DWORD error = ret ? 0 : GetLastError();
+    if (profiled) {
+        Couchbase::LockProfiler::reacquired(mutex);
+    }
+    if (!ret && error == ERROR_TIMEOUT) {
+        return -1;
+    }
+    return 0;
 }
 
 __declspec(dllexport)
 void cb_cond_timedwait(cb_cond_t *cond, cb_mutex_t *mutex, unsigned int msec) {
-    SleepConditionVariableCS(cond, mutex, msec);
+    cb_cond_timedwait_ns(cond, mutex, uint64_t(msec) * 1000000);
 }
 
 __declspec(dllexport)
@@ -300,13 +467,25 @@ void cb_rw_lock_initialize(cb_rwlock_t *rw)
 __declspec(dllexport)
 void cb_rw_lock_destroy(cb_rwlock_t *rw)
 {
-    (void)rw;
-    // Nothing todo on windows
+    if (Couchbase::LockProfiler::hasEntries()) {
+        Couchbase::LockProfiler::destroyed(rw);
+    }
 }
 
 __declspec(dllexport)
 int cb_rw_reader_enter(cb_rwlock_t *rw)
 {
+    using namespace Couchbase::LockProfiler;
+    if (active()) {
+        return profiledAcquire(rw, LockType::RWLock,
+                               [rw]() {
+                                   return TryAcquireSRWLockShared(rw) != 0;
+                               },
+                               [rw]() {
+                                   AcquireSRWLockShared(rw);
+                                   return 0;
+                               });
+    }
     AcquireSRWLockShared(rw);
     return 0;
 }
@@ -314,6 +493,9 @@ int cb_rw_reader_enter(cb_rwlock_t *rw)
 __declspec(dllexport)
 int cb_rw_reader_exit(cb_rwlock_t *rw)
 {
+    if (Couchbase::LockProfiler::active()) {
+        Couchbase::LockProfiler::released(rw);
+    }
     ReleaseSRWLockShared(rw);
     return 0;
 }
@@ -321,6 +503,17 @@ int cb_rw_reader_exit(cb_rwlock_t *rw)
 __declspec(dllexport)
 int cb_rw_writer_enter(cb_rwlock_t *rw)
 {
+    using namespace Couchbase::LockProfiler;
+    if (active()) {
+        return profiledAcquire(rw, LockType::RWLock,
+                               [rw]() {
+                                   return TryAcquireSRWLockExclusive(rw) != 0;
+                               },
+                               [rw]() {
+                                   AcquireSRWLockExclusive(rw);
+                                   return 0;
+                               });
+    }
     AcquireSRWLockExclusive(rw);
     return 0;
 }
@@ -328,6 +521,9 @@ int cb_rw_writer_enter(cb_rwlock_t *rw)
 __declspec(dllexport)
 int cb_rw_writer_exit(cb_rwlock_t *rw)
 {
+    if (Couchbase::LockProfiler::active()) {
+        Couchbase::LockProfiler::released(rw);
+    }
     ReleaseSRWLockExclusive(rw);
     return 0;
 }
\ No newline at end of file
@@ -6,6 +6,8 @@
 #cmakedefine HAVE_DLADDR 1
 #cmakedefine HAVE_PTHREAD_SETNAME_NP 1
 #cmakedefine HAVE_PTHREAD_GETNAME_NP 1
+#cmakedefine HAVE_PTHREAD_CONDATTR_SETCLOCK 1
+#cmakedefine HAVE_LIBNUMA 1
 
 #ifdef WIN32
 #define NOMINMAX
@@ -0,0 +1,245 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+
+#include <platform/cacheline.h>
+#include <platform/epoch.h>
+#include <platform/thread_local.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+//
+// The global epoch is advanced when all of the threads in a critical
+// section have observed the current value. An object retired in epoch e
+// may be visible to readers which entered in epoch e (or e - 1 if they
+// raced with the advance), so it is safe to delete once the global epoch
+// reaches e + 2.
+//
+
+/** The number of retired objects a thread keeps before it reclaims */
+static const size_t ReclaimThreshold = 64;
+
+static std::atomic<uint64_t> globalEpoch(0);
+
+namespace {
+    struct Retired {
+        void* ptr;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    struct Participant {
+        Participant();
+        ~Participant();
+
+        // ThreadLocal heap allocates the participants (see CacheLineSize)
+        Couchbase::CacheLinePad pad0;
+
+        /**
+         * (epoch << 1) | 1 while the thread is in a critical section,
+         * 0 otherwise. Written by the owning thread, read by the threads
+         * trying to advance the epoch.
+         */
+        std::atomic<uint64_t> state;
+        Couchbase::CacheLinePad pad1;
+
+        /** Only accessed by the owning thread */
+        uint32_t nesting;
+        std::vector<Retired> limbo;
+        /** The size of limbo at which retire() tries to reclaim */
+        size_t reclaimAt;
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<Participant*> participants;
+        /** Objects retired by threads which exited before they expired */
+        std::vector<Retired> orphans;
+    };
+}
+
+/**
+ * The registry is never deleted, as detached threads may exit after the
+ * static destructors have run.
+ */
+static Registry& getRegistry() {
+    static Registry* registry = new Registry;
+    return *registry;
+}
+
+/**
+ * The ThreadLocal destroys the calling thread's Participant when it
+ * exits. Never deleted for the same reason as the registry.
+ */
+static Couchbase::ThreadLocal<Participant>& getParticipants() {
+    static auto* participants = new Couchbase::ThreadLocal<Participant>;
+    return *participants;
+}
+
+/** Cached pointer to the calling thread's Participant */
+static thread_local Participant* currentParticipant = nullptr;
+
+Participant::Participant()
+    : state(0),
+      nesting(0),
+      reclaimAt(ReclaimThreshold) {
+    auto& registry = getRegistry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    registry.participants.push_back(this);
+}
+
+Participant::~Participant() {
+    // Called on the owning thread as it exits
+    currentParticipant = nullptr;
+
+    auto& registry = getRegistry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    auto& participants = registry.participants;
+    participants.erase(
+        std::find(participants.begin(), participants.end(), this));
+    registry.orphans.insert(registry.orphans.end(), limbo.begin(),
+                            limbo.end());
+}
+
+static Participant& getParticipant() {
+    Participant* participant = currentParticipant;
+    if (participant == nullptr) {
+        participant = &getParticipants().get();
+        currentParticipant = participant;
+    }
+    return *participant;
+}
+
+/**
+ * Try to move the global epoch forward
+ *
+ * @return true if the epoch was advanced (by us or someone else)
+ */
+static bool tryAdvance() {
+    uint64_t epoch = globalEpoch.load();
+    // Pairs with the fence in enter(): either we see the reader in its
+    // critical section, or the reader sees everything which happened
+    // before we advance the epoch (including the unlinking of retired
+    // objects)
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    {
+        auto& registry = getRegistry();
+        std::lock_guard<std::mutex> guard(registry.mutex);
+        for (const auto* participant : registry.participants) {
+            const uint64_t state = participant->state.load();
+            if ((state & 1) != 0 && (state >> 1) != epoch) {
+                return false;
+            }
+        }
+    }
+    globalEpoch.compare_exchange_strong(epoch, epoch + 1);
+    return true;
+}
+
+/**
+ * Move the objects in the list which may be deleted in the given epoch
+ * over to expired
+ */
+static void collectExpired(std::vector<Retired>& list, uint64_t epoch,
+                           std::vector<Retired>& expired) {
+    auto split = std::partition(list.begin(), list.end(),
+                                [epoch](const Retired& r) {
+                                    return r.epoch + 2 > epoch;
+                                });
+    expired.insert(expired.end(), split, list.end());
+    list.erase(split, list.end());
+}
+
+/**
+ * Delete the expired objects of the calling thread and the exited
+ * threads. The deleters are called without any locks held and after the
+ * lists are updated, so they may retire other objects.
+ */
+static void deleteExpired(Participant& participant) {
+    const uint64_t epoch = globalEpoch.load();
+    std::vector<Retired> expired;
+    collectExpired(participant.limbo, epoch, expired);
+    {
+        auto& registry = getRegistry();
+        std::lock_guard<std::mutex> guard(registry.mutex);
+        collectExpired(registry.orphans, epoch, expired);
+    }
+    participant.reclaimAt = participant.limbo.size() + ReclaimThreshold;
+    for (const auto& r : expired) {
+        r.deleter(r.ptr);
+    }
+}
+
+void Couchbase::Epoch::enter() {
+    auto& participant = getParticipant();
+    if (participant.nesting++ == 0) {
+        participant.state.store((globalEpoch.load(std::memory_order_relaxed)
+                                 << 1) | 1,
+                                std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+void Couchbase::Epoch::exit() {
+    auto& participant = *currentParticipant;
+    if (--participant.nesting == 0) {
+        participant.state.store(0, std::memory_order_release);
+    }
+}
+
+void Couchbase::Epoch::retire(void* ptr, void (*deleter)(void*)) {
+    auto& participant = getParticipant();
+    participant.limbo.push_back({ptr, deleter, globalEpoch.load()});
+    if (participant.limbo.size() >= participant.reclaimAt) {
+        const bool advanced = tryAdvance();
+        deleteExpired(participant);
+        if (!advanced) {
+            // A stalled reader holds the epoch back. Don't take the
+            // registry lock on every retire until it leaves; wait for
+            // the backlog to double.
+            participant.reclaimAt = std::max(participant.reclaimAt,
+                                             participant.limbo.size() * 2);
+        }
+    }
+}
+
+void Couchbase::Epoch::reclaim() {
+    tryAdvance();
+    deleteExpired(getParticipant());
+}
+
+void Couchbase::Epoch::synchronize() {
+    auto& participant = getParticipant();
+    if (participant.nesting != 0) {
+        throw std::logic_error("Couchbase::Epoch::synchronize: called from "
+                               "within a critical section");
+    }
+
+    const uint64_t target = globalEpoch.load() + 2;
+    while (globalEpoch.load() < target) {
+        if (!tryAdvance()) {
+            std::this_thread::yield();
+        }
+    }
+    deleteExpired(participant);
+}
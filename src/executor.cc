@@ -0,0 +1,251 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+
+#include <platform/chaselev_deque.h>
+#include <platform/executor.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+typedef std::function<void()> Task;
+
+static const int NumPriorities = 3;
+
+struct Couchbase::Executor::Impl {
+    struct Worker {
+        Worker(Impl& impl_, size_t id_)
+            : impl(impl_),
+              id(id_) {
+        }
+
+        Impl& impl;
+        const size_t id;
+        cb_thread_t tid;
+        ChaseLevDeque<Task*> deques[NumPriorities];
+    };
+
+    Impl()
+        : started(0),
+          pending(0),
+          idle(0),
+          shutdown(false) {
+        for (auto& count : sharedCount) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ~Impl() {
+        // There shouldn't be any tasks left, but just in case..
+        for (int ii = 0; ii < NumPriorities; ++ii) {
+            for (auto* task : shared[ii]) {
+                delete task;
+            }
+        }
+    }
+
+    static void thread_main(void* arg) {
+        auto* worker = reinterpret_cast<Worker*>(arg);
+        worker->impl.run(*worker);
+    }
+
+    void schedule(Task* task, TaskPriority priority) {
+        const int prio = static_cast<int>(priority);
+        if (prio < 0 || prio >= NumPriorities) {
+            delete task;
+            throw std::invalid_argument("Executor: invalid priority");
+        }
+
+        // pending must be incremented before the task is visible so that
+        // a worker going to sleep can't miss it (see run())
+        pending.fetch_add(1, std::memory_order_seq_cst);
+        Worker* self = current;
+        if (self != nullptr && &self->impl == this) {
+            try {
+                self->deques[prio].push(task);
+            } catch (...) {
+                pending.fetch_sub(1, std::memory_order_seq_cst);
+                delete task;
+                throw;
+            }
+        } else {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (shutdown) {
+                pending.fetch_sub(1, std::memory_order_seq_cst);
+                delete task;
+                throw std::logic_error("Executor: shutting down");
+            }
+            shared[prio].push_back(task);
+            sharedCount[prio].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (idle.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> guard(mutex);
+            cond.notify_one();
+        }
+    }
+
+    Task* findTask(Worker& self) {
+        Task* task;
+        const size_t n = workers.size();
+        for (int prio = 0; prio < NumPriorities; ++prio) {
+            if (self.deques[prio].take(task)) {
+                return task;
+            }
+
+            if (sharedCount[prio].load(std::memory_order_relaxed) > 0) {
+                std::lock_guard<std::mutex> guard(mutex);
+                if (!shared[prio].empty()) {
+                    task = shared[prio].front();
+                    shared[prio].pop_front();
+                    sharedCount[prio].fetch_sub(1, std::memory_order_relaxed);
+                    return task;
+                }
+            }
+
+            for (size_t ii = 1; ii < n; ++ii) {
+                Worker& victim = *workers[(self.id + ii) % n];
+                if (victim.deques[prio].steal(task)) {
+                    return task;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    void run(Worker& self) {
+        current = &self;
+        while (true) {
+            Task* task = findTask(self);
+            if (task != nullptr) {
+                pending.fetch_sub(1, std::memory_order_relaxed);
+                try {
+                    (*task)();
+                } catch (...) {
+                    // Tasks scheduled with post() should not throw
+                }
+                delete task;
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            idle.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (pending.load(std::memory_order_relaxed) > 0) {
+                // A task is (about to become) available; go find it
+                idle.fetch_sub(1, std::memory_order_relaxed);
+                continue;
+            }
+            if (shutdown) {
+                idle.fetch_sub(1, std::memory_order_relaxed);
+                break;
+            }
+            cond.wait(lock);
+            idle.fetch_sub(1, std::memory_order_relaxed);
+        }
+        current = nullptr;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            shutdown = true;
+            cond.notify_all();
+        }
+        for (size_t ii = 0; ii < started; ++ii) {
+            cb_join_thread(workers[ii]->tid);
+        }
+        started = 0;
+    }
+
+    /** The worker object for the calling thread (if it is a worker) */
+    static thread_local Worker* current;
+
+    std::vector<std::unique_ptr<Worker> > workers;
+    /** The number of worker threads running */
+    size_t started;
+
+    /** The number of tasks which are scheduled but not started */
+    std::atomic<size_t> pending;
+    /** The number of workers about to sleep (or sleeping) */
+    std::atomic<size_t> idle;
+
+    /** Protects the shared queues, shutdown and the sleeping workers */
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool shutdown;
+
+    /** Tasks scheduled from threads outside of the executor */
+    std::deque<Task*> shared[NumPriorities];
+    std::atomic<size_t> sharedCount[NumPriorities];
+};
+
+thread_local Couchbase::Executor::Impl::Worker* Couchbase::Executor::Impl::current = nullptr;
+
+Couchbase::Executor::Executor(const std::string& name, size_t workers)
+    : impl(new Impl) {
+    if (workers == 0) {
+        throw std::invalid_argument("Executor: workers must be > 0");
+    }
+
+    // Create all of the worker objects before starting any threads as
+    // they'll start to steal from each other as soon as they're running
+    for (size_t ii = 0; ii < workers; ++ii) {
+        impl->workers.emplace_back(new Impl::Worker(*impl, ii));
+    }
+
+    for (size_t ii = 0; ii < workers; ++ii) {
+        auto& worker = *impl->workers[ii];
+        std::string threadname = name + std::to_string(ii);
+        if (threadname.length() > 15) {
+            threadname.resize(15);
+        }
+        if (cb_create_named_thread(&worker.tid, Impl::thread_main, &worker,
+                                   0, threadname.c_str()) != 0) {
+            impl->stop();
+            throw std::bad_alloc();
+        }
+        ++impl->started;
+    }
+}
+
+Couchbase::Executor::~Executor() {
+    impl->stop();
+}
+
+void Couchbase::Executor::post(std::function<void()> task,
+                               TaskPriority priority) {
+    impl->schedule(new Task(std::move(task)), priority);
+}
+
+size_t Couchbase::Executor::getWorkers() const {
+    return impl->workers.size();
+}
+
+bool Couchbase::Executor::isWorkerThread() const {
+    return Impl::current != nullptr && &Impl::current->impl == impl.get();
+}
+
+size_t Couchbase::Executor::getPendingTasks() const {
+    return impl->pending.load(std::memory_order_relaxed);
+}
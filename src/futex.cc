@@ -0,0 +1,122 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+
+#include <platform/futex.h>
+
+#include <cerrno>
+#include <climits>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#endif
+
+#ifdef __linux__
+
+static long futex(std::atomic<uint32_t>& word, int op, uint32_t val,
+                  const struct timespec* timeout) {
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+                  "futex requires std::atomic<uint32_t> to be a plain word");
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), op, val,
+                   timeout, nullptr, 0);
+}
+
+bool Couchbase::futexWait(std::atomic<uint32_t>& word, uint32_t expected,
+                          uint64_t timeout) {
+    struct timespec ts;
+    struct timespec* tsp = nullptr;
+    if (timeout != UINT64_MAX) {
+        ts.tv_sec = time_t(timeout / 1000000000);
+        ts.tv_nsec = long(timeout % 1000000000);
+        tsp = &ts;
+    }
+
+    if (futex(word, FUTEX_WAIT_PRIVATE, expected, tsp) == -1 &&
+        errno == ETIMEDOUT) {
+        return false;
+    }
+    // EAGAIN (the value didn't match) and EINTR are reported as a
+    // (spurious) wakeup
+    return true;
+}
+
+void Couchbase::futexWake(std::atomic<uint32_t>& word, int count) {
+    futex(word, FUTEX_WAKE_PRIVATE, uint32_t(count), nullptr);
+}
+
+void Couchbase::futexWakeAll(std::atomic<uint32_t>& word) {
+    futex(word, FUTEX_WAKE_PRIVATE, uint32_t(INT_MAX), nullptr);
+}
+
+#else
+
+/**
+ * Platforms without a futex park the waiting threads in a table of
+ * condition variables selected by the address of the word. Multiple
+ * words may share a bucket, so we always wake all of the threads in the
+ * bucket (they'll recheck their word and go back to sleep).
+ */
+namespace {
+    struct Bucket {
+        std::mutex mutex;
+        std::condition_variable cond;
+    };
+
+    const size_t NumBuckets = 64;
+    Bucket buckets[NumBuckets];
+
+    Bucket& getBucket(const std::atomic<uint32_t>& word) {
+        const uintptr_t addr = reinterpret_cast<uintptr_t>(&word);
+        return buckets[(addr >> 4) % NumBuckets];
+    }
+}
+
+bool Couchbase::futexWait(std::atomic<uint32_t>& word, uint32_t expected,
+                          uint64_t timeout) {
+    auto& bucket = getBucket(word);
+    std::unique_lock<std::mutex> lock(bucket.mutex);
+    if (word.load() != expected) {
+        return true;
+    }
+    if (timeout == UINT64_MAX) {
+        bucket.cond.wait(lock);
+        return true;
+    }
+    return bucket.cond.wait_for(lock, std::chrono::nanoseconds(timeout)) ==
+           std::cv_status::no_timeout;
+}
+
+void Couchbase::futexWake(std::atomic<uint32_t>& word, int) {
+    futexWakeAll(word);
+}
+
+void Couchbase::futexWakeAll(std::atomic<uint32_t>& word) {
+    auto& bucket = getBucket(word);
+    // Grab the lock so that we can't race with a thread which checked
+    // the value but hasn't started to wait yet
+    std::lock_guard<std::mutex> guard(bucket.mutex);
+    bucket.cond.notify_all();
+}
+
+#endif
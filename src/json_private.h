@@ -0,0 +1,62 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// json_private - helpers for the modules generating JSON by hand (to
+// avoid linking the platform library with cJSON)
+//
+
+#pragma once
+
+#include <cstdio>
+#include <ostream>
+#include <string>
+
+namespace Couchbase {
+
+    /**
+     * Append str to out as a quoted and escaped JSON string
+     */
+    inline void appendJSONString(std::ostream& out, const std::string& str) {
+        out << '"';
+        for (const char c : str) {
+            switch (c) {
+            case '"':
+                out << "\\\"";
+                break;
+            case '\\':
+                out << "\\\\";
+                break;
+            case '\n':
+                out << "\\n";
+                break;
+            case '\t':
+                out << "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    out << buffer;
+                } else {
+                    out << c;
+                }
+            }
+        }
+        out << '"';
+    }
+}
@@ -0,0 +1,359 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "json_private.h"
+#include "lock_profiler_private.h"
+
+#include <platform/backtrace.h>
+#include <platform/histogram.h>
+#include <platform/lock_profiler.h>
+#include <platform/readmostly_rwlock.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+using Couchbase::LockProfiler::LockType;
+
+std::atomic<uint32_t> Couchbase::LockProfiler::session(0);
+std::atomic<size_t> Couchbase::LockProfiler::registryEntries(0);
+
+/** The session number used the last time profiling was enabled */
+static std::atomic<uint32_t> lastSession(0);
+
+static std::atomic<unsigned int> backtraceSampleRate(100);
+
+/**
+ * The maximum number of distinct backtraces kept per lock. Once reached
+ * the samples are only counted.
+ */
+static const size_t MaxBacktraces = 16;
+
+namespace {
+    struct LockStats {
+        LockStats(LockType t)
+            : type(t),
+              acquisitions(0),
+              contended(0),
+              totalWait(0),
+              maxWait(0),
+              totalHold(0),
+              maxHold(0),
+              droppedBacktraces(0) {
+        }
+
+        void reset() {
+            acquisitions.store(0);
+            contended.store(0);
+            totalWait.store(0);
+            maxWait.store(0);
+            totalHold.store(0);
+            maxHold.store(0);
+            waitTime.reset();
+            holdTime.reset();
+            std::lock_guard<std::mutex> guard(backtraceMutex);
+            backtraces.clear();
+            droppedBacktraces = 0;
+        }
+
+        const LockType type;
+        std::atomic<uint64_t> acquisitions;
+        std::atomic<uint64_t> contended;
+
+        /* All times in usec */
+        std::atomic<uint64_t> totalWait;
+        std::atomic<uint64_t> maxWait;
+        Histogram<hrtime_t> waitTime;
+        std::atomic<uint64_t> totalHold;
+        std::atomic<uint64_t> maxHold;
+        Histogram<hrtime_t> holdTime;
+
+        std::mutex backtraceMutex;
+        std::map<std::string, uint64_t> backtraces;
+        uint64_t droppedBacktraces;
+    };
+}
+
+namespace {
+    /**
+     * The registry of profiled locks. It is looked up on every profiled
+     * acquisition and only modified when a new lock is seen.
+     */
+    struct Registry {
+        Couchbase::ReadMostlyRWLock lock;
+        std::unordered_map<const void*, std::unique_ptr<LockStats>> locks;
+        std::unordered_map<const void*, std::string> names;
+
+        /** Must be called with the lock held after modifying the maps */
+        void updateEntries() {
+            Couchbase::LockProfiler::registryEntries.store(
+                locks.size() + names.size());
+        }
+    };
+}
+
+static Registry& getRegistry() {
+    static Registry registry;
+    return registry;
+}
+
+static LockStats& getStats(const void* lock, LockType type) {
+    auto& registry = getRegistry();
+    registry.lock.lock_shared();
+    auto iter = registry.locks.find(lock);
+    if (iter != registry.locks.end()) {
+        auto& stats = *iter->second;
+        registry.lock.unlock_shared();
+        return stats;
+    }
+    registry.lock.unlock_shared();
+
+    std::lock_guard<Couchbase::ReadMostlyRWLock> guard(registry.lock);
+    auto& entry = registry.locks[lock];
+    if (!entry) {
+        entry.reset(new LockStats(type));
+    }
+    registry.updateEntries();
+    return *entry;
+}
+
+static void updateMax(std::atomic<uint64_t>& max, uint64_t value) {
+    uint64_t current = max.load(std::memory_order_relaxed);
+    while (value > current &&
+           !max.compare_exchange_weak(current, value,
+                                      std::memory_order_relaxed)) {
+        // current is updated by compare_exchange_weak
+    }
+}
+
+namespace {
+    /**
+     * The locks held by a thread, and when it got them
+     */
+    struct HeldLock {
+        const void* lock;
+        LockStats* stats;
+        uint32_t session;
+        hrtime_t start;
+    };
+}
+
+static thread_local std::vector<HeldLock> heldLocks;
+static thread_local unsigned int contendedSinceBacktrace = 0;
+
+static void recordBacktrace(LockStats& stats) {
+    char buffer[4096];
+    if (!print_backtrace_to_buffer("    ", buffer, sizeof(buffer))) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(stats.backtraceMutex);
+    auto iter = stats.backtraces.find(buffer);
+    if (iter != stats.backtraces.end()) {
+        ++iter->second;
+    } else if (stats.backtraces.size() < MaxBacktraces) {
+        stats.backtraces[buffer] = 1;
+    } else {
+        ++stats.droppedBacktraces;
+    }
+}
+
+void Couchbase::LockProfiler::acquired(const void* lock, LockType type,
+                                       hrtime_t wait, bool contended) {
+    auto& stats = getStats(lock, type);
+    const hrtime_t usec = wait / 1000;
+    stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+    stats.waitTime.add(usec);
+    if (contended) {
+        stats.contended.fetch_add(1, std::memory_order_relaxed);
+        stats.totalWait.fetch_add(usec, std::memory_order_relaxed);
+        updateMax(stats.maxWait, usec);
+
+        const unsigned int rate = backtraceSampleRate.load();
+        if (rate != 0 && ++contendedSinceBacktrace >= rate) {
+            contendedSinceBacktrace = 0;
+            recordBacktrace(stats);
+        }
+    }
+
+    heldLocks.push_back({lock, &stats, session.load(), gethrtime()});
+}
+
+void Couchbase::LockProfiler::reacquired(const void* lock) {
+    auto& stats = getStats(lock, LockType::Mutex);
+    heldLocks.push_back({lock, &stats, session.load(), gethrtime()});
+}
+
+void Couchbase::LockProfiler::released(const void* lock) {
+    const uint32_t current = session.load();
+    // Search from the back; locks are usually released in the reverse
+    // order of acquisition
+    for (auto iter = heldLocks.rbegin(); iter != heldLocks.rend(); ++iter) {
+        if (iter->lock == lock) {
+            if (iter->session == current) {
+                const uint64_t usec = (gethrtime() - iter->start) / 1000;
+                iter->stats->holdTime.add(usec);
+                iter->stats->totalHold.fetch_add(usec,
+                                                 std::memory_order_relaxed);
+                updateMax(iter->stats->maxHold, usec);
+            }
+            heldLocks.erase(std::next(iter).base());
+            break;
+        }
+    }
+
+    // Drop whatever is left over from an earlier profiling session
+    heldLocks.erase(std::remove_if(heldLocks.begin(), heldLocks.end(),
+                                   [current](const HeldLock& held) {
+                                       return held.session != current;
+                                   }),
+                    heldLocks.end());
+}
+
+void Couchbase::LockProfiler::destroyed(const void* lock) {
+    auto& registry = getRegistry();
+    std::lock_guard<Couchbase::ReadMostlyRWLock> guard(registry.lock);
+    registry.locks.erase(lock);
+    registry.names.erase(lock);
+    registry.updateEntries();
+}
+
+void Couchbase::LockProfiler::enable() {
+    uint32_t next;
+    do {
+        next = ++lastSession;
+    } while (next == 0);
+    session.store(next);
+}
+
+void Couchbase::LockProfiler::disable() {
+    session.store(0);
+}
+
+bool Couchbase::LockProfiler::isEnabled() {
+    return active();
+}
+
+void Couchbase::LockProfiler::setBacktraceSampleRate(unsigned int n) {
+    backtraceSampleRate.store(n);
+}
+
+void Couchbase::LockProfiler::setName(const void* lock,
+                                      const std::string& name) {
+    auto& registry = getRegistry();
+    std::lock_guard<Couchbase::ReadMostlyRWLock> guard(registry.lock);
+    registry.names[lock] = name;
+    registry.updateEntries();
+}
+
+void Couchbase::LockProfiler::reset() {
+    auto& registry = getRegistry();
+    std::lock_guard<Couchbase::ReadMostlyRWLock> guard(registry.lock);
+    for (auto& entry : registry.locks) {
+        entry.second->reset();
+    }
+}
+
+static void appendTimes(std::ostringstream& out, uint64_t total, uint64_t max,
+                        const Histogram<hrtime_t>& histogram) {
+    out << "{\"total\":" << total << ",\"max\":" << max
+        << ",\"histogram\":[";
+    bool first = true;
+    for (auto iter = histogram.begin(); iter != histogram.end(); ++iter) {
+        const auto* bin = *iter;
+        if (bin->count() == 0) {
+            continue;
+        }
+        if (!first) {
+            out << ",";
+        }
+        first = false;
+        out << "[" << bin->start() << "," << bin->end() << ","
+            << bin->count() << "]";
+    }
+    out << "]}";
+}
+
+std::string Couchbase::LockProfiler::toJSON() {
+    auto& registry = getRegistry();
+    // Held exclusively to keep it simple; dumping the statistics is rare
+    std::lock_guard<Couchbase::ReadMostlyRWLock> guard(registry.lock);
+
+    std::vector<std::pair<const void*, LockStats*>> locks;
+    for (auto& entry : registry.locks) {
+        locks.emplace_back(entry.first, entry.second.get());
+    }
+    std::sort(locks.begin(), locks.end(),
+              [](const std::pair<const void*, LockStats*>& a,
+                 const std::pair<const void*, LockStats*>& b) {
+                  return a.second->contended.load() >
+                         b.second->contended.load();
+              });
+
+    std::ostringstream out;
+    out << "{\"enabled\":" << (active() ? "true" : "false")
+        << ",\"locks\":[";
+    bool first = true;
+    for (const auto& entry : locks) {
+        if (!first) {
+            out << ",";
+        }
+        first = false;
+
+        auto& stats = *entry.second;
+        char address[32];
+        snprintf(address, sizeof(address), "%p", entry.first);
+
+        out << "{";
+        auto name = registry.names.find(entry.first);
+        if (name != registry.names.end()) {
+            out << "\"name\":";
+            Couchbase::appendJSONString(out, name->second);
+            out << ",";
+        }
+        out << "\"address\":\"" << address << "\",\"type\":\""
+            << (stats.type == LockType::Mutex ? "mutex" : "rwlock") << "\""
+            << ",\"acquisitions\":" << stats.acquisitions.load()
+            << ",\"contended\":" << stats.contended.load()
+            << ",\"wait_usec\":";
+        appendTimes(out, stats.totalWait.load(), stats.maxWait.load(),
+                    stats.waitTime);
+        out << ",\"hold_usec\":";
+        appendTimes(out, stats.totalHold.load(), stats.maxHold.load(),
+                    stats.holdTime);
+
+        out << ",\"backtraces\":[";
+        std::lock_guard<std::mutex> btGuard(stats.backtraceMutex);
+        bool firstTrace = true;
+        for (const auto& trace : stats.backtraces) {
+            if (!firstTrace) {
+                out << ",";
+            }
+            firstTrace = false;
+            out << "{\"count\":" << trace.second << ",\"backtrace\":";
+            Couchbase::appendJSONString(out, trace.first);
+            out << "}";
+        }
+        out << "],\"dropped_backtraces\":" << stats.droppedBacktraces << "}";
+    }
+    out << "]}";
+    return out.str();
+}
@@ -0,0 +1,116 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// lock_profiler_private - the hooks used by the cb_mutex_t and
+// cb_rwlock_t implementations to report to the lock profiler
+//
+
+#pragma once
+
+#include <platform/platform.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace Couchbase {
+    namespace LockProfiler {
+
+        /**
+         * Non-zero while profiling is enabled. It changes every time
+         * profiling is enabled so that hold times started in an earlier
+         * profiling session are ignored.
+         */
+        extern std::atomic<uint32_t> session;
+
+        inline bool active() {
+            return session.load(std::memory_order_relaxed) != 0;
+        }
+
+        /**
+         * The number of entries (statistics and names) in the registry
+         */
+        extern std::atomic<size_t> registryEntries;
+
+        /**
+         * Does the registry hold anything a destroyed lock must remove?
+         * (it may, even if profiling has been disabled since)
+         */
+        inline bool hasEntries() {
+            return registryEntries.load(std::memory_order_relaxed) != 0;
+        }
+
+        enum class LockType {
+            Mutex,
+            RWLock
+        };
+
+        /**
+         * Record that the calling thread got the lock
+         *
+         * @param lock the address of the lock
+         * @param type the kind of lock
+         * @param wait the number of ns spent waiting for the lock
+         * @param contended true if the lock wasn't immediately available
+         */
+        void acquired(const void* lock, LockType type, hrtime_t wait,
+                      bool contended);
+
+        /**
+         * Record that the calling thread released the lock
+         */
+        void released(const void* lock);
+
+        /**
+         * Record that the calling thread got the lock back after waiting
+         * for a condition variable (only restarts the hold time)
+         */
+        void reacquired(const void* lock);
+
+        /**
+         * Drop the statistics for a lock which is being destroyed
+         */
+        void destroyed(const void* lock);
+
+        /**
+         * Acquire a lock and report it to the profiler. The lock is
+         * tried first so that uncontended acquisitions don't pay for
+         * reading the clock.
+         *
+         * @param tryLock function returning true if it got the lock
+         * @param doLock function blocking for the lock, returning 0 on
+         *               success
+         * @return the value returned from doLock (or 0 if tryLock
+         *         succeeded)
+         */
+        template <typename TryLock, typename Lock>
+        int profiledAcquire(const void* lock, LockType type,
+                            TryLock tryLock, Lock doLock) {
+            if (tryLock()) {
+                acquired(lock, type, 0, false);
+                return 0;
+            }
+            const hrtime_t start = gethrtime();
+            const int rv = doLock();
+            if (rv == 0) {
+                acquired(lock, type, gethrtime() - start, true);
+            }
+            return rv;
+        }
+    }
+}
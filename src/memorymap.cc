@@ -0,0 +1,149 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// The platform independent parts of MemoryMappedFile
+//
+
+#include <platform/memorymap.h>
+
+#include <algorithm>
+#include <iterator>
+
+bool Couchbase::MemoryMappedFile::alignRange(size_t& offset,
+                                             size_t& length) const {
+    if (offset >= size || length == 0) {
+        return false;
+    }
+    const size_t page = pageSize;
+    size_t end = length > size - offset ? size : offset + length;
+    // The mapping covers the whole of the last page (even if the file
+    // ends before it)
+    end = (end + page - 1) / page * page;
+    offset -= offset % page;
+    length = end - offset;
+    return true;
+}
+
+void Couchbase::MemoryMappedFile::advise(Advice advice, size_t offset,
+                                         size_t length) {
+    if (root == NULL) {
+        throw std::string("Internal error, open() not called");
+    }
+    if (alignRange(offset, length)) {
+        doAdvise(advice, offset, length);
+    }
+}
+
+std::future<void> Couchbase::MemoryMappedFile::prefetchAsync(size_t offset,
+                                                             size_t length) {
+    if (root == NULL) {
+        throw std::string("Internal error, open() not called");
+    }
+    if (!alignRange(offset, length)) {
+        std::promise<void> done;
+        done.set_value();
+        return done.get_future();
+    }
+
+    // Let the kernel start the readahead as well (we only touch one page
+    // at a time)
+    doAdvise(Advice::WillNeed, offset, length);
+
+    const volatile char* start = static_cast<const char*>(root) + offset;
+    const size_t end = std::min(length, size - offset);
+    const size_t page = pageSize;
+    return std::async(std::launch::async, [start, end, page]() {
+        char sink = 0;
+        for (size_t ii = 0; ii < end; ii += page) {
+            sink ^= start[ii];
+        }
+        (void)sink;
+    });
+}
+
+void Couchbase::MemoryMappedFile::sync(size_t offset, size_t length,
+                                       SyncMode mode) {
+    if (root == NULL) {
+        throw std::string("Internal error, open() not called");
+    }
+    if (sharedMapping && alignRange(offset, length)) {
+        doSync(offset, length, mode);
+    }
+}
+
+void Couchbase::MemoryMappedFile::markDirty(size_t offset, size_t length) {
+    if (root == NULL) {
+        throw std::string("Internal error, open() not called");
+    }
+    if (!alignRange(offset, length)) {
+        return;
+    }
+
+    size_t start = offset;
+    size_t end = offset + length;
+    std::lock_guard<std::mutex> guard(dirtyMutex);
+    // Merge with the range before it (if they touch) and all of the
+    // ranges it touches after it
+    auto it = dirtyRanges.upper_bound(start);
+    if (it != dirtyRanges.begin()) {
+        auto prev = std::prev(it);
+        if (prev->second >= start) {
+            start = prev->first;
+            it = prev;
+        }
+    }
+    while (it != dirtyRanges.end() && it->first <= end) {
+        end = std::max(end, it->second);
+        it = dirtyRanges.erase(it);
+    }
+    dirtyRanges[start] = end;
+}
+
+void Couchbase::MemoryMappedFile::flushDirty(SyncMode mode) {
+    if (root == NULL) {
+        throw std::string("Internal error, open() not called");
+    }
+
+    // Don't hold the lock while flushing; writers may keep marking
+    // ranges dirty
+    std::map<size_t, size_t> ranges;
+    {
+        std::lock_guard<std::mutex> guard(dirtyMutex);
+        ranges.swap(dirtyRanges);
+    }
+
+    for (auto it = ranges.begin(); it != ranges.end(); ++it) {
+        try {
+            sync(it->first, it->second - it->first, mode);
+        } catch (...) {
+            for (; it != ranges.end(); ++it) {
+                markDirty(it->first, it->second - it->first);
+            }
+            throw;
+        }
+    }
+}
+
+size_t Couchbase::MemoryMappedFile::getDirtySize() const {
+    std::lock_guard<std::mutex> guard(dirtyMutex);
+    size_t ret = 0;
+    for (const auto& range : dirtyRanges) {
+        ret += range.second - range.first;
+    }
+    return ret;
+}
@@ -19,22 +19,174 @@
 #ifdef __sun
 const int MAP_FILE = 0;
 #endif
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
 
+#include <algorithm>
 #include <sstream>
 #include <cerrno>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include "platform/memorymap.h"
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+
+#ifdef __linux__
+/** The f_type of a hugetlbfs mount (from linux/magic.h) */
+static const long HugetlbfsMagic = 0x958458f6;
+#endif
+
+static size_t roundUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * Read the first number following the key in a file like /proc/meminfo
+ * (0 if it isn't found)
+ */
+static size_t readNumber(const char* path, const std::string& key) {
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, key.size(), key) == 0) {
+            return size_t(strtoull(line.c_str() + key.size(), NULL, 10));
+        }
+    }
+    return 0;
+}
+
+/**
+ * Check /proc/self/smaps to see if the kernel will back the memory
+ * at address with transparent huge pages
+ */
+static bool isThpEligible(const void* address) {
+    const uintptr_t addr = reinterpret_cast<uintptr_t>(address);
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    bool found = false;
+    while (std::getline(smaps, line)) {
+        uintptr_t start;
+        uintptr_t end;
+        if (sscanf(line.c_str(), "%" SCNxPTR "-%" SCNxPTR " ",
+                   &start, &end) == 2) {
+            if (found) {
+                // Older kernels don't report it
+                return false;
+            }
+            found = addr >= start && addr < end;
+        } else if (found && line.compare(0, 12, "THPeligible:") == 0) {
+            return strtol(line.c_str() + 12, NULL, 10) == 1;
+        }
+    }
+    return false;
+}
+
+/**
+ * mmap with the start of the mapping aligned to the given alignment
+ * (the kernel only uses transparent huge pages for aligned memory)
+ */
+static void* mapAligned(size_t length, size_t alignment, int protection,
+                        int flags, int fd, off_t offset) {
+    // Reserve enough address space to find an aligned address in it,
+    // map over it and release what's left on either side
+    const size_t reservedLength = length + alignment;
+    void* reserved = mmap(NULL, reservedLength, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    char* begin = static_cast<char*>(reserved);
+    char* aligned = reinterpret_cast<char*>(roundUp(
+        reinterpret_cast<uintptr_t>(reserved), alignment));
+    void* ret = mmap(aligned, length, protection, flags | MAP_FIXED, fd,
+                     offset);
+    if (ret == MAP_FAILED) {
+        const int error = errno;
+        munmap(reserved, reservedLength);
+        errno = error;
+        return MAP_FAILED;
+    }
+    if (aligned > begin) {
+        munmap(begin, aligned - begin);
+    }
+    char* end = aligned +
+        roundUp(length, Couchbase::MemoryMappedFile::getPageSize());
+    if (begin + reservedLength > end) {
+        munmap(end, begin + reservedLength - end);
+    }
+    return ret;
+}
+
+/**
+ * Reserve address space for maxSize bytes and map the file at the start
+ * of it, so that the mapping may grow in place
+ */
+static void* mapGrowable(size_t length, size_t maxSize, int protection,
+                         int flags, int fd) {
+    const size_t reservedLength =
+        roundUp(maxSize, Couchbase::MemoryMappedFile::getPageSize());
+    void* ret = mmap(NULL, reservedLength, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ret == MAP_FAILED || length == 0) {
+        return ret;
+    }
+    if (mmap(ret, length, protection, flags | MAP_FIXED, fd, 0) ==
+        MAP_FAILED) {
+        const int error = errno;
+        munmap(ret, reservedLength);
+        errno = error;
+        return MAP_FAILED;
+    }
+    return ret;
+}
 
 Couchbase::MemoryMappedFile::MemoryMappedFile(const char *fname, bool share, bool rdonly) :
         filename(fname),
         filehandle(-1),
+        externalHandle(false),
+        fileSize(0),
         root(NULL),
         size(0),
         sharedMapping(share),
-        readonly(rdonly) {
+        readonly(rdonly),
+        anonymous(false),
+        openAdvice(Advice::Normal),
+        populate(false),
+        hugePages(HugePages::None),
+        maxSize(0),
+        rangeOffset(0),
+        rangeLength(SIZE_MAX),
+        pageSize(0),
+        mappingPageSize(0) {
+    // Empty
+}
+
+Couchbase::MemoryMappedFile::MemoryMappedFile(size_t length) :
+        filehandle(-1),
+        externalHandle(false),
+        fileSize(0),
+        root(NULL),
+        size(length),
+        sharedMapping(false),
+        readonly(false),
+        anonymous(true),
+        openAdvice(Advice::Normal),
+        populate(false),
+        hugePages(HugePages::None),
+        maxSize(0),
+        rangeOffset(0),
+        rangeLength(SIZE_MAX),
+        pageSize(0),
+        mappingPageSize(0) {
     // Empty
 }
 
@@ -49,13 +201,22 @@ void Couchbase::MemoryMappedFile::close(void) {
     }
     std::stringstream ss;
 
-    if (munmap(root, size) != 0) {
+    const size_t length = roundUp(maxSize != 0 ? maxSize : size, pageSize);
+    if (munmap(root, length) != 0) {
         ss << "munmap failed: " << strerror(errno);
     }
-    ::close(filehandle);
-    filehandle = -1;
+    if (filehandle != -1 && !externalHandle) {
+        ::close(filehandle);
+        filehandle = -1;
+    }
     root = NULL;
-    size = 0;
+    {
+        std::lock_guard<std::mutex> guard(dirtyMutex);
+        dirtyRanges.clear();
+    }
+    if (!anonymous) {
+        size = 0;
+    }
 
     std::string str = ss.str();
     if (str.length() > 0) {
@@ -67,23 +228,66 @@ void Couchbase::MemoryMappedFile::open(void) {
     if (sharedMapping && readonly) {
         throw std::string("Invalid mode: shared and readonly don't make sense");
     }
-
-    struct stat st;
-    if (stat(filename.c_str(), &st) == -1) {
-        std::stringstream ss;
-        ss << "stat(" << filename << ") failed: " << strerror(errno);
-        throw ss.str();
+    if (maxSize != 0 && !sharedMapping) {
+        throw std::string("Invalid mode: only shared mappings may grow");
     }
-    size = st.st_size;
 
-    int mapMode = MAP_FILE;
+    int mapMode;
     int openMode;
-    if (sharedMapping) {
+    if (anonymous) {
         openMode = O_RDWR;
-        mapMode |= MAP_SHARED;
+        mapMode = MAP_PRIVATE | MAP_ANONYMOUS;
     } else {
-        openMode = O_RDONLY;
-        mapMode |= MAP_PRIVATE;
+        if (externalHandle) {
+            if (maxSize != 0) {
+                throw std::string("Invalid mode: a file handle can't be "
+                                  "combined with a growable mapping");
+            }
+        } else {
+            struct stat st;
+            if (stat(filename.c_str(), &st) == -1) {
+                if (errno != ENOENT || maxSize == 0) {
+                    std::stringstream ss;
+                    ss << "stat(" << filename << ") failed: "
+                       << strerror(errno);
+                    throw ss.str();
+                }
+                // A growable file is created by open()
+                st.st_size = 0;
+            }
+            fileSize = uint64_t(st.st_size);
+        }
+        if (rangeOffset != 0 || rangeLength != SIZE_MAX) {
+            if (maxSize != 0) {
+                throw std::string("Invalid mode: a range of a file can't "
+                                  "grow");
+            }
+            if (rangeOffset % getAllocationGranularity() != 0 ||
+                rangeOffset > fileSize) {
+                std::stringstream ss;
+                ss << "Invalid range offset " << rangeOffset << " for "
+                   << filename;
+                throw ss.str();
+            }
+        }
+        size = size_t(std::min(fileSize - rangeOffset,
+                               uint64_t(rangeLength)));
+        if (maxSize != 0 && size > maxSize) {
+            std::stringstream ss;
+            ss << "The size of " << filename << " (" << size
+               << ") exceeds the max size of the mapping";
+            size = 0;
+            throw ss.str();
+        }
+
+        mapMode = MAP_FILE;
+        if (sharedMapping) {
+            openMode = O_RDWR;
+            mapMode |= MAP_SHARED;
+        } else {
+            openMode = O_RDONLY;
+            mapMode |= MAP_PRIVATE;
+        }
     }
 
     int protection = PROT_READ;
@@ -93,20 +297,233 @@ void Couchbase::MemoryMappedFile::open(void) {
         protection |= PROT_WRITE;
     }
 
-    if ((filehandle = ::open(filename.c_str(), openMode)) == -1) {
+    if (maxSize != 0) {
+        openMode |= O_CREAT;
+    }
+
+    if (!anonymous && !externalHandle &&
+        (filehandle = ::open(filename.c_str(), openMode, 0666)) == -1) {
         std::stringstream ss;
         ss << "Failed to open file: " << filename << " (" << strerror(errno) << ")";
         throw ss.str();
     }
 
-    root = mmap(NULL, size, protection, mapMode, filehandle, 0);
+    pageSize = getPageSize();
+    mappingPageSize = pageSize;
+    bool transparent = hugePages == HugePages::Transparent && maxSize == 0;
+    root = MAP_FAILED;
+
+    if (hugePages == HugePages::HugeTLB && maxSize == 0) {
+#ifdef __linux__
+        const size_t hugePageSize =
+            readNumber("/proc/meminfo", "Hugepagesize:") * 1024;
+        struct statfs fs;
+        if (anonymous) {
+#ifdef MAP_HUGETLB
+            if (hugePageSize != 0) {
+                root = mmap(NULL, roundUp(size, hugePageSize), protection,
+                            mapMode | MAP_HUGETLB, -1, 0);
+            }
+#endif
+            if (root != MAP_FAILED) {
+                pageSize = mappingPageSize = hugePageSize;
+            }
+        } else if (fstatfs(filehandle, &fs) == 0 &&
+                   long(fs.f_type) == HugetlbfsMagic) {
+            // Every mapping of a hugetlbfs file uses its huge pages
+            pageSize = mappingPageSize = size_t(fs.f_bsize);
+        }
+#endif
+        // Fall back to transparent huge pages if we didn't get any
+        transparent = pageSize == getPageSize();
+    }
+
+    const size_t hugePageSize = transparent ? getHugePageSize() : 0;
+    const bool alignForHugePages = hugePageSize != 0 && size >= hugePageSize;
+#ifdef MAP_POPULATE
+    // Populating the mapping before MADV_HUGEPAGE would fault it in
+    // with normal pages
+    if (populate && !alignForHugePages) {
+        mapMode |= MAP_POPULATE;
+    }
+#endif
+
+    if (root != MAP_FAILED) {
+        // Already mapped
+    } else if (maxSize != 0) {
+        root = mapGrowable(roundUp(size, pageSize), maxSize, protection,
+                           mapMode, filehandle);
+    } else if (alignForHugePages) {
+        root = mapAligned(size, hugePageSize, protection, mapMode,
+                          filehandle, off_t(rangeOffset));
+    } else {
+        root = mmap(NULL, roundUp(size, pageSize), protection, mapMode,
+                    filehandle, off_t(rangeOffset));
+    }
+
     if (root == MAP_FAILED) {
         std::stringstream ss;
         ss << "mmap failed: " << strerror(errno);
-        ::close(filehandle);
-        filehandle = -1;
+        if (filehandle != -1 && !externalHandle) {
+            ::close(filehandle);
+            filehandle = -1;
+        }
         root = NULL;
-        size = 0;
+        if (!anonymous) {
+            size = 0;
+        }
+        throw ss.str();
+    }
+
+    if (alignForHugePages) {
+#ifdef MADV_HUGEPAGE
+        // Huge pages are only a hint, so ignore if the kernel says no
+        if (madvise(root, size, MADV_HUGEPAGE) == 0 && isThpEligible(root)) {
+            mappingPageSize = hugePageSize;
+        }
+#endif
+        if (populate) {
+            populateHugePages();
+        }
+    }
+
+    if (openAdvice != Advice::Normal) {
+        advise(openAdvice);
+    }
+#ifndef MAP_POPULATE
+    if (populate) {
+        advise(Advice::WillNeed);
+    }
+#endif
+}
+
+void Couchbase::MemoryMappedFile::populateHugePages() {
+#ifdef MADV_POPULATE_READ
+    // Writing to a private file mapping would copy every page
+    const int flag = anonymous ? MADV_POPULATE_WRITE : MADV_POPULATE_READ;
+    if (madvise(root, size, flag) == 0) {
+        return;
+    }
+#endif
+    // Older kernels; touch every page instead
+    prefetchAsync().get();
+}
+
+void Couchbase::MemoryMappedFile::grow(size_t newSize) {
+    if (root == NULL) {
+        throw std::string("Internal error, open() not called");
+    }
+    if (maxSize == 0) {
+        throw std::string("grow: the mapping isn't growable");
+    }
+    if (newSize <= size) {
+        return;
+    }
+    if (newSize > maxSize) {
+        std::stringstream ss;
+        ss << "grow: " << newSize << " exceeds the max size of the mapping ("
+           << maxSize << ")";
+        throw ss.str();
+    }
+
+#ifdef __linux__
+    // Allocate the blocks so that running out of space doesn't show up
+    // as a SIGBUS when the new part of the mapping is written to
+    if (fallocate(filehandle, 0, off_t(size), off_t(newSize - size)) != 0 &&
+        errno != EOPNOTSUPP) {
+        std::stringstream ss;
+        ss << "fallocate failed: " << strerror(errno);
+        throw ss.str();
+    }
+#endif
+    if (ftruncate(filehandle, off_t(newSize)) != 0) {
+        std::stringstream ss;
+        ss << "ftruncate failed: " << strerror(errno);
+        throw ss.str();
+    }
+
+    // The last page of the old mapping already covers the file up to
+    // the next page boundary; map the pages following it over the
+    // reserved address space
+    const size_t mapped = roundUp(size, pageSize);
+    const size_t needed = roundUp(newSize, pageSize);
+    if (needed > mapped &&
+        mmap(static_cast<char*>(root) + mapped, needed - mapped,
+             PROT_READ | PROT_WRITE, MAP_FILE | MAP_SHARED | MAP_FIXED,
+             filehandle, off_t(mapped)) == MAP_FAILED) {
+        std::stringstream ss;
+        ss << "mmap failed: " << strerror(errno);
+        throw ss.str();
+    }
+    size = newSize;
+}
+
+size_t Couchbase::MemoryMappedFile::getPageSize() {
+    static const size_t page = size_t(sysconf(_SC_PAGESIZE));
+    return page;
+}
+
+size_t Couchbase::MemoryMappedFile::getAllocationGranularity() {
+    return getPageSize();
+}
+
+size_t Couchbase::MemoryMappedFile::getHugePageSize() {
+#ifdef __linux__
+    static const size_t hugePage = []() {
+        size_t ret = readNumber(
+            "/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "");
+        if (ret == 0) {
+            ret = readNumber("/proc/meminfo", "Hugepagesize:") * 1024;
+        }
+        return ret;
+    }();
+    return hugePage;
+#else
+    return 0;
+#endif
+}
+
+void Couchbase::MemoryMappedFile::doSync(size_t offset, size_t length,
+                                         SyncMode mode) {
+    const int flags = mode == SyncMode::Sync ? MS_SYNC : MS_ASYNC;
+    if (msync(static_cast<char*>(root) + offset, length, flags) != 0) {
+        std::stringstream ss;
+        ss << "msync failed: " << strerror(errno);
+        throw ss.str();
+    }
+}
+
+void Couchbase::MemoryMappedFile::doAdvise(Advice advice, size_t offset,
+                                           size_t length) {
+    int flag;
+    switch (advice) {
+    case Advice::Normal:
+        flag = MADV_NORMAL;
+        break;
+    case Advice::Sequential:
+        flag = MADV_SEQUENTIAL;
+        break;
+    case Advice::Random:
+        flag = MADV_RANDOM;
+        break;
+    case Advice::WillNeed:
+        flag = MADV_WILLNEED;
+        break;
+    case Advice::DontNeed:
+        if (!sharedMapping && !readonly) {
+            // MADV_DONTNEED would throw away our private modifications,
+            // which isn't what the caller asked for
+            return;
+        }
+        flag = MADV_DONTNEED;
+        break;
+    default:
+        throw std::string("Invalid advice");
+    }
+
+    if (madvise(static_cast<char*>(root) + offset, length, flag) != 0) {
+        std::stringstream ss;
+        ss << "madvise failed: " << strerror(errno);
         throw ss.str();
     }
 }
@@ -16,6 +16,7 @@
  */
 #include <platform/platform.h>
 
+#include <algorithm>
 #include <sstream>
 #include <platform/strerror.h>
 #include "platform/memorymap.h"
@@ -25,10 +26,42 @@ Couchbase::MemoryMappedFile::MemoryMappedFile(const char *fname, bool share, boo
         filename(fname),
         filehandle(INVALID_HANDLE_VALUE),
         maphandle(INVALID_HANDLE_VALUE),
+        externalHandle(false),
+        fileSize(0),
         root(NULL),
         size(0),
         sharedMapping(share),
-        readonly(rdonly) {
+        readonly(rdonly),
+        anonymous(false),
+        openAdvice(Advice::Normal),
+        populate(false),
+        hugePages(HugePages::None),
+        maxSize(0),
+        rangeOffset(0),
+        rangeLength(SIZE_MAX),
+        pageSize(0),
+        mappingPageSize(0) {
+}
+
+Couchbase::MemoryMappedFile::MemoryMappedFile(size_t length)
+        :
+        filehandle(INVALID_HANDLE_VALUE),
+        maphandle(INVALID_HANDLE_VALUE),
+        externalHandle(false),
+        fileSize(0),
+        root(NULL),
+        size(length),
+        sharedMapping(false),
+        readonly(false),
+        anonymous(true),
+        openAdvice(Advice::Normal),
+        populate(false),
+        hugePages(HugePages::None),
+        maxSize(0),
+        rangeOffset(0),
+        rangeLength(SIZE_MAX),
+        pageSize(0),
+        mappingPageSize(0) {
 }
 
 Couchbase::MemoryMappedFile::~MemoryMappedFile() {
@@ -47,10 +80,18 @@ void Couchbase::MemoryMappedFile::close(void) {
     }
     CloseHandle(maphandle);
     maphandle = INVALID_HANDLE_VALUE;
-    CloseHandle(filehandle);
-    filehandle = INVALID_HANDLE_VALUE;
+    if (filehandle != INVALID_HANDLE_VALUE && !externalHandle) {
+        CloseHandle(filehandle);
+        filehandle = INVALID_HANDLE_VALUE;
+    }
     root = NULL;
-    size = 0;
+    {
+        std::lock_guard<std::mutex> guard(dirtyMutex);
+        dirtyRanges.clear();
+    }
+    if (!anonymous) {
+        size = 0;
+    }
 
     std::string str = ss.str();
     if (str.length() > 0) {
@@ -63,17 +104,42 @@ void Couchbase::MemoryMappedFile::open(void) {
         throw std::string("Invalid mode: shared and readonly don't make sense");
     }
 
-    WIN32_FILE_ATTRIBUTE_DATA fad;
-    if (GetFileAttributesEx(filename.c_str(), GetFileExInfoStandard,
-            &fad) == 0) {
+    if (maxSize != 0) {
+        // Growing in place needs placeholder support (MapViewOfFile3)
+        throw std::string("Growable mappings aren't supported on Windows");
+    }
+
+    pageSize = getPageSize();
+    mappingPageSize = pageSize;
+    if (anonymous) {
+        openAnonymous();
+        if (openAdvice != Advice::Normal) {
+            advise(openAdvice);
+        }
+        return;
+    }
+
+    if (!externalHandle) {
+        WIN32_FILE_ATTRIBUTE_DATA fad;
+        if (GetFileAttributesEx(filename.c_str(), GetFileExInfoStandard,
+                &fad) == 0) {
+            std::stringstream ss;
+            ss << "failed to determine file size: " << cb_strerror();
+            throw ss.str();
+        }
+        LARGE_INTEGER sz;
+        sz.HighPart = fad.nFileSizeHigh;
+        sz.LowPart = fad.nFileSizeLow;
+        fileSize = uint64_t(sz.QuadPart);
+    }
+    const bool partial = rangeOffset != 0 || rangeLength != SIZE_MAX;
+    if (partial && (rangeOffset % getAllocationGranularity() != 0 ||
+                    rangeOffset > fileSize)) {
         std::stringstream ss;
-        ss << "failed to determine file size: " << cb_strerror();
+        ss << "Invalid range offset " << rangeOffset << " for " << filename;
         throw ss.str();
     }
-    LARGE_INTEGER sz;
-    sz.HighPart = fad.nFileSizeHigh;
-    sz.LowPart = fad.nFileSizeLow;
-    size = (size_t) sz.QuadPart;
+    size = (size_t) std::min(fileSize - rangeOffset, uint64_t(rangeLength));
 
     DWORD mode;
     DWORD access;
@@ -90,15 +156,26 @@ void Couchbase::MemoryMappedFile::open(void) {
         shared = FILE_SHARE_READ | FILE_SHARE_WRITE;
     }
 
-    filehandle = CreateFile(filename.c_str(), mode,
-            shared, NULL, OPEN_EXISTING,
-            FILE_ATTRIBUTE_NORMAL, NULL);
+    // The closest we get to the access pattern advice is the caching
+    // hints for the file
+    DWORD flags = FILE_ATTRIBUTE_NORMAL;
+    if (openAdvice == Advice::Sequential) {
+        flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+    } else if (openAdvice == Advice::Random) {
+        flags |= FILE_FLAG_RANDOM_ACCESS;
+    }
 
-    if (filehandle == INVALID_HANDLE_VALUE) {
-        std::stringstream ss;
-        ss << "failed to open file: " << cb_strerror();
-        size = 0;
-        throw ss.str();
+    if (!externalHandle) {
+        filehandle = CreateFile(filename.c_str(), mode,
+                shared, NULL, OPEN_EXISTING,
+                flags, NULL);
+
+        if (filehandle == INVALID_HANDLE_VALUE) {
+            std::stringstream ss;
+            ss << "failed to open file: " << cb_strerror();
+            size = 0;
+            throw ss.str();
+        }
     }
 
     maphandle = CreateFileMapping(filehandle, NULL,
@@ -107,18 +184,142 @@ void Couchbase::MemoryMappedFile::open(void) {
     if (maphandle == INVALID_HANDLE_VALUE) {
         std::stringstream ss;
         ss << "failed to create file mapping: " << cb_strerror();
-        CloseHandle(filehandle);
+        if (!externalHandle) {
+            CloseHandle(filehandle);
+        }
         size = 0;
         throw ss.str();
     }
 
-    root = MapViewOfFile(maphandle, access, 0, 0, 0);
+    root = MapViewOfFile(maphandle, access, DWORD(rangeOffset >> 32),
+                         DWORD(rangeOffset), partial ? size : 0);
     if (root == NULL) {
         std::stringstream ss;
         ss << "mapviewoffile failed: " << cb_strerror();
         CloseHandle(maphandle);
-        CloseHandle(filehandle);
+        if (!externalHandle) {
+            CloseHandle(filehandle);
+        }
         size = 0;
         throw ss.str();
     }
+
+    // The file flags only cover sequential and random access
+    if (openAdvice != Advice::Normal) {
+        advise(openAdvice);
+    }
+    if (populate) {
+        advise(Advice::WillNeed);
+    }
+}
+
+void Couchbase::MemoryMappedFile::openAnonymous() {
+    // Large pages need the SeLockMemoryPrivilege, so fall back to normal
+    // pages if we can't get them. Windows doesn't have transparent huge
+    // pages, so treat both kinds the same.
+    const size_t largePageSize = getHugePageSize();
+    if (hugePages != HugePages::None && largePageSize != 0) {
+        const uint64_t length = (uint64_t(size) + largePageSize - 1) /
+                                largePageSize * largePageSize;
+        maphandle = CreateFileMapping(INVALID_HANDLE_VALUE, NULL,
+                PAGE_READWRITE | SEC_COMMIT | SEC_LARGE_PAGES,
+                DWORD(length >> 32), DWORD(length), NULL);
+        if (maphandle != NULL) {
+            DWORD access = FILE_MAP_ALL_ACCESS;
+#ifdef FILE_MAP_LARGE_PAGES
+            access |= FILE_MAP_LARGE_PAGES;
+#endif
+            root = MapViewOfFile(maphandle, access, 0, 0, 0);
+            if (root != NULL) {
+                pageSize = mappingPageSize = largePageSize;
+                return;
+            }
+            CloseHandle(maphandle);
+        }
+    }
+
+    maphandle = CreateFileMapping(INVALID_HANDLE_VALUE, NULL,
+            PAGE_READWRITE, DWORD(uint64_t(size) >> 32), DWORD(size),
+            NULL);
+    if (maphandle == NULL) {
+        std::stringstream ss;
+        ss << "failed to create file mapping: " << cb_strerror();
+        maphandle = INVALID_HANDLE_VALUE;
+        throw ss.str();
+    }
+
+    root = MapViewOfFile(maphandle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (root == NULL) {
+        std::stringstream ss;
+        ss << "mapviewoffile failed: " << cb_strerror();
+        CloseHandle(maphandle);
+        maphandle = INVALID_HANDLE_VALUE;
+        throw ss.str();
+    }
+
+    if (populate) {
+        advise(Advice::WillNeed);
+    }
+}
+
+void Couchbase::MemoryMappedFile::grow(size_t) {
+    throw std::string("grow: the mapping isn't growable");
+}
+
+size_t Couchbase::MemoryMappedFile::getPageSize() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return size_t(info.dwPageSize);
+}
+
+size_t Couchbase::MemoryMappedFile::getAllocationGranularity() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return size_t(info.dwAllocationGranularity);
+}
+
+size_t Couchbase::MemoryMappedFile::getHugePageSize() {
+    return GetLargePageMinimum();
+}
+
+void Couchbase::MemoryMappedFile::doSync(size_t offset, size_t length,
+                                         SyncMode mode) {
+    // FlushViewOfFile only starts writing the pages back
+    if (!FlushViewOfFile(static_cast<char*>(root) + offset, length)) {
+        std::stringstream ss;
+        ss << "FlushViewOfFile failed: " << cb_strerror();
+        throw ss.str();
+    }
+    if (mode == SyncMode::Sync && !FlushFileBuffers(filehandle)) {
+        std::stringstream ss;
+        ss << "FlushFileBuffers failed: " << cb_strerror();
+        throw ss.str();
+    }
+}
+
+void Couchbase::MemoryMappedFile::doAdvise(Advice advice, size_t offset,
+                                           size_t length) {
+    if (advice == Advice::DontNeed) {
+        // Unlocking pages which aren't locked fails, but it takes them
+        // out of the working set (without losing any data)
+        VirtualUnlock(static_cast<char*>(root) + offset, length);
+        return;
+    }
+    // Otherwise Windows only lets us ask for pages to be read in
+    if (advice != Advice::WillNeed) {
+        return;
+    }
+#if _WIN32_WINNT >= 0x0602
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = static_cast<char*>(root) + offset;
+    range.NumberOfBytes = length;
+    if (!PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0)) {
+        std::stringstream ss;
+        ss << "PrefetchVirtualMemory failed: " << cb_strerror();
+        throw ss.str();
+    }
+#else
+    (void)offset;
+    (void)length;
+#endif
 }
@@ -0,0 +1,209 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+
+#include <platform/cacheline.h>
+#include <platform/readmostly_rwlock.h>
+
+#include <new>
+#include <thread>
+
+/**
+ * The maximum number of reader slots per lock (each using a cache line)
+ */
+static const size_t MaxSlots = 128;
+
+/**
+ * Threads are assigned reader slots round robin the first time they use
+ * a ReadMostlyRWLock, and keep using the same slot in every lock.
+ */
+static std::atomic<uint32_t> nextSlot(0);
+static thread_local uint32_t threadSlot = UINT32_MAX;
+
+/**
+ * The number of times the writer checks a reader slot before it sleeps
+ * waiting for the readers to leave
+ */
+static const int WriterSpin = 100;
+
+Couchbase::ReadMostlyRWLock::ReadMostlyRWLock()
+    : writer(0),
+      drained(0) {
+    size_t count = 1;
+    const size_t cpus = std::thread::hardware_concurrency();
+    while (count < cpus && count < MaxSlots) {
+        count <<= 1;
+    }
+    mask = count - 1;
+
+    storage.reset(new char[(count + 1) * CacheLineSize]);
+    const uintptr_t base = reinterpret_cast<uintptr_t>(storage.get());
+    slots = storage.get() + (CacheLineSize - (base % CacheLineSize));
+    for (size_t ii = 0; ii < count; ++ii) {
+        new (slots + ii * CacheLineSize) Slot;
+        slotAt(ii).readers.store(0);
+    }
+}
+
+Couchbase::ReadMostlyRWLock::Slot& Couchbase::ReadMostlyRWLock::slotAt(
+    size_t index) {
+    return *reinterpret_cast<Slot*>(slots + index * CacheLineSize);
+}
+
+Couchbase::ReadMostlyRWLock::Slot& Couchbase::ReadMostlyRWLock::getSlot() {
+    if (threadSlot == UINT32_MAX) {
+        threadSlot = nextSlot.fetch_add(1, std::memory_order_relaxed);
+    }
+    return slotAt(threadSlot & mask);
+}
+
+void Couchbase::ReadMostlyRWLock::waitForWriter() {
+    uint32_t state = writer.load();
+    while (state != 0) {
+        if (state == 1 && !writer.compare_exchange_weak(state, 2)) {
+            continue;
+        }
+        futexWait(writer, 2);
+        state = writer.load();
+    }
+}
+
+void Couchbase::ReadMostlyRWLock::readerDone(Slot& slot) {
+    slot.readers.fetch_sub(1);
+    if (writer.load() != 0) {
+        // A writer may be waiting for us to drain
+        drained.fetch_add(1);
+        futexWake(drained, 1);
+    }
+}
+
+void Couchbase::ReadMostlyRWLock::lock_shared() {
+    auto& slot = getSlot();
+    while (true) {
+        // The increment and the load of writer must be sequentially
+        // consistent, as the writer does the opposite (sets writer and
+        // loads the reader counts).
+        slot.readers.fetch_add(1);
+        if (writer.load() == 0) {
+            return;
+        }
+        // Writer preference: back off and wait for the writer
+        readerDone(slot);
+        waitForWriter();
+    }
+}
+
+bool Couchbase::ReadMostlyRWLock::try_lock_shared() {
+    auto& slot = getSlot();
+    slot.readers.fetch_add(1);
+    if (writer.load() == 0) {
+        return true;
+    }
+    readerDone(slot);
+    return false;
+}
+
+void Couchbase::ReadMostlyRWLock::unlock_shared() {
+    readerDone(getSlot());
+}
+
+bool Couchbase::ReadMostlyRWLock::readersActive() {
+    for (size_t ii = 0; ii <= mask; ++ii) {
+        if (slotAt(ii).readers.load() != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Couchbase::ReadMostlyRWLock::lock() {
+    writerMutex.lock();
+    writer.store(1);
+    for (size_t ii = 0; ii <= mask; ++ii) {
+        auto& slot = slotAt(ii);
+        int spin = 0;
+        while (true) {
+            const uint32_t seen = drained.load();
+            if (slot.readers.load() == 0) {
+                break;
+            }
+            if (++spin < WriterSpin) {
+                cpuRelax();
+            } else {
+                futexWait(drained, seen);
+            }
+        }
+    }
+}
+
+bool Couchbase::ReadMostlyRWLock::try_lock() {
+    if (!writerMutex.try_lock()) {
+        return false;
+    }
+    writer.store(1);
+    if (readersActive()) {
+        unlock();
+        return false;
+    }
+    return true;
+}
+
+void Couchbase::ReadMostlyRWLock::unlock() {
+    if (writer.exchange(0) == 2) {
+        futexWakeAll(writer);
+    }
+    writerMutex.unlock();
+}
+
+struct cb_rm_rwlock_st {
+    Couchbase::ReadMostlyRWLock lock;
+};
+
+void cb_rm_rw_lock_initialize(cb_rm_rwlock_t *rw)
+{
+    *rw = new cb_rm_rwlock_st;
+}
+
+void cb_rm_rw_lock_destroy(cb_rm_rwlock_t *rw)
+{
+    delete *rw;
+    *rw = nullptr;
+}
+
+int cb_rm_rw_reader_enter(cb_rm_rwlock_t *rw)
+{
+    (*rw)->lock.lock_shared();
+    return 0;
+}
+
+int cb_rm_rw_reader_exit(cb_rm_rwlock_t *rw)
+{
+    (*rw)->lock.unlock_shared();
+    return 0;
+}
+
+int cb_rm_rw_writer_enter(cb_rm_rwlock_t *rw)
+{
+    (*rw)->lock.lock();
+    return 0;
+}
+
+int cb_rm_rw_writer_exit(cb_rm_rwlock_t *rw)
+{
+    (*rw)->lock.unlock();
+    return 0;
+}
@@ -14,11 +14,70 @@
  *   See the License for the specific language governing permissions and
  *   limitations under the License.
  */
+#include "thread_registry_private.h"
+
+#include <platform/futex.h>
 #include <platform/thread.h>
+#include <platform/thread_local.h>
+
+#include <vector>
+
+namespace {
+    /**
+     * A parked thread in the thread cache. The thread sleeps on the
+     * futex word until it is given a Thread to run (or told to exit).
+     */
+    struct CachedThread {
+        enum : uint32_t { Idle = 0, Run = 1, Exit = 2 };
+
+        CachedThread()
+            : command(Idle),
+              thread(nullptr) {
+        }
+
+        std::atomic<uint32_t> command;
+        Couchbase::Thread* thread;
+    };
+
+    struct ThreadCache {
+        ThreadCache()
+            : maxIdle(0) {
+        }
+
+        std::mutex mutex;
+        std::vector<CachedThread*> idle;
+        size_t maxIdle;
+    };
+}
+
+/**
+ * The cache is never deleted, as the cached threads are detached and may
+ * still be parked when the static destructors run.
+ */
+static ThreadCache& getThreadCache() {
+    static ThreadCache* cache = new ThreadCache;
+    return *cache;
+}
 
 Couchbase::Thread::Thread(const std::string& name_)
     : name(name_),
-      state(ThreadState::Stopped) {
+      cacheable(true),
+      cached(false),
+      attached(0),
+      state(ThreadState::Stopped),
+      stopToken(0) {
+    cb_thread_options_initialize(&options);
+}
+
+Couchbase::Thread::Thread(const std::string& name_,
+                          const cb_thread_options_t& options_)
+    : name(name_),
+      options(options_),
+      cacheable(false),
+      cached(false),
+      attached(0),
+      state(ThreadState::Stopped),
+      stopToken(0) {
 
 }
 
@@ -27,7 +86,7 @@ Couchbase::Thread::~Thread() {
     case ThreadState::Stopped:
         return;
     case ThreadState::Zombie:
-        cb_join_thread(thread_id);
+        reap();
         return;
     case ThreadState::Running:
         throw std::logic_error("Thread should be stopped before deleted"
@@ -40,7 +99,11 @@ Couchbase::Thread::~Thread() {
 }
 
 void Couchbase::Thread::thread_entry() {
+    ThreadRegistry::setState(ThreadState::Starting);
+    // The OS may reject the name (if it is too long), but the registry
+    // should still know the thread by its full name
     cb_set_thread_name(name.c_str());
+    ThreadRegistry::setName(name.c_str());
 
     // Call the subclass run() method
     run();
@@ -51,6 +114,10 @@ void Couchbase::Thread::thread_entry() {
                                    " call setRunning()");
     }
 
+    // Run the ThreadLocal destructors before anyone waiting for the
+    // thread to stop is told that it is done
+    ThreadLocalBase::threadExit();
+    ThreadRegistry::setState(ThreadState::Zombie);
     setState(ThreadState::Zombie);
 }
 
@@ -59,6 +126,15 @@ public:
     static void run(Thread& thread) {
         thread.thread_entry();
     }
+
+    /**
+     * The cached thread is done with the Thread object (it may be
+     * deleted or restarted as soon as this returns)
+     */
+    static void detach(Thread& thread) {
+        thread.attached.store(0, std::memory_order_release);
+        Couchbase::futexWakeAll(thread.attached);
+    }
 };
 
 static void task_thread_main(void* arg) {
@@ -66,21 +142,142 @@ static void task_thread_main(void* arg) {
     Couchbase::StartThreadDelegator::run(*thread);
 }
 
-void Couchbase::Thread::start() {
-    std::unique_lock<std::mutex> lock(synchronization.mutex);
-    state = ThreadState::Starting;
+static void cached_thread_main(void* arg) {
+    auto* self = reinterpret_cast<CachedThread*>(arg);
+    auto& cache = getThreadCache();
+
+    while (true) {
+        uint32_t command;
+        while ((command = self->command.load(std::memory_order_acquire)) ==
+               CachedThread::Idle) {
+            Couchbase::futexWait(self->command, CachedThread::Idle);
+        }
+        if (command == CachedThread::Exit) {
+            break;
+        }
+
+        auto* thread = self->thread;
+        self->thread = nullptr;
+        self->command.store(CachedThread::Idle, std::memory_order_relaxed);
+        Couchbase::StartThreadDelegator::run(*thread);
+        Couchbase::StartThreadDelegator::detach(*thread);
+        Couchbase::ThreadRegistry::setState(Couchbase::ThreadState::Stopped);
+        cb_set_thread_name("cached thread");
+
+        std::lock_guard<std::mutex> guard(cache.mutex);
+        if (cache.idle.size() >= cache.maxIdle) {
+            break;
+        }
+        cache.idle.push_back(self);
+    }
+    delete self;
+}
 
-    if (cb_create_thread(&thread_id, task_thread_main, this, 0) != 0) {
+void Couchbase::Thread::spawn() {
+    stopToken.store(0, std::memory_order_relaxed);
+    attached.store(1, std::memory_order_relaxed);
+    cached = false;
+
+    if (cacheable) {
+        auto& cache = getThreadCache();
+        CachedThread* idle = nullptr;
+        {
+            std::lock_guard<std::mutex> guard(cache.mutex);
+            if (cache.maxIdle > 0) {
+                cached = true;
+                if (!cache.idle.empty()) {
+                    idle = cache.idle.back();
+                    cache.idle.pop_back();
+                }
+            }
+        }
+
+        if (cached) {
+            if (idle != nullptr) {
+                idle->thread = this;
+                idle->command.store(CachedThread::Run,
+                                    std::memory_order_release);
+                futexWake(idle->command, 1);
+                return;
+            }
+
+            // Nothing in the cache; create a new thread which is put in
+            // the cache when this Thread is done with it
+            idle = new CachedThread;
+            idle->thread = this;
+            idle->command.store(CachedThread::Run, std::memory_order_relaxed);
+            // The cached thread outlives this Thread (and its name may be
+            // too long for cb_create_named_thread); thread_entry sets the
+            // real name
+            cb_thread_t tid;
+            if (cb_create_named_thread(&tid, cached_thread_main, idle, 1,
+                                       "cached thread") != 0) {
+                delete idle;
+                std::lock_guard<std::mutex> lock(synchronization.mutex);
+                attached.store(0, std::memory_order_relaxed);
+                state = ThreadState::Stopped;
+                throw std::bad_alloc();
+            }
+            return;
+        }
+    }
+
+    cb_thread_t tid;
+    if (cb_create_named_thread_ex(&tid, task_thread_main, this, 0,
+                                  nullptr, &options) != 0) {
+        std::lock_guard<std::mutex> lock(synchronization.mutex);
+        attached.store(0, std::memory_order_relaxed);
         state = ThreadState::Stopped;
         throw std::bad_alloc();
     }
+    // The thread may already have finished, so reap() waits for this
+    thread_id = tid;
+    attached.store(0, std::memory_order_release);
+    futexWakeAll(attached);
+}
+
+void Couchbase::Thread::reap() {
+    while (attached.load(std::memory_order_acquire) != 0) {
+        futexWait(attached, 1);
+    }
+    if (!cached) {
+        cb_join_thread(thread_id);
+    }
+}
+
+void Couchbase::Thread::start() {
+    startAsync();
 
+    // The mutex isn't held while the thread is created so that the new
+    // thread doesn't block in setRunning()
+    std::unique_lock<std::mutex> lock(synchronization.mutex);
     while (state != ThreadState::Running && state != ThreadState::Zombie) {
         synchronization.cond.wait(lock);
     }
 }
 
+void Couchbase::Thread::startAsync() {
+    {
+        std::lock_guard<std::mutex> lock(synchronization.mutex);
+        state = ThreadState::Starting;
+    }
+    spawn();
+}
+
+void Couchbase::Thread::setThreadCacheSize(size_t size) {
+    auto& cache = getThreadCache();
+    std::lock_guard<std::mutex> guard(cache.mutex);
+    cache.maxIdle = size;
+    while (cache.idle.size() > size) {
+        auto* idle = cache.idle.back();
+        cache.idle.pop_back();
+        idle->command.store(CachedThread::Exit, std::memory_order_release);
+        futexWake(idle->command, 1);
+    }
+}
+
 void Couchbase::Thread::setRunning() {
+    ThreadRegistry::setState(ThreadState::Running);
     setState(ThreadState::Running);
 }
 
@@ -104,3 +301,57 @@ const Couchbase::ThreadState Couchbase::Thread::waitForState(
         synchronization.cond.wait(lock);
     }
 }
+
+void Couchbase::Thread::requestStop() {
+    if (stopToken.exchange(1, std::memory_order_release) == 0) {
+        futexWakeAll(stopToken);
+    }
+}
+
+bool Couchbase::Thread::waitForStop(std::chrono::nanoseconds timeout) {
+    if (isStopRequested()) {
+        return true;
+    }
+
+    uint64_t deadline = UINT64_MAX;
+    if (timeout != std::chrono::nanoseconds::max()) {
+        const uint64_t now = cb_get_monotonic_ns();
+        const uint64_t ns = timeout.count() > 0 ? timeout.count() : 0;
+        deadline = ns < UINT64_MAX - now ? now + ns : UINT64_MAX;
+    }
+
+    while (!isStopRequested()) {
+        uint64_t remaining = UINT64_MAX;
+        if (deadline != UINT64_MAX) {
+            const uint64_t now = cb_get_monotonic_ns();
+            if (now >= deadline) {
+                return false;
+            }
+            remaining = deadline - now;
+        }
+        futexWait(stopToken, 0, remaining);
+    }
+    return true;
+}
+
+bool Couchbase::Thread::joinFor(std::chrono::nanoseconds timeout) {
+    std::unique_lock<std::mutex> lock(synchronization.mutex);
+    const auto done = [this]() {
+        const auto current = state.load();
+        return current == ThreadState::Zombie ||
+               current == ThreadState::Stopped;
+    };
+
+    if (timeout == std::chrono::nanoseconds::max()) {
+        synchronization.cond.wait(lock, done);
+    } else if (!synchronization.cond.wait_for(lock, timeout, done)) {
+        return false;
+    }
+
+    if (state == ThreadState::Zombie) {
+        reap();
+        state = ThreadState::Stopped;
+        synchronization.cond.notify_all();
+    }
+    return true;
+}
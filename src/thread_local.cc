@@ -0,0 +1,244 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+
+#include <platform/thread_local.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+    /**
+     * The ThreadLocal elements of a thread, indexed by the id of the
+     * ThreadLocal. The owning thread reads the vector without locking;
+     * everything else (including resizing it) happens with the registry
+     * mutex held.
+     */
+    struct ThreadSlots {
+        std::vector<void*> slots;
+        /** The thread's caches in ThreadLocal::get (owning thread only) */
+        std::vector<Couchbase::ThreadLocalBase::Cache*> caches;
+    };
+
+    /** An element (of a thread or a ThreadLocal) about to be destroyed */
+    struct Doomed {
+        void* element;
+        void (*deleter)(void*);
+    };
+
+    struct Registry {
+        /**
+         * Recursive as the forEach callbacks (which are called with the
+         * mutex held) may use other ThreadLocals. The element destructors
+         * are called without it.
+         */
+        std::recursive_mutex mutex;
+
+        /** The ThreadLocal owning each id (nullptr if the id is free) */
+        std::vector<Couchbase::ThreadLocalBase*> owners;
+        std::vector<size_t> freeIds;
+
+        /** The elements for each id, keyed by the thread owning them */
+        std::vector<std::unordered_map<ThreadSlots*, void*>> elements;
+    };
+
+    /**
+     * Destroys the elements of threads which weren't created by the
+     * platform library (or which created elements after threadExit)
+     */
+    struct ThreadExitGuard {
+        ~ThreadExitGuard() {
+            Couchbase::ThreadLocalBase::threadExit();
+        }
+    };
+}
+
+/**
+ * The registry is never deleted, as detached threads may exit after the
+ * static destructors have run.
+ */
+static Registry& getRegistry() {
+    static Registry* registry = new Registry;
+    return *registry;
+}
+
+/** Trivially destructible, so it's safe to use during thread exit */
+static thread_local ThreadSlots* currentSlots = nullptr;
+
+static thread_local ThreadExitGuard exitGuard;
+
+static std::atomic<uint64_t> nextSerial(1);
+
+Couchbase::ThreadLocalBase::ThreadLocalBase(void (*deleter_)(void*))
+    : serial(nextSerial.fetch_add(1, std::memory_order_relaxed)),
+      deleter(deleter_),
+      id([this]() {
+          auto& registry = getRegistry();
+          std::lock_guard<std::recursive_mutex> guard(registry.mutex);
+          size_t ret;
+          if (registry.freeIds.empty()) {
+              ret = registry.owners.size();
+              registry.owners.push_back(this);
+              registry.elements.emplace_back();
+          } else {
+              ret = registry.freeIds.back();
+              registry.freeIds.pop_back();
+              registry.owners[ret] = this;
+          }
+          return ret;
+      }()) {
+}
+
+Couchbase::ThreadLocalBase::~ThreadLocalBase() {
+    auto& registry = getRegistry();
+    std::lock_guard<std::recursive_mutex> guard(registry.mutex);
+    registry.owners[id] = nullptr;
+    registry.freeIds.push_back(id);
+}
+
+void* Couchbase::ThreadLocalBase::getElement() {
+    const auto* slots = currentSlots;
+    if (slots != nullptr && id < slots->slots.size()) {
+        void* element = slots->slots[id];
+        if (element != nullptr) {
+            return element;
+        }
+    }
+    return getElementSlow();
+}
+
+void* Couchbase::ThreadLocalBase::fillCache(Cache& cache) {
+    void* element = getElement();
+    if (!cache.registered) {
+        // Only the owning thread touches its caches
+        currentSlots->caches.push_back(&cache);
+        cache.registered = true;
+    }
+    cache.serial = serial;
+    cache.element = element;
+    return element;
+}
+
+void* Couchbase::ThreadLocalBase::getElementSlow() {
+    // Make sure the guard is constructed so that its destructor runs
+    // when the thread exits
+    (void)&exitGuard;
+
+    std::unique_ptr<ThreadSlots> created;
+    if (currentSlots == nullptr) {
+        created.reset(new ThreadSlots);
+    }
+    void* element = createElement();
+
+    auto& registry = getRegistry();
+    std::lock_guard<std::recursive_mutex> guard(registry.mutex);
+    if (created) {
+        currentSlots = created.release();
+    }
+    auto& slots = currentSlots->slots;
+    if (slots.size() <= id) {
+        slots.resize(registry.owners.size(), nullptr);
+    }
+    slots[id] = element;
+    registry.elements[id][currentSlots] = element;
+    return element;
+}
+
+void Couchbase::ThreadLocalBase::forEachElement(
+    const std::function<void(void*)>& callback) {
+    auto& registry = getRegistry();
+    std::lock_guard<std::recursive_mutex> guard(registry.mutex);
+    for (const auto& entry : registry.elements[id]) {
+        callback(entry.second);
+    }
+}
+
+static void destroy(const std::vector<Doomed>& doomed) {
+    for (const auto& d : doomed) {
+        d.deleter(d.element);
+    }
+}
+
+void Couchbase::ThreadLocalBase::destroyAll() {
+    std::vector<Doomed> doomed;
+    {
+        auto& registry = getRegistry();
+        std::lock_guard<std::recursive_mutex> guard(registry.mutex);
+        auto& elements = registry.elements[id];
+        for (const auto& entry : elements) {
+            // The owning thread only reads its own slots for other ids
+            // while we're running (as nobody may use a ThreadLocal while
+            // it is being destroyed). Its cache still refers to the
+            // element, but our serial is never used again.
+            entry.first->slots[id] = nullptr;
+            doomed.push_back({entry.second, deleter});
+        }
+        elements.clear();
+    }
+    destroy(doomed);
+}
+
+/**
+ * Make the calling thread's ThreadLocal::get calls look up their
+ * elements again
+ */
+static void clearCaches(ThreadSlots& slots) {
+    for (auto* cache : slots.caches) {
+        cache->serial = 0;
+        cache->registered = false;
+    }
+    slots.caches.clear();
+}
+
+void Couchbase::ThreadLocalBase::threadExit() {
+    ThreadSlots* slots = currentSlots;
+    if (slots == nullptr) {
+        return;
+    }
+
+    // The destructors may create new elements, so keep going until
+    // there are none left
+    while (true) {
+        clearCaches(*slots);
+        std::vector<Doomed> doomed;
+        {
+            auto& registry = getRegistry();
+            std::lock_guard<std::recursive_mutex> guard(registry.mutex);
+            for (size_t ii = 0; ii < slots->slots.size(); ++ii) {
+                void* element = slots->slots[ii];
+                if (element != nullptr) {
+                    slots->slots[ii] = nullptr;
+                    registry.elements[ii].erase(slots);
+                    // The deleter outlives the ThreadLocal (which may be
+                    // destroyed once we release the mutex)
+                    doomed.push_back({element,
+                                      registry.owners[ii]->deleter});
+                }
+            }
+        }
+        if (doomed.empty()) {
+            break;
+        }
+        destroy(doomed);
+    }
+    currentSlots = nullptr;
+    delete slots;
+}
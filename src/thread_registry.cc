@@ -0,0 +1,283 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "json_private.h"
+#include "thread_registry_private.h"
+
+#include <platform/thread_registry.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <unordered_set>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+namespace {
+    struct ThreadEntry {
+        ThreadEntry()
+            : tid(0),
+              state(-1) {
+        }
+
+        /** Protected by the registry mutex */
+        std::string name;
+        uint64_t tid;
+#ifdef WIN32
+        HANDLE handle;
+#else
+        pthread_t handle;
+#endif
+        /** The ThreadState (or -1 if it isn't a Couchbase::Thread) */
+        std::atomic<int> state;
+    };
+
+    struct Registry {
+        /**
+         * The threads can't exit while it is held (they need it to
+         * unregister), so we may look up their CPU time
+         */
+        std::mutex mutex;
+        std::unordered_set<ThreadEntry*> threads;
+    };
+}
+
+/**
+ * The registry is never deleted, as detached threads may exit after the
+ * static destructors have run.
+ */
+static Registry& getRegistry() {
+    static Registry* registry = new Registry;
+    return *registry;
+}
+
+/** Trivially destructible, so it's safe to use during thread exit */
+static thread_local ThreadEntry* currentEntry = nullptr;
+
+void Couchbase::ThreadRegistry::registerThread(const char* name) {
+    auto* entry = new ThreadEntry;
+    if (name != nullptr) {
+        entry->name.assign(name);
+    }
+#ifdef WIN32
+    entry->tid = GetCurrentThreadId();
+    entry->handle = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE,
+                               GetCurrentThreadId());
+#else
+#if defined(__linux__)
+    entry->tid = uint64_t(syscall(SYS_gettid));
+#elif defined(__APPLE__)
+    pthread_threadid_np(nullptr, &entry->tid);
+#else
+    entry->tid = uint64_t(uintptr_t(pthread_self()));
+#endif
+    entry->handle = pthread_self();
+#endif
+
+    auto& registry = getRegistry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    registry.threads.insert(entry);
+    currentEntry = entry;
+}
+
+void Couchbase::ThreadRegistry::unregisterThread() {
+    auto* entry = currentEntry;
+    if (entry == nullptr) {
+        return;
+    }
+
+    {
+        auto& registry = getRegistry();
+        std::lock_guard<std::mutex> guard(registry.mutex);
+        registry.threads.erase(entry);
+        currentEntry = nullptr;
+    }
+#ifdef WIN32
+    if (entry->handle != NULL) {
+        CloseHandle(entry->handle);
+    }
+#endif
+    delete entry;
+}
+
+void Couchbase::ThreadRegistry::setName(const char* name) {
+    auto* entry = currentEntry;
+    if (entry != nullptr) {
+        auto& registry = getRegistry();
+        std::lock_guard<std::mutex> guard(registry.mutex);
+        entry->name.assign(name);
+    }
+}
+
+void Couchbase::ThreadRegistry::setState(ThreadState state) {
+    auto* entry = currentEntry;
+    if (entry != nullptr) {
+        entry->state.store(static_cast<int>(state), std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Get the CPU time of the thread in ns. The thread must be alive (which
+ * it is while the registry mutex is held)
+ */
+static uint64_t getCpuTime(const ThreadEntry& entry) {
+#ifdef WIN32
+    FILETIME creation, exit, kernel, user;
+    if (entry.handle == NULL ||
+        !GetThreadTimes(entry.handle, &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    // FILETIME is in units of 100ns
+    return (k.QuadPart + u.QuadPart) * 100;
+#elif defined(__APPLE__)
+    // There is no pthread_getcpuclockid on macOS
+    thread_basic_info_data_t info;
+    mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+    if (thread_info(pthread_mach_thread_np(entry.handle), THREAD_BASIC_INFO,
+                    reinterpret_cast<thread_info_t>(&info),
+                    &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    const uint64_t us =
+        uint64_t(info.user_time.seconds + info.system_time.seconds) *
+            1000000ULL +
+        uint64_t(info.user_time.microseconds +
+                 info.system_time.microseconds);
+    return us * 1000;
+#else
+    clockid_t clock;
+    struct timespec ts;
+    if (pthread_getcpuclockid(entry.handle, &clock) != 0 ||
+        clock_gettime(clock, &ts) != 0) {
+        return 0;
+    }
+    return uint64_t(ts.tv_sec) * 1000000000ULL + uint64_t(ts.tv_nsec);
+#endif
+}
+
+/**
+ * Read the context switch counters of the thread from procfs (if
+ * available)
+ */
+static void getContextSwitches(const ThreadEntry& entry,
+                               Couchbase::ThreadStats& stats) {
+    stats.voluntaryContextSwitches = 0;
+    stats.involuntaryContextSwitches = 0;
+#ifdef __linux__
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%llu/status",
+             (unsigned long long)entry.tid);
+    FILE* fp = fopen(path, "r");
+    if (fp == nullptr) {
+        return;
+    }
+    char line[256];
+    unsigned long long value;
+    while (fgets(line, sizeof(line), fp) != nullptr) {
+        if (sscanf(line, "voluntary_ctxt_switches: %llu", &value) == 1) {
+            stats.voluntaryContextSwitches = value;
+        } else if (sscanf(line, "nonvoluntary_ctxt_switches: %llu",
+                          &value) == 1) {
+            stats.involuntaryContextSwitches = value;
+        }
+    }
+    fclose(fp);
+#else
+    (void)entry;
+#endif
+}
+
+std::vector<Couchbase::ThreadStats> Couchbase::ThreadRegistry::getStats() {
+    std::vector<ThreadStats> ret;
+    auto& registry = getRegistry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    ret.reserve(registry.threads.size());
+    for (const auto* entry : registry.threads) {
+        ThreadStats stats;
+        stats.name = entry->name;
+        stats.tid = entry->tid;
+        stats.cpuTime = getCpuTime(*entry);
+        getContextSwitches(*entry, stats);
+        const int state = entry->state.load(std::memory_order_relaxed);
+        stats.hasState = state >= 0;
+        stats.state = stats.hasState ? static_cast<ThreadState>(state)
+                                     : ThreadState::Stopped;
+        ret.push_back(stats);
+    }
+    return ret;
+}
+
+const char* Couchbase::ThreadRegistry::to_string(ThreadState state) {
+    switch (state) {
+    case ThreadState::Stopped:
+        return "stopped";
+    case ThreadState::Starting:
+        return "starting";
+    case ThreadState::Running:
+        return "running";
+    case ThreadState::Zombie:
+        return "zombie";
+    }
+    return "unknown";
+}
+
+std::string Couchbase::ThreadRegistry::toJSON() {
+    auto threads = getStats();
+    std::sort(threads.begin(), threads.end(),
+              [](const ThreadStats& a, const ThreadStats& b) {
+                  return a.cpuTime > b.cpuTime;
+              });
+
+    std::ostringstream out;
+    out << "{\"threads\":[";
+    bool first = true;
+    for (const auto& thread : threads) {
+        if (!first) {
+            out << ",";
+        }
+        first = false;
+        out << "{\"name\":";
+        appendJSONString(out, thread.name);
+        out << ",\"tid\":" << thread.tid
+            << ",\"cpu_time\":" << thread.cpuTime
+            << ",\"voluntary_ctxt_switches\":"
+            << thread.voluntaryContextSwitches
+            << ",\"involuntary_ctxt_switches\":"
+            << thread.involuntaryContextSwitches;
+        if (thread.hasState) {
+            out << ",\"state\":\"" << to_string(thread.state) << "\"";
+        }
+        out << "}";
+    }
+    out << "]}";
+    return out.str();
+}
@@ -0,0 +1,54 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// thread_registry_private - the hooks used by the thread implementations
+// to keep the thread registry up to date
+//
+
+#pragma once
+
+#include <platform/thread.h>
+
+namespace Couchbase {
+    namespace ThreadRegistry {
+
+        /**
+         * Add the calling thread to the registry
+         *
+         * @param name the initial name of the thread (may be NULL)
+         */
+        void registerThread(const char* name);
+
+        /**
+         * Remove the calling thread from the registry. Must be called
+         * before the thread exits.
+         */
+        void unregisterThread();
+
+        /**
+         * The calling thread changed its name
+         */
+        void setName(const char* name);
+
+        /**
+         * The calling thread runs a Couchbase::Thread which entered the
+         * given state
+         */
+        void setState(ThreadState state);
+    }
+}
@@ -0,0 +1,212 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include <platform/windowed_file_reader.h>
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#ifdef WIN32
+#include <platform/strerror.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+Couchbase::WindowedFileReader::WindowedFileReader(const std::string& fname,
+                                                  size_t windowSize_,
+                                                  size_t maxWindows_)
+    : filename(fname),
+      windowSize([windowSize_]() {
+          const size_t granularity =
+              MemoryMappedFile::getAllocationGranularity();
+          const size_t size = std::max(windowSize_, granularity);
+          return (size + granularity - 1) / granularity * granularity;
+      }()),
+      maxWindows(std::max(maxWindows_, size_t(1))) {
+    std::stringstream ss;
+#ifdef WIN32
+    file = CreateFile(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                      NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER sz;
+    if (file == INVALID_HANDLE_VALUE) {
+        ss << "WindowedFileReader: failed to open " << filename << ": "
+           << cb_strerror();
+        throw ss.str();
+    }
+    if (!GetFileSizeEx(file, &sz)) {
+        ss << "WindowedFileReader: failed to read the size of "
+           << filename << ": " << cb_strerror();
+        CloseHandle(file);
+        throw ss.str();
+    }
+    fileSize = uint64_t(sz.QuadPart);
+#else
+    file = ::open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (file == -1) {
+        ss << "WindowedFileReader: failed to open " << filename << ": "
+           << strerror(errno);
+        throw ss.str();
+    }
+    if (fstat(file, &st) == -1) {
+        ss << "WindowedFileReader: failed to read the size of "
+           << filename << ": " << strerror(errno);
+        ::close(file);
+        throw ss.str();
+    }
+    fileSize = uint64_t(st.st_size);
+#endif
+}
+
+Couchbase::WindowedFileReader::~WindowedFileReader() {
+    // The windows must be unmapped before the file is closed
+    windows.clear();
+#ifdef WIN32
+    CloseHandle(file);
+#else
+    ::close(file);
+#endif
+}
+
+Couchbase::WindowedFileReader::Chunk Couchbase::WindowedFileReader::map(
+    uint64_t offset) {
+    const Chunk ret = getChunk(offset, false);
+    // The caller may hold on to the pointer, so the iterator must leave
+    // the window alone
+    windows.front().pinned = true;
+    return ret;
+}
+
+size_t Couchbase::WindowedFileReader::read(uint64_t offset, void* buffer,
+                                           size_t length) {
+    auto* dest = static_cast<uint8_t*>(buffer);
+    size_t copied = 0;
+    while (copied < length && offset < fileSize) {
+        const Chunk chunk = getChunk(offset, false);
+        const size_t count = std::min(chunk.size, length - copied);
+        std::memcpy(dest + copied, chunk.data, count);
+        copied += count;
+        offset += count;
+    }
+    return copied;
+}
+
+Couchbase::WindowedFileReader::Chunk
+Couchbase::WindowedFileReader::getChunk(uint64_t offset, bool sequential) {
+    if (offset >= fileSize) {
+        std::stringstream ss;
+        ss << "WindowedFileReader: offset " << offset
+           << " is beyond the end of " << filename;
+        throw ss.str();
+    }
+    const uint64_t index = offset / windowSize;
+    auto& window = *getWindow(index, sequential).file;
+    const size_t skip = size_t(offset - index * windowSize);
+    Chunk ret;
+    ret.offset = offset;
+    ret.data = static_cast<const uint8_t*>(window.getRoot()) + skip;
+    ret.size = window.getSize() - skip;
+    return ret;
+}
+
+Couchbase::WindowedFileReader::Window&
+Couchbase::WindowedFileReader::getWindow(uint64_t index, bool sequential) {
+    for (auto it = windows.begin(); it != windows.end(); ++it) {
+        if (it->index == index) {
+            windows.splice(windows.begin(), windows, it);
+            return windows.front();
+        }
+    }
+
+    // Make room before mapping the new window, so we never have more
+    // than maxWindows mapped
+    if (windows.size() >= maxWindows) {
+        windows.pop_back();
+    }
+
+    std::unique_ptr<MemoryMappedFile> mapping(
+        new MemoryMappedFile(filename.c_str(), false, true));
+    mapping->setFileHandle(file, fileSize);
+    mapping->setRange(index * windowSize, windowSize);
+    if (sequential) {
+        mapping->setOpenAdvice(MemoryMappedFile::Advice::Sequential);
+    }
+    mapping->open();
+
+    Window window;
+    window.index = index;
+    window.file = std::move(mapping);
+    window.pinned = false;
+    windows.push_front(std::move(window));
+    return windows.front();
+}
+
+void Couchbase::WindowedFileReader::dropWindow(uint64_t index) {
+    for (auto it = windows.begin(); it != windows.end(); ++it) {
+        if (it->index == index) {
+            if (!it->pinned) {
+                windows.erase(it);
+            }
+            return;
+        }
+    }
+}
+
+void Couchbase::WindowedFileReader::readAhead(uint64_t index) {
+    if (maxWindows < 2 || index * windowSize >= fileSize) {
+        return;
+    }
+    // Mapping the next window makes it the most recently used, so move
+    // the current window back in front of it to keep it from being the
+    // next one evicted
+    const uint64_t current = windows.front().index;
+    getWindow(index, true).file->advise(MemoryMappedFile::Advice::WillNeed);
+    getWindow(current, true);
+}
+
+Couchbase::WindowedFileReader::Iterator::Iterator(
+    WindowedFileReader* reader_, uint64_t offset)
+    : reader(reader_) {
+    chunk.offset = offset;
+    chunk.data = nullptr;
+    chunk.size = 0;
+    if (reader != nullptr && offset < reader->fileSize) {
+        chunk = reader->getChunk(offset, true);
+        reader->readAhead(offset / reader->windowSize + 1);
+    } else if (reader != nullptr) {
+        chunk.offset = reader->fileSize;
+    }
+}
+
+Couchbase::WindowedFileReader::Iterator&
+Couchbase::WindowedFileReader::Iterator::operator++() {
+    const uint64_t next = chunk.offset + chunk.size;
+    // We're done with the window behind us
+    reader->dropWindow(chunk.offset / reader->windowSize);
+    if (next < reader->fileSize) {
+        chunk = reader->getChunk(next, true);
+        reader->readAhead(next / reader->windowSize + 1);
+    } else {
+        chunk.offset = reader->fileSize;
+        chunk.data = nullptr;
+        chunk.size = 0;
+    }
+    return *this;
+}
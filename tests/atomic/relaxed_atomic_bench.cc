@@ -0,0 +1,105 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// Show the effect of false sharing: N threads increment their own
+// counter, with the counters packed next to each other (sharing cache
+// lines) or padded to a cache line each. Then all of the threads
+// increment a single counter, which is either a RelaxedAtomic or a
+// StripedCounter.
+//
+
+#include <platform/platform.h>
+#include <relaxed_atomic.h>
+#include <striped_counter.h>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const uint64_t Iterations = 10000000;
+
+template <typename Counters>
+static void run(const std::string& name, Counters& counters, int threads) {
+    std::vector<std::thread> workers;
+    const hrtime_t start = gethrtime();
+    for (int ii = 0; ii < threads; ++ii) {
+        workers.emplace_back([&counters, ii]() {
+            auto& counter = counters[ii];
+            for (uint64_t jj = 0; jj < Iterations; ++jj) {
+                ++counter;
+            }
+        });
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    const hrtime_t duration = gethrtime() - start;
+
+    std::cout << std::setw(8) << name << std::setw(9) << threads
+              << std::setw(12) << std::fixed << std::setprecision(2)
+              << double(duration) / Iterations << std::endl;
+}
+
+template <typename Counter>
+static void shared(const std::string& name, int threads) {
+    Counter counter;
+    std::vector<std::thread> workers;
+    const hrtime_t start = gethrtime();
+    for (int ii = 0; ii < threads; ++ii) {
+        workers.emplace_back([&counter]() {
+            for (uint64_t jj = 0; jj < Iterations; ++jj) {
+                ++counter;
+            }
+        });
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    const hrtime_t duration = gethrtime() - start;
+
+    std::cout << std::setw(8) << name << std::setw(9) << threads
+              << std::setw(12) << std::fixed << std::setprecision(2)
+              << double(duration) / Iterations << std::endl;
+}
+
+int main() {
+    std::vector<int> threads = {1, 2, 4};
+    const int cores = int(std::thread::hardware_concurrency());
+    for (int ii = 8; ii <= cores; ii *= 2) {
+        threads.push_back(ii);
+    }
+
+    std::cout << std::setw(8) << "Layout" << std::setw(9) << "Threads"
+              << std::setw(12) << "ns/op" << std::endl;
+    for (auto n : threads) {
+        std::vector<Couchbase::RelaxedAtomic<uint64_t>> packed(n);
+        run("packed", packed, n);
+        Couchbase::RelaxedAtomicArray<uint64_t> padded(n);
+        run("padded", padded, n);
+    }
+
+    std::cout << std::endl << std::setw(8) << "Counter" << std::setw(9)
+              << "Threads" << std::setw(12) << "ns/op" << std::endl;
+    for (auto n : threads) {
+        shared<Couchbase::RelaxedAtomic<uint64_t>>("relaxed", n);
+        shared<Couchbase::StripedCounter<uint64_t>>("striped", n);
+    }
+    return 0;
+}
@@ -17,10 +17,19 @@
 
 #include "config.h"
 
+#include <atomic128.h>
 #include <relaxed_atomic.h>
+#include <seqlock.h>
+#include <striped_counter.h>
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
 // Test that we can use RelaxedAtomic<T> in STL containers.
 TEST(RelaxedAtomicTest, STLContainer) {
     std::vector<Couchbase::RelaxedAtomic<uint64_t>> vec;
@@ -35,3 +44,310 @@ TEST(RelaxedAtomicTest, STLContainer) {
     vec[2] = 2;
     EXPECT_EQ(2, vec[2]);
 }
+
+TEST(RelaxedAtomicTest, Padded) {
+    EXPECT_EQ(2 * Couchbase::CacheLineSize,
+              sizeof(Couchbase::PaddedRelaxedAtomic<uint64_t>));
+
+    Couchbase::PaddedRelaxedAtomic<uint64_t> counters[2];
+    EXPECT_EQ(0, counters[0]);
+    ++counters[0];
+    counters[1] += 5;
+    EXPECT_EQ(1, counters[0]);
+    EXPECT_EQ(5, counters[1]);
+    // A full cache line on either side of the value
+    const auto* value =
+        static_cast<Couchbase::RelaxedAtomic<uint64_t>*>(&counters[1]);
+    EXPECT_EQ(Couchbase::CacheLineSize,
+              reinterpret_cast<const char*>(value) -
+                  reinterpret_cast<const char*>(&counters[1]));
+
+    Couchbase::PaddedRelaxedAtomic<uint64_t> copy(counters[1]);
+    EXPECT_EQ(5, copy);
+    copy = counters[0];
+    EXPECT_EQ(1, copy);
+}
+
+TEST(RelaxedAtomicTest, Array) {
+    Couchbase::RelaxedAtomicArray<uint64_t> array(4);
+    EXPECT_EQ(4u, array.size());
+    EXPECT_EQ(0, array.sum());
+    for (size_t ii = 0; ii < array.size(); ++ii) {
+        array[ii] += ii + 1;
+    }
+    EXPECT_EQ(10, array.sum());
+    EXPECT_EQ(3, array[2]);
+
+    // Every counter is on its own cache line
+    const auto distance = uintptr_t(&array[1]) - uintptr_t(&array[0]);
+    EXPECT_LE(Couchbase::CacheLineSize, distance);
+
+    array.reset();
+    EXPECT_EQ(0, array.sum());
+}
+
+TEST(StripedCounterTest, Interface) {
+    Couchbase::StripedCounter<uint64_t> counter;
+    EXPECT_EQ(0, counter.load());
+    ++counter;
+    counter++;
+    counter += 10;
+    counter -= 2;
+    --counter;
+    EXPECT_EQ(9, counter.load());
+    EXPECT_EQ(9, uint64_t(counter));
+
+    static_assert(!std::is_copy_constructible<
+                          Couchbase::StripedCounter<uint64_t>>::value,
+                  "A StripedCounter can't be copied atomically");
+    Couchbase::StripedCounter<uint64_t> copy(counter.load());
+    EXPECT_EQ(9, copy.load());
+
+    counter = 5;
+    EXPECT_EQ(5, counter.load());
+    counter.reset();
+    EXPECT_EQ(0, counter.load());
+
+    Couchbase::StripedCounter<int64_t> initial(-3);
+    EXPECT_EQ(-3, initial.load());
+}
+
+TEST(StripedCounterTest, Threads) {
+    Couchbase::StripedCounter<uint64_t> counter;
+    const int threads = 8;
+    const int iterations = 100000;
+    std::vector<std::thread> workers;
+    for (int ii = 0; ii < threads; ++ii) {
+        workers.emplace_back([&counter]() {
+            for (int jj = 0; jj < iterations; ++jj) {
+                ++counter;
+            }
+        });
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    EXPECT_EQ(uint64_t(threads) * iterations, counter.load());
+    EXPECT_LE(1u, counter.size());
+    EXPECT_EQ(0u, counter.size() & (counter.size() - 1));
+}
+
+TEST(RelaxedAtomicTest, SetIfGreaterAndLess) {
+    Couchbase::RelaxedAtomic<int> value(10);
+    value.setIfGreater(5);
+    EXPECT_EQ(10, value);
+    value.setIfGreater(20);
+    EXPECT_EQ(20, value);
+    value.setIfLess(30);
+    EXPECT_EQ(20, value);
+    value.setIfLess(-1);
+    EXPECT_EQ(-1, value);
+
+    Couchbase::RelaxedAtomic<int> other(-5);
+    value.setIfLess(other);
+    EXPECT_EQ(-5, value);
+    other = 7;
+    value.setIfGreater(other);
+    EXPECT_EQ(7, value);
+}
+
+TEST(RelaxedAtomicTest, SetIfGreaterContended) {
+    Couchbase::RelaxedAtomic<uint64_t> max(0);
+    Couchbase::RelaxedAtomic<uint64_t> min(UINT64_MAX);
+    const int threads = 4;
+    const uint64_t iterations = 100000;
+    std::vector<std::thread> workers;
+    for (int ii = 0; ii < threads; ++ii) {
+        workers.emplace_back([&max, &min, ii]() {
+            for (uint64_t jj = 1; jj <= iterations; ++jj) {
+                max.setIfGreater(jj * threads + ii);
+                min.setIfLess(jj * threads + ii);
+            }
+        });
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    EXPECT_EQ(iterations * threads + threads - 1, max.load());
+    EXPECT_EQ(uint64_t(threads), min.load());
+}
+
+TEST(StripedWatermarkTest, HighAndLow) {
+    Couchbase::StripedHighWatermark<int64_t> high;
+    Couchbase::StripedLowWatermark<int64_t> low;
+    EXPECT_EQ(std::numeric_limits<int64_t>::lowest(), high.load());
+    EXPECT_EQ(std::numeric_limits<int64_t>::max(), low.load());
+
+    const int threads = 4;
+    std::vector<std::thread> workers;
+    for (int ii = 0; ii < threads; ++ii) {
+        workers.emplace_back([&high, &low, ii]() {
+            for (int jj = 0; jj < 10000; ++jj) {
+                high.setIfGreater(ii * 10000 + jj);
+                low.setIfLess(ii * 10000 + jj - 5);
+            }
+        });
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    EXPECT_EQ(threads * 10000 - 1, high.load());
+    EXPECT_EQ(-5, low.load());
+
+    high.reset();
+    low.reset();
+    high.setIfGreater(-10);
+    low.setIfLess(10);
+    EXPECT_EQ(-10, int64_t(high));
+    EXPECT_EQ(10, int64_t(low));
+}
+
+struct Timings {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+};
+
+TEST(SeqLockTest, LoadStore) {
+    Couchbase::SeqLock<Timings> timings;
+    auto value = timings.load();
+    EXPECT_EQ(0u, value.count);
+    EXPECT_EQ(0u, value.sum);
+    EXPECT_EQ(0u, value.max);
+
+    timings.store({1, 2, 3});
+    value = timings.load();
+    EXPECT_EQ(1u, value.count);
+    EXPECT_EQ(2u, value.sum);
+    EXPECT_EQ(3u, value.max);
+
+    // Types which aren't a multiple of the word size
+    Couchbase::SeqLock<char> small('a');
+    EXPECT_EQ('a', small.load());
+    small.store('b');
+    EXPECT_EQ('b', small.load());
+}
+
+TEST(SeqLockTest, ConsistentSnapshots) {
+    Couchbase::SeqLock<Timings> timings;
+    const int writers = 2;
+    const uint64_t iterations = 100000;
+    std::atomic<bool> done(false);
+
+    std::vector<std::thread> threads;
+    for (int ii = 0; ii < writers; ++ii) {
+        threads.emplace_back([&timings]() {
+            for (uint64_t jj = 1; jj <= iterations; ++jj) {
+                timings.update([jj](Timings& t) {
+                    ++t.count;
+                    t.sum += jj;
+                    t.max = std::max(t.max, jj);
+                });
+            }
+        });
+    }
+
+    // The reader checks that the fields are consistent with each other
+    threads.emplace_back([&timings, &done]() {
+        while (!done.load()) {
+            const auto value = timings.load();
+            EXPECT_LE(value.max, value.count);
+            EXPECT_LE(value.count, value.sum);
+            EXPECT_LE(value.sum, value.count * value.max);
+        }
+    });
+
+    for (int ii = 0; ii < writers; ++ii) {
+        threads[ii].join();
+    }
+    done = true;
+    threads.back().join();
+
+    const auto value = timings.load();
+    EXPECT_EQ(writers * iterations, value.count);
+    EXPECT_EQ(writers * iterations * (iterations + 1) / 2, value.sum);
+    EXPECT_EQ(iterations, value.max);
+}
+
+TEST(RelaxedAtomicTest, FloatingPoint) {
+    Couchbase::RelaxedAtomic<double> sum;
+    EXPECT_EQ(0.0, sum.load());
+    sum += 1.5;
+    sum -= 0.25;
+    ++sum;
+    EXPECT_DOUBLE_EQ(2.25, sum.load());
+    EXPECT_DOUBLE_EQ(2.25, sum--);
+    EXPECT_DOUBLE_EQ(1.25, double(sum));
+
+    Couchbase::RelaxedAtomic<float> total;
+    const int threads = 4;
+    std::vector<std::thread> workers;
+    for (int ii = 0; ii < threads; ++ii) {
+        workers.emplace_back([&total]() {
+            for (int jj = 0; jj < 10000; ++jj) {
+                total += 0.5f;
+            }
+        });
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    // All of the partial sums are exactly representable
+    EXPECT_EQ(threads * 5000.0f, total.load());
+}
+
+struct VersionedValue {
+    uint64_t value;
+    uint64_t version;
+};
+
+TEST(Atomic128Test, CompareExchange) {
+    Couchbase::Atomic128<VersionedValue> atomic;
+    auto current = atomic.load();
+    EXPECT_EQ(0u, current.value);
+    EXPECT_EQ(0u, current.version);
+
+    atomic.store({5, 1});
+    VersionedValue expected = {5, 0};
+    EXPECT_FALSE(atomic.compareExchange(expected, {6, 1}));
+    EXPECT_EQ(5u, expected.value);
+    EXPECT_EQ(1u, expected.version);
+    EXPECT_TRUE(atomic.compareExchange(expected, {6, 2}));
+    current = atomic.load();
+    EXPECT_EQ(6u, current.value);
+    EXPECT_EQ(2u, current.version);
+
+    Couchbase::Atomic128<VersionedValue> initial({1, 2});
+    EXPECT_EQ(1u, initial.load().value);
+    EXPECT_EQ(2u, initial.load().version);
+
+#if defined(__x86_64__) || defined(_M_X64)
+    EXPECT_TRUE(Couchbase::Atomic128<VersionedValue>::isLockFree());
+#endif
+}
+
+TEST(Atomic128Test, Update) {
+    // Both words are updated together, so value and version always match
+    Couchbase::Atomic128<VersionedValue> atomic;
+    const int threads = 4;
+    const int iterations = 20000;
+    std::vector<std::thread> workers;
+    for (int ii = 0; ii < threads; ++ii) {
+        workers.emplace_back([&atomic]() {
+            for (int jj = 0; jj < iterations; ++jj) {
+                atomic.update([](VersionedValue& v) {
+                    v.value += 3;
+                    ++v.version;
+                });
+                const auto current = atomic.load();
+                EXPECT_EQ(current.version * 3, current.value);
+            }
+        });
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    const auto current = atomic.load();
+    EXPECT_EQ(uint64_t(threads) * iterations, current.version);
+    EXPECT_EQ(uint64_t(threads) * iterations * 3, current.value);
+}
@@ -0,0 +1,203 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// Benchmark the phase synchronisation latency of Couchbase::Latch and
+// Couchbase::Barrier compared to their cb_mutex_t / cb_cond_t
+// equivalents:
+//
+//   * barrier: the time per phase when N threads repeatedly wait for
+//     each other
+//   * latch: the time from the last countDown() until all of the
+//     waiting threads are running
+//
+
+#include <platform/barrier.h>
+#include <platform/platform.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * The condition variable countdown we want to replace
+ */
+class CondLatch {
+public:
+    explicit CondLatch(uint32_t count)
+        : remaining(count) {
+        cb_mutex_initialize(&mutex);
+        cb_cond_initialize(&cond);
+    }
+
+    ~CondLatch() {
+        cb_cond_destroy(&cond);
+        cb_mutex_destroy(&mutex);
+    }
+
+    void countDown() {
+        cb_mutex_enter(&mutex);
+        if (--remaining == 0) {
+            cb_cond_broadcast(&cond);
+        }
+        cb_mutex_exit(&mutex);
+    }
+
+    void wait() {
+        cb_mutex_enter(&mutex);
+        while (remaining != 0) {
+            cb_cond_wait(&cond, &mutex);
+        }
+        cb_mutex_exit(&mutex);
+    }
+
+private:
+    uint32_t remaining;
+    cb_mutex_t mutex;
+    cb_cond_t cond;
+};
+
+class CondBarrier {
+public:
+    explicit CondBarrier(uint32_t count)
+        : count(count),
+          arrived(0),
+          generation(0) {
+        cb_mutex_initialize(&mutex);
+        cb_cond_initialize(&cond);
+    }
+
+    ~CondBarrier() {
+        cb_cond_destroy(&cond);
+        cb_mutex_destroy(&mutex);
+    }
+
+    bool arriveAndWait() {
+        cb_mutex_enter(&mutex);
+        const uint64_t gen = generation;
+        if (++arrived == count) {
+            arrived = 0;
+            ++generation;
+            cb_cond_broadcast(&cond);
+            cb_mutex_exit(&mutex);
+            return true;
+        }
+        while (generation == gen) {
+            cb_cond_wait(&cond, &mutex);
+        }
+        cb_mutex_exit(&mutex);
+        return false;
+    }
+
+private:
+    const uint32_t count;
+    uint32_t arrived;
+    uint64_t generation;
+    cb_mutex_t mutex;
+    cb_cond_t cond;
+};
+
+template <typename BarrierType>
+static void barrier(const std::string& name, int threads) {
+    const int phases = 20000;
+    BarrierType barrier(threads);
+    std::vector<std::thread> workers;
+
+    const hrtime_t start = gethrtime();
+    for (int ii = 0; ii < threads; ++ii) {
+        workers.emplace_back([&barrier]() {
+            for (int phase = 0; phase < phases; ++phase) {
+                barrier.arriveAndWait();
+            }
+        });
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    const hrtime_t duration = gethrtime() - start;
+
+    std::cout << std::setw(10) << name << std::setw(9) << threads
+              << std::setw(14) << duration / phases << std::endl;
+}
+
+template <typename LatchType>
+static void latch(const std::string& name, int threads) {
+    const int rounds = 2000;
+    std::vector<hrtime_t> samples;
+    samples.reserve(rounds);
+
+    for (int round = 0; round < rounds; ++round) {
+        std::unique_ptr<LatchType> ready(new LatchType(threads));
+        std::unique_ptr<LatchType> go(new LatchType(1));
+        std::atomic<hrtime_t> last(0);
+        std::vector<std::thread> workers;
+        for (int ii = 0; ii < threads; ++ii) {
+            workers.emplace_back([&ready, &go, &last]() {
+                ready->countDown();
+                go->wait();
+                const hrtime_t now = gethrtime();
+                hrtime_t current = last.load();
+                while (now > current &&
+                       !last.compare_exchange_weak(current, now)) {
+                }
+            });
+        }
+        ready->wait();
+        const hrtime_t start = gethrtime();
+        go->countDown();
+        for (auto& t : workers) {
+            t.join();
+        }
+        samples.push_back(last.load() - start);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    std::cout << std::setw(10) << name << std::setw(9) << threads
+              << std::setw(12) << samples[rounds / 2]
+              << std::setw(12) << samples[rounds * 99 / 100] << std::endl;
+}
+
+int main() {
+    std::vector<int> threads = {2, 4};
+    const int cores = int(std::thread::hardware_concurrency());
+    for (int ii = 8; ii <= cores; ii *= 2) {
+        threads.push_back(ii);
+    }
+
+    std::cout << "Barrier" << std::endl;
+    std::cout << std::setw(10) << "Type" << std::setw(9) << "Threads"
+              << std::setw(14) << "ns/phase" << std::endl;
+    for (auto n : threads) {
+        barrier<Couchbase::Barrier>("futex", n);
+        barrier<CondBarrier>("condvar", n);
+    }
+
+    std::cout << std::endl << "Latch release latency (ns)" << std::endl;
+    std::cout << std::setw(10) << "Type" << std::setw(9) << "Threads"
+              << std::setw(12) << "p50" << std::setw(12) << "p99"
+              << std::endl;
+    for (auto n : threads) {
+        latch<Couchbase::Latch>("futex", n);
+        latch<CondLatch>("condvar", n);
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include <gtest/gtest.h>
+#include <platform/barrier.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST(LatchTest, CountDown) {
+    Couchbase::Latch latch(2);
+    EXPECT_FALSE(latch.tryWait());
+    latch.countDown();
+    EXPECT_FALSE(latch.tryWait());
+    latch.countDown();
+    EXPECT_TRUE(latch.tryWait());
+    // Doesn't block once the counter is 0
+    latch.wait();
+
+    Couchbase::Latch zero(0);
+    EXPECT_TRUE(zero.tryWait());
+    zero.wait();
+}
+
+TEST(LatchTest, ReleasesWaiters) {
+    const int threads = 4;
+    Couchbase::Latch start(1);
+    Couchbase::Latch done(threads);
+    std::atomic<int> released(0);
+
+    std::vector<std::thread> workers;
+    for (int ii = 0; ii < threads; ++ii) {
+        workers.emplace_back([&start, &done, &released]() {
+            start.wait();
+            ++released;
+            done.countDown();
+        });
+    }
+
+    // Give the threads a chance to park
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(0, released.load());
+    start.countDown();
+    done.wait();
+    EXPECT_EQ(threads, released.load());
+
+    for (auto& t : workers) {
+        t.join();
+    }
+}
+
+TEST(LatchTest, ArriveAndWait) {
+    const int threads = 4;
+    Couchbase::Latch latch(threads);
+    std::atomic<int> arrived(0);
+
+    std::vector<std::thread> workers;
+    for (int ii = 0; ii < threads; ++ii) {
+        workers.emplace_back([&latch, &arrived, threads]() {
+            ++arrived;
+            latch.arriveAndWait();
+            EXPECT_EQ(threads, arrived.load());
+        });
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+}
+
+/**
+ * The waiter may delete the latch as soon as it is released, so
+ * countDown() must not touch it after the final decrement (run with
+ * ASan to catch it)
+ */
+TEST(LatchTest, WaiterDestroysLatch) {
+    for (int ii = 0; ii < 200; ++ii) {
+        auto* latch = new Couchbase::Latch(1);
+        std::thread releaser([latch]() { latch->countDown(); });
+        latch->wait();
+        delete latch;
+        releaser.join();
+    }
+}
+
+TEST(BarrierTest, Phases) {
+    const int threads = 4;
+    const int phases = 1000;
+    Couchbase::Barrier barrier(threads);
+    std::atomic<int> counter(0);
+    std::atomic<int> serial(0);
+
+    std::vector<std::thread> workers;
+    for (int ii = 0; ii < threads; ++ii) {
+        workers.emplace_back([&barrier, &counter, &serial]() {
+            for (int phase = 0; phase < phases; ++phase) {
+                ++counter;
+                if (barrier.arriveAndWait()) {
+                    ++serial;
+                }
+                // Everyone incremented the counter before anyone left
+                // the barrier, and nobody increments it for the next
+                // phase until everyone read it
+                EXPECT_EQ((phase + 1) * threads, counter.load());
+                barrier.arriveAndWait();
+            }
+        });
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    EXPECT_EQ(threads * phases, counter.load());
+    EXPECT_EQ(phases, serial.load());
+}
+
+TEST(BarrierTest, SingleThread) {
+    Couchbase::Barrier barrier(1);
+    for (int ii = 0; ii < 10; ++ii) {
+        EXPECT_TRUE(barrier.arriveAndWait());
+    }
+}
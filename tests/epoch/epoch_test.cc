@@ -0,0 +1,170 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include <gtest/gtest.h>
+#include <platform/epoch.h>
+#include <platform/platform.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static const uint64_t Magic = 0xfeedfacecafebeefULL;
+
+/**
+ * Counts the live instances so that we can check when they're deleted
+ */
+struct Tracked {
+    Tracked()
+        : magic(Magic) {
+        ++live;
+    }
+
+    ~Tracked() {
+        magic = 0;
+        --live;
+    }
+
+    volatile uint64_t magic;
+    static std::atomic<int> live;
+};
+
+std::atomic<int> Tracked::live(0);
+
+TEST(EpochTest, RetireAndSynchronize) {
+    Couchbase::Epoch::retire(new Tracked);
+    Couchbase::Epoch::retire(new Tracked);
+    EXPECT_EQ(2, Tracked::live.load());
+    Couchbase::Epoch::synchronize();
+    EXPECT_EQ(0, Tracked::live.load());
+}
+
+TEST(EpochTest, ReaderBlocksReclaim) {
+    std::atomic<int> state(0);
+    std::thread reader([&state]() {
+        Couchbase::EpochGuard guard;
+        state = 1;
+        while (state.load() != 2) {
+            std::this_thread::yield();
+        }
+    });
+    while (state.load() != 1) {
+        std::this_thread::yield();
+    }
+
+    Couchbase::Epoch::retire(new Tracked);
+    for (int ii = 0; ii < 10; ++ii) {
+        Couchbase::Epoch::reclaim();
+    }
+    // The reader entered before the object was retired, so it may still
+    // be using it
+    EXPECT_EQ(1, Tracked::live.load());
+
+    state = 2;
+    reader.join();
+    Couchbase::Epoch::synchronize();
+    EXPECT_EQ(0, Tracked::live.load());
+}
+
+TEST(EpochTest, RetireAfterStalledReader) {
+    std::atomic<int> state(0);
+    std::thread reader([&state]() {
+        Couchbase::EpochGuard guard;
+        state = 1;
+        while (state.load() != 2) {
+            std::this_thread::yield();
+        }
+    });
+    while (state.load() != 1) {
+        std::this_thread::yield();
+    }
+
+    for (int ii = 0; ii < 1000; ++ii) {
+        Couchbase::Epoch::retire(new Tracked);
+    }
+    EXPECT_EQ(1000, Tracked::live.load());
+
+    state = 2;
+    reader.join();
+
+    // retire() backs off while the reader is stalled, but picks up the
+    // backlog once it is gone
+    for (int ii = 0; ii < 10000 && Tracked::live.load() >= 1000; ++ii) {
+        Couchbase::Epoch::retire(new Tracked);
+    }
+    EXPECT_LT(Tracked::live.load(), 1000);
+    Couchbase::Epoch::synchronize();
+    EXPECT_EQ(0, Tracked::live.load());
+}
+
+TEST(EpochTest, NestedGuards) {
+    {
+        Couchbase::EpochGuard outer;
+        {
+            Couchbase::EpochGuard inner;
+        }
+        Couchbase::Epoch::retire(new Tracked);
+        EXPECT_THROW(Couchbase::Epoch::synchronize(), std::logic_error);
+    }
+    Couchbase::Epoch::synchronize();
+    EXPECT_EQ(0, Tracked::live.load());
+}
+
+static void retire_and_exit(void*) {
+    Couchbase::EpochGuard guard;
+    Couchbase::Epoch::retire(new Tracked);
+}
+
+TEST(EpochTest, ThreadExit) {
+    // The objects retired by a thread which exits are handed over to
+    // the remaining threads
+    cb_thread_t tid;
+    ASSERT_EQ(0, cb_create_thread(&tid, retire_and_exit, nullptr, 0));
+    ASSERT_EQ(0, cb_join_thread(tid));
+    EXPECT_EQ(1, Tracked::live.load());
+    Couchbase::Epoch::synchronize();
+    EXPECT_EQ(0, Tracked::live.load());
+}
+
+TEST(EpochTest, PublishAndRetire) {
+    std::atomic<Tracked*> published(new Tracked);
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> reads(0);
+
+    std::vector<std::thread> readers;
+    for (int ii = 0; ii < 4; ++ii) {
+        readers.emplace_back([&published, &stop, &reads]() {
+            while (!stop.load()) {
+                Couchbase::EpochGuard guard;
+                const auto* current = published.load();
+                EXPECT_EQ(Magic, current->magic);
+                ++reads;
+            }
+        });
+    }
+
+    for (int ii = 0; ii < 10000; ++ii) {
+        Couchbase::Epoch::retire(published.exchange(new Tracked));
+    }
+    stop = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+
+    Couchbase::Epoch::retire(published.exchange(nullptr));
+    Couchbase::Epoch::synchronize();
+    EXPECT_EQ(0, Tracked::live.load());
+}
@@ -0,0 +1,127 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// Benchmark the Executor:
+//
+//   * throughput for tasks scheduled from an external thread
+//   * throughput for tasks recursively split up by the workers (where
+//     the work is spread by stealing)
+//   * latency from a task is scheduled until it starts running
+//
+
+#include <platform/executor.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+static void external(size_t workers) {
+    const int tasks = 1000000;
+    Couchbase::Executor executor("bench", workers);
+    std::atomic<int> count(0);
+
+    const hrtime_t start = gethrtime();
+    for (int ii = 0; ii < tasks; ++ii) {
+        executor.post([&count]() { count++; });
+    }
+    while (count.load() != tasks) {
+        std::this_thread::yield();
+    }
+    const hrtime_t duration = gethrtime() - start;
+
+    std::cout << std::setw(8) << workers << std::setw(12) << "external"
+              << std::setw(16) << std::fixed << std::setprecision(0)
+              << tasks / (double(duration) / 1e9) << std::endl;
+}
+
+static void recursive(size_t workers) {
+    const int depth = 20;
+    Couchbase::Executor executor("bench", workers);
+    std::atomic<int> count(0);
+    std::function<void(int)> split;
+    split = [&executor, &count, &split](int level) {
+        count++;
+        if (level > 0) {
+            executor.post([&split, level]() { split(level - 1); });
+            executor.post([&split, level]() { split(level - 1); });
+        }
+    };
+
+    const int tasks = (1 << (depth + 1)) - 1;
+    const hrtime_t start = gethrtime();
+    executor.post([&split]() { split(depth); });
+    while (count.load() != tasks) {
+        std::this_thread::yield();
+    }
+    const hrtime_t duration = gethrtime() - start;
+
+    std::cout << std::setw(8) << workers << std::setw(12) << "recursive"
+              << std::setw(16) << std::fixed << std::setprecision(0)
+              << tasks / (double(duration) / 1e9) << std::endl;
+}
+
+static void latency(size_t workers) {
+    const int tasks = 10000;
+    Couchbase::Executor executor("bench", workers);
+    std::vector<hrtime_t> samples;
+    samples.reserve(tasks);
+
+    for (int ii = 0; ii < tasks; ++ii) {
+        const hrtime_t start = gethrtime();
+        auto future = executor.submit([start]() {
+            return gethrtime() - start;
+        });
+        samples.push_back(future.get());
+    }
+    std::sort(samples.begin(), samples.end());
+
+    std::cout << std::setw(8) << workers
+              << std::setw(12) << samples[tasks / 2]
+              << std::setw(12) << samples[tasks * 99 / 100]
+              << std::setw(12) << samples[tasks * 999 / 1000]
+              << std::setw(12) << samples.back() << std::endl;
+}
+
+int main() {
+    std::vector<size_t> workers = {1, 2, 4};
+    const size_t cores = std::thread::hardware_concurrency();
+    for (size_t ii = 8; ii <= cores; ii *= 2) {
+        workers.push_back(ii);
+    }
+
+    std::cout << "Throughput" << std::endl;
+    std::cout << std::setw(8) << "Workers" << std::setw(12) << "Scheduled"
+              << std::setw(16) << "Tasks/s" << std::endl;
+    for (auto n : workers) {
+        external(n);
+        recursive(n);
+    }
+
+    std::cout << std::endl << "Schedule to start latency (ns)" << std::endl;
+    std::cout << std::setw(8) << "Workers" << std::setw(12) << "p50"
+              << std::setw(12) << "p99" << std::setw(12) << "p99.9"
+              << std::setw(12) << "max" << std::endl;
+    for (auto n : workers) {
+        latency(n);
+    }
+    return 0;
+}
@@ -0,0 +1,184 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include <gtest/gtest.h>
+#include <platform/chaselev_deque.h>
+#include <platform/executor.h>
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+TEST(ChaseLevDequeTest, OwnerIsLifoThiefIsFifo) {
+    Couchbase::ChaseLevDeque<int> deque(2);
+    for (int ii = 0; ii < 10; ++ii) {
+        deque.push(ii);
+    }
+    EXPECT_EQ(10, deque.size());
+
+    int value;
+    EXPECT_TRUE(deque.take(value));
+    EXPECT_EQ(9, value);
+    EXPECT_TRUE(deque.steal(value));
+    EXPECT_EQ(0, value);
+    EXPECT_EQ(8, deque.size());
+
+    while (deque.take(value)) {
+    }
+    EXPECT_TRUE(deque.empty());
+    EXPECT_FALSE(deque.steal(value));
+}
+
+TEST(ChaseLevDequeTest, ConcurrentSteal) {
+    // Every element must be returned exactly once
+    const int elements = 100000;
+    Couchbase::ChaseLevDeque<int> deque(4);
+    std::vector<std::atomic<int> > seen(elements);
+    for (auto& s : seen) {
+        s.store(0);
+    }
+    std::atomic<bool> done(false);
+
+    std::vector<std::thread> thieves;
+    for (int ii = 0; ii < 3; ++ii) {
+        thieves.emplace_back([&deque, &seen, &done]() {
+            int value;
+            while (!done.load()) {
+                if (deque.steal(value)) {
+                    seen[value]++;
+                }
+            }
+        });
+    }
+
+    int value;
+    for (int ii = 0; ii < elements; ++ii) {
+        deque.push(ii);
+        if (ii % 3 == 0 && deque.take(value)) {
+            seen[value]++;
+        }
+    }
+    while (!deque.empty()) {
+        if (deque.take(value)) {
+            seen[value]++;
+        }
+    }
+    done.store(true);
+    for (auto& t : thieves) {
+        t.join();
+    }
+
+    for (int ii = 0; ii < elements; ++ii) {
+        ASSERT_EQ(1, seen[ii].load()) << "Element " << ii;
+    }
+}
+
+TEST(ExecutorTest, InvalidWorkers) {
+    EXPECT_THROW(Couchbase::Executor("exec", 0), std::invalid_argument);
+}
+
+TEST(ExecutorTest, SubmitReturnsResult) {
+    Couchbase::Executor executor("exec", 4);
+    EXPECT_EQ(4, executor.getWorkers());
+    EXPECT_FALSE(executor.isWorkerThread());
+
+    std::vector<std::future<int> > futures;
+    for (int ii = 0; ii < 1000; ++ii) {
+        futures.push_back(executor.submit([ii]() { return ii * 2; }));
+    }
+    for (int ii = 0; ii < 1000; ++ii) {
+        EXPECT_EQ(ii * 2, futures[ii].get());
+    }
+}
+
+TEST(ExecutorTest, SubmitPropagatesException) {
+    Couchbase::Executor executor("exec", 2);
+    auto future = executor.submit([]() -> int {
+        throw std::runtime_error("foo");
+    });
+    EXPECT_THROW(future.get(), std::runtime_error);
+}
+
+TEST(ExecutorTest, NestedTasks) {
+    // Tasks scheduled from a worker end up in its deque and are stolen by
+    // the other workers.
+    Couchbase::Executor executor("exec", 4);
+    std::atomic<int> count(0);
+    std::function<void(int)> split;
+    split = [&executor, &count, &split](int depth) {
+        EXPECT_TRUE(executor.isWorkerThread());
+        if (depth == 0) {
+            count++;
+            return;
+        }
+        executor.post([&split, depth]() { split(depth - 1); });
+        executor.post([&split, depth]() { split(depth - 1); });
+    };
+    executor.post([&split]() { split(12); });
+
+    while (count.load() != 4096) {
+        std::this_thread::yield();
+    }
+}
+
+TEST(ExecutorTest, DestructorRunsPendingTasks) {
+    std::atomic<int> count(0);
+    {
+        Couchbase::Executor executor("exec", 2);
+        for (int ii = 0; ii < 1000; ++ii) {
+            executor.post([&count]() { count++; });
+        }
+    }
+    EXPECT_EQ(1000, count.load());
+}
+
+TEST(ExecutorTest, HighPriorityRunsFirst) {
+    Couchbase::Executor executor("exec", 1);
+
+    // Block the only worker while we schedule the tasks
+    std::promise<void> blocker;
+    auto blocked = blocker.get_future().share();
+    std::promise<void> running;
+    executor.post([blocked, &running]() {
+        running.set_value();
+        blocked.wait();
+    });
+    running.get_future().wait();
+
+    std::mutex mutex;
+    std::vector<Couchbase::TaskPriority> order;
+    for (auto prio : {Couchbase::TaskPriority::Low,
+                      Couchbase::TaskPriority::Normal,
+                      Couchbase::TaskPriority::High}) {
+        for (int ii = 0; ii < 10; ++ii) {
+            executor.post([&mutex, &order, prio]() {
+                std::lock_guard<std::mutex> guard(mutex);
+                order.push_back(prio);
+            }, prio);
+        }
+    }
+    auto last = executor.submit([]() {}, Couchbase::TaskPriority::Low);
+    blocker.set_value();
+    last.wait();
+
+    ASSERT_EQ(30, order.size());
+    for (int ii = 0; ii < 30; ++ii) {
+        EXPECT_EQ(static_cast<int>(Couchbase::TaskPriority::High) + ii / 10,
+                  static_cast<int>(order[ii]));
+    }
+}
@@ -0,0 +1,260 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// Benchmark the JSON checker for a set of document shapes and sizes.
+//
+// The global operator new is replaced so that we may count the number
+// of allocations performed per validation.
+//
+// Usage: platform-json-checker-bench [--json]
+//
+//   --json  print the results as JSON instead of a table (so that they
+//           may be stored and compared against a baseline)
+//
+
+#include "config.h"
+
+#include <JSON_checker.h>
+#include <cJSON_utils.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(std::size_t count) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* ret = malloc(count == 0 ? 1 : count);
+    if (ret == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ret;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    free(ptr);
+}
+
+typedef std::function<std::string(size_t)> generator_t;
+
+/**
+ * An object where the values are long strings
+ */
+static std::string stringHeavy(size_t size) {
+    std::string ret("{");
+    int ii = 0;
+    while (ret.size() < size) {
+        if (ii != 0) {
+            ret.append(",");
+        }
+        ret.append("\"key" + std::to_string(ii++) + "\":\"");
+        ret.append(100, 'x');
+        ret.append("\"");
+    }
+    ret.append("}");
+    return ret;
+}
+
+/**
+ * An array of integers, decimals and exponents
+ */
+static std::string numberHeavy(size_t size) {
+    static const char* numbers[] = {"12345", "-42", "3.14159", "0.5e-10",
+                                    "6.02214E23", "0", "-0.001"};
+    std::string ret("[");
+    int ii = 0;
+    while (ret.size() < size) {
+        if (ii != 0) {
+            ret.append(",");
+        }
+        ret.append(numbers[ii++ % 7]);
+    }
+    ret.append("]");
+    return ret;
+}
+
+/**
+ * Nested objects and arrays, as deep as the size allows
+ */
+static std::string deeplyNested(size_t size) {
+    // Every two levels ({"a":[ and ]}) take 8 bytes
+    const size_t depth = size / 4;
+    std::string ret;
+    for (size_t ii = 0; ii < depth; ++ii) {
+        ret.append(ii % 2 ? "[" : "{\"a\":");
+    }
+    ret.append("1");
+    for (size_t ii = depth; ii > 0; --ii) {
+        ret.append((ii - 1) % 2 ? "]" : "}");
+    }
+    return ret;
+}
+
+/**
+ * An object with strings containing 2, 3 and 4 byte UTF-8 sequences
+ */
+static std::string nonAscii(size_t size) {
+    std::string ret("{");
+    int ii = 0;
+    while (ret.size() < size) {
+        if (ii != 0) {
+            ret.append(",");
+        }
+        ret.append("\"n\xC3\xB8kkel" + std::to_string(ii++) + "\":\"");
+        ret.append("bl\xC3\xA5" "b\xC3\xA6r \xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E "
+                   "\xF0\x9F\x98\x80 \xD0\xBF\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5"
+                   "\xD1\x82");
+        ret.append("\"");
+    }
+    ret.append("}");
+    return ret;
+}
+
+struct Result {
+    std::string method;
+    std::string shape;
+    size_t size;
+    uint64_t iterations;
+    hrtime_t duration;
+    uint64_t allocations;
+
+    double mbPerSec() const {
+        return (double(size) * iterations / (1024.0 * 1024.0)) /
+               (double(duration) / 1e9);
+    }
+
+    double docsPerSec() const {
+        return double(iterations) / (double(duration) / 1e9);
+    }
+
+    double allocsPerDoc() const {
+        return double(allocations) / iterations;
+    }
+};
+
+static Result bench(const std::string& method, const std::string& shape,
+                    const std::string& doc,
+                    std::function<bool(const std::string&)> validate) {
+    // Run for ~200ms, but at least 10 iterations
+    const hrtime_t limit = 200 * 1000 * 1000;
+    Result result = {method, shape, doc.size(), 0, 0, 0};
+
+    // Warm up (and let the Validator allocate its stack)
+    if (!validate(doc)) {
+        std::cerr << "FATAL: " << shape << " document of " << doc.size()
+                  << " bytes is invalid" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    const uint64_t allocs = allocations.load();
+    const hrtime_t start = gethrtime();
+    hrtime_t now;
+    do {
+        for (int ii = 0; ii < 10; ++ii) {
+            validate(doc);
+        }
+        result.iterations += 10;
+        now = gethrtime();
+    } while ((now - start) < limit);
+    result.duration = now - start;
+    result.allocations = allocations.load() - allocs;
+    return result;
+}
+
+int main(int argc, char** argv) {
+    bool json = false;
+    for (int ii = 1; ii < argc; ++ii) {
+        if (strcmp(argv[ii], "--json") == 0) {
+            json = true;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--json]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    const std::vector<std::pair<std::string, generator_t> > shapes = {
+        {"string-heavy", stringHeavy},
+        {"number-heavy", numberHeavy},
+        {"deeply-nested", deeplyNested},
+        {"non-ascii-utf8", nonAscii}
+    };
+    const std::vector<size_t> sizes = {64, 1024, 16 * 1024, 256 * 1024,
+                                       1024 * 1024};
+
+    JSON_checker::Validator validator;
+    std::vector<Result> results;
+    for (const auto& shape : shapes) {
+        for (auto size : sizes) {
+            const std::string doc = shape.second(size);
+            results.push_back(bench("Validator::validate", shape.first, doc,
+                                    [&validator](const std::string& d) {
+                                        return validator.validate(d);
+                                    }));
+            results.push_back(bench("checkUTF8JSON", shape.first, doc,
+                                    [](const std::string& d) {
+                                        return checkUTF8JSON(
+                                            reinterpret_cast<const unsigned char*>(d.data()),
+                                            d.size());
+                                    }));
+        }
+    }
+
+    if (json) {
+        unique_cJSON_ptr root(cJSON_CreateArray());
+        for (const auto& r : results) {
+            cJSON* obj = cJSON_CreateObject();
+            cJSON_AddStringToObject(obj, "method", r.method.c_str());
+            cJSON_AddStringToObject(obj, "shape", r.shape.c_str());
+            cJSON_AddNumberToObject(obj, "size", double(r.size));
+            cJSON_AddNumberToObject(obj, "iterations", double(r.iterations));
+            cJSON_AddNumberToObject(obj, "ns", double(r.duration));
+            cJSON_AddNumberToObject(obj, "mb_per_sec", r.mbPerSec());
+            cJSON_AddNumberToObject(obj, "docs_per_sec", r.docsPerSec());
+            cJSON_AddNumberToObject(obj, "allocs_per_doc", r.allocsPerDoc());
+            cJSON_AddItemToArray(root.get(), obj);
+        }
+        std::cout << to_string(root) << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    std::cout << std::left << std::setw(21) << "Method" << std::setw(16)
+              << "Shape" << std::right << std::setw(10) << "Size"
+              << std::setw(12) << "MB/s" << std::setw(14) << "docs/s"
+              << std::setw(14) << "allocs/doc" << std::endl;
+    for (const auto& r : results) {
+        std::cout << std::left << std::setw(21) << r.method << std::setw(16)
+                  << r.shape << std::right << std::setw(10) << r.size
+                  << std::fixed << std::setprecision(1) << std::setw(12)
+                  << r.mbPerSec() << std::setw(14) << r.docsPerSec()
+                  << std::setprecision(2) << std::setw(14)
+                  << r.allocsPerDoc() << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
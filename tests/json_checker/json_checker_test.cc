@@ -114,3 +114,52 @@ TEST_F(ValidatorTest, StringValidatorTest) {
     value.resize(value.length() - 1);
     EXPECT_TRUE(validator.validate(value));
 }
+
+class BatchValidatorTest : public ::testing::TestWithParam<size_t> {
+protected:
+    void SetUp() override {
+        // Every third document is invalid
+        for (size_t ii = 0; ii < 1000; ++ii) {
+            if (ii % 3 == 0) {
+                payload.push_back("{\"id\": " + std::to_string(ii) + "]");
+            } else {
+                payload.push_back("{\"id\": " + std::to_string(ii) +
+                                  ", \"list\": [[1, 2], [\"a\"]]}");
+            }
+        }
+        for (const auto& doc : payload) {
+            docs.push_back({reinterpret_cast<const uint8_t*>(doc.data()),
+                            doc.size()});
+        }
+    }
+
+    std::vector<std::string> payload;
+    std::vector<JSON_checker::Document> docs;
+};
+
+TEST_P(BatchValidatorTest, MixedDocuments) {
+    JSON_checker::BatchValidator validator(GetParam());
+    EXPECT_EQ(GetParam(), validator.getWorkers());
+
+    std::vector<uint64_t> result;
+    // Run multiple batches to verify that the pool may be reused
+    for (int batch = 0; batch < 5; ++batch) {
+        validator.validate(docs, result);
+        ASSERT_EQ((docs.size() + 63) / 64, result.size());
+        for (size_t ii = 0; ii < docs.size(); ++ii) {
+            EXPECT_EQ(ii % 3 != 0,
+                      JSON_checker::BatchValidator::isValid(result, ii))
+                << "Document " << ii;
+        }
+    }
+}
+
+TEST_P(BatchValidatorTest, EmptyBatch) {
+    JSON_checker::BatchValidator validator(GetParam());
+    std::vector<uint64_t> result;
+    validator.validate(nullptr, 0, result);
+    EXPECT_TRUE(result.empty());
+}
+
+INSTANTIATE_TEST_CASE_P(Workers, BatchValidatorTest,
+                        ::testing::Values(0, 1, 4));
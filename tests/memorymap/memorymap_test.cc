@@ -29,14 +29,16 @@
 #ifdef WIN32
 #include <process.h>
 #define getpid() _getpid()
+#else
+#include <sys/mman.h>
 #endif
 
 using namespace Couchbase;
 std::string filename;
 
-static std::vector<uint8_t> readFile(void) {
+static std::vector<uint8_t> readFile(const std::string& name = filename) {
     std::vector<uint8_t> ret;
-    FILE *fp = fopen(filename.c_str(), "rb");
+    FILE *fp = fopen(name.c_str(), "rb");
     cb_assert(fp != NULL);
     cb_assert(fseek(fp, 0, SEEK_END) == 0);
     ret.resize(ftell(fp));
@@ -107,6 +109,284 @@ static void testSharedMapping(void) {
     cb_assert(memcmp(before.data(), after.data(), before.size()) != 0);
 }
 
+static void testAdvice(void) {
+    std::vector<uint8_t> before = readFile();
+    MemoryMappedFile mymap(filename.c_str(), false, true);
+    try {
+        mymap.advise(MemoryMappedFile::Advice::WillNeed);
+        std::cerr << "ERROR: advise() should fail before open()" << std::endl;
+        exit(EXIT_FAILURE);
+    } catch (std::string err) {
+    }
+
+    mymap.setOpenAdvice(MemoryMappedFile::Advice::Sequential);
+    mymap.setPopulate(true);
+    try {
+        mymap.open();
+        // Unaligned ranges, ranges beyond the end of the mapping and
+        // empty ranges should all be accepted
+        mymap.advise(MemoryMappedFile::Advice::Normal);
+        mymap.advise(MemoryMappedFile::Advice::Random, 1, 10);
+        mymap.advise(MemoryMappedFile::Advice::WillNeed, 4097, 8000);
+        mymap.advise(MemoryMappedFile::Advice::Sequential, 100, 1 << 20);
+        mymap.advise(MemoryMappedFile::Advice::DontNeed, 1 << 20);
+        mymap.advise(MemoryMappedFile::Advice::Normal, 0, 0);
+        mymap.prefetchAsync().get();
+        mymap.prefetchAsync(5000, 3).get();
+        mymap.prefetchAsync(1 << 20).get();
+    } catch (std::string err) {
+        std::cerr << "ERROR: " << err << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    cb_assert(MemoryMappedFile::getPageSize() > 0);
+    cb_assert(memcmp(before.data(), mymap.getRoot(), mymap.getSize()) == 0);
+
+    // Dropping the pages of a read only mapping just means that they
+    // are read back in from the file
+    mymap.advise(MemoryMappedFile::Advice::DontNeed);
+    cb_assert(memcmp(before.data(), mymap.getRoot(), mymap.getSize()) == 0);
+}
+
+static void testPrivateDontNeed(void) {
+    MemoryMappedFile mymap(filename.c_str(), false, false);
+    try {
+        mymap.open();
+    } catch (std::string err) {
+        std::cerr << "ERROR: " << err << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::vector<uint8_t> block(mymap.getSize(), 0xaa);
+    memset(mymap.getRoot(), 0xaa, mymap.getSize());
+    // The private modifications must survive the advice
+    mymap.advise(MemoryMappedFile::Advice::DontNeed);
+    cb_assert(memcmp(block.data(), mymap.getRoot(), mymap.getSize()) == 0);
+}
+
+static void checkPageSize(const MemoryMappedFile& mymap) {
+    const size_t pageSize = mymap.getMappingPageSize();
+    cb_assert(pageSize == MemoryMappedFile::getPageSize() ||
+              pageSize == MemoryMappedFile::getHugePageSize());
+}
+
+static void testAnonymousMapping(MemoryMappedFile::HugePages mode) {
+    // Big enough to be backed by huge pages
+    const size_t size = 4 * 1024 * 1024 + 100;
+    MemoryMappedFile mymap(size);
+    mymap.setHugePages(mode);
+    mymap.setPopulate(true);
+    try {
+        mymap.open();
+    } catch (std::string err) {
+        std::cerr << "ERROR: " << err << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    cb_assert(mymap.getSize() == size);
+    if (mode == MemoryMappedFile::HugePages::None) {
+        cb_assert(mymap.getMappingPageSize() ==
+                  MemoryMappedFile::getPageSize());
+    } else {
+        checkPageSize(mymap);
+    }
+
+    std::vector<uint8_t> block(size, 0);
+    cb_assert(memcmp(block.data(), mymap.getRoot(), size) == 0);
+    memset(block.data(), 0xcb, size);
+    memset(mymap.getRoot(), 0xcb, size);
+    cb_assert(memcmp(block.data(), mymap.getRoot(), size) == 0);
+
+    // The mapping may be reopened (and starts out zero filled again)
+    mymap.close();
+    mymap.open();
+    cb_assert(mymap.getSize() == size);
+    cb_assert(static_cast<uint8_t*>(mymap.getRoot())[size - 1] == 0);
+}
+
+static void testHugePageFileMapping(void) {
+    std::vector<uint8_t> before = readFile();
+    MemoryMappedFile mymap(filename.c_str(), false, true);
+    mymap.setHugePages(MemoryMappedFile::HugePages::HugeTLB);
+    try {
+        mymap.open();
+    } catch (std::string err) {
+        std::cerr << "ERROR: " << err << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    checkPageSize(mymap);
+    cb_assert(memcmp(before.data(), mymap.getRoot(), mymap.getSize()) == 0);
+}
+
+static void testGrowableMapping(void) {
+    const std::string growname = filename + ".grow";
+    remove(growname.c_str());
+
+    MemoryMappedFile privatemap(filename.c_str(), false, false);
+    privatemap.setGrowable(1024 * 1024);
+    try {
+        privatemap.open();
+        std::cerr << "ERROR: private mappings can't grow" << std::endl;
+        exit(EXIT_FAILURE);
+    } catch (std::string err) {
+    }
+
+    const size_t chunk = 1000;
+    std::vector<uint8_t> expected;
+    {
+        MemoryMappedFile mymap(growname.c_str(), true, false);
+        mymap.setGrowable(1024 * 1024);
+        try {
+            // The file is created
+            mymap.open();
+            cb_assert(mymap.getSize() == 0);
+            auto* root = static_cast<uint8_t*>(mymap.getRoot());
+            for (size_t ii = 0; ii < 100; ++ii) {
+                mymap.grow(mymap.getSize() + chunk);
+                cb_assert(mymap.getRoot() == root);
+                cb_assert(mymap.getSize() == (ii + 1) * chunk);
+                memset(root + ii * chunk, int(ii), chunk);
+                expected.insert(expected.end(), chunk, uint8_t(ii));
+            }
+            // Shrinking is a no-op
+            mymap.grow(10);
+            cb_assert(mymap.getSize() == expected.size());
+        } catch (std::string err) {
+            std::cerr << "ERROR: " << err << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        try {
+            mymap.grow(1024 * 1024 + 1);
+            std::cerr << "ERROR: grow beyond the max size" << std::endl;
+            exit(EXIT_FAILURE);
+        } catch (std::string err) {
+        }
+    }
+
+    {
+        // Reopen the file and keep appending to it
+        MemoryMappedFile mymap(growname.c_str(), true, false);
+        mymap.setGrowable(1024 * 1024);
+        try {
+            mymap.open();
+            cb_assert(mymap.getSize() == expected.size());
+            cb_assert(memcmp(expected.data(), mymap.getRoot(),
+                             expected.size()) == 0);
+            mymap.grow(expected.size() + chunk);
+            memset(static_cast<uint8_t*>(mymap.getRoot()) + expected.size(),
+                   0xff, chunk);
+            expected.insert(expected.end(), chunk, 0xff);
+        } catch (std::string err) {
+            std::cerr << "ERROR: " << err << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    cb_assert(readFile(growname) == expected);
+    remove(growname.c_str());
+}
+
+static void testSync(void) {
+    MemoryMappedFile mymap(filename.c_str(), true, false);
+    try {
+        mymap.open();
+    } catch (std::string err) {
+        std::cerr << "ERROR: " << err << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const size_t page = MemoryMappedFile::getPageSize();
+    const size_t size = mymap.getSize();
+    auto* root = static_cast<uint8_t*>(mymap.getRoot());
+
+    // The dirty ranges are page aligned and merged
+    cb_assert(mymap.getDirtySize() == 0);
+    mymap.markDirty(1, 1);
+    cb_assert(mymap.getDirtySize() == page);
+    mymap.markDirty(0, page);
+    cb_assert(mymap.getDirtySize() == page);
+    mymap.markDirty(size - 1, 1);
+    const size_t lastPage = (size - 1) / page;
+    cb_assert(mymap.getDirtySize() == (lastPage == 0 ? page : 2 * page));
+    mymap.markDirty(1, SIZE_MAX);
+    cb_assert(mymap.getDirtySize() == (lastPage + 1) * page);
+    mymap.markDirty(size, 100);
+    cb_assert(mymap.getDirtySize() == (lastPage + 1) * page);
+
+    try {
+        mymap.flushDirty();
+        cb_assert(mymap.getDirtySize() == 0);
+
+        // The page cache is coherent with the mapping, so this only
+        // checks that sync accepts an unaligned range (whether the data
+        // reached the disk can't be observed from here)
+        root[10] = uint8_t(~root[10]);
+        mymap.sync(10, 1);
+        cb_assert(readFile()[10] == root[10]);
+
+        root[size - 1] = uint8_t(~root[size - 1]);
+        mymap.markDirty(size - 1, 1);
+        mymap.flushDirty(MemoryMappedFile::SyncMode::Async);
+        mymap.sync(0, SIZE_MAX, MemoryMappedFile::SyncMode::Async);
+        cb_assert(mymap.getDirtySize() == 0);
+    } catch (std::string err) {
+        std::cerr << "ERROR: " << err << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    // The mapping is coherent with the file
+    cb_assert(readFile()[size - 1] == root[size - 1]);
+
+#ifndef WIN32
+    // A failed flush keeps the range which failed and the ones after it
+    // dirty, so it may be retried. msync fails (ENOMEM) on the range of
+    // the mapping we unmap behind its back.
+    if (lastPage >= 2) {
+        mymap.markDirty(0, 1);
+        mymap.markDirty(2 * page, 1);
+        cb_assert(munmap(root, page) == 0);
+        bool failed = false;
+        try {
+            mymap.flushDirty();
+        } catch (std::string) {
+            failed = true;
+        }
+        cb_assert(failed);
+        cb_assert(mymap.getDirtySize() == 2 * page);
+    }
+#endif
+}
+
+static void testRangeMapping(void) {
+    std::vector<uint8_t> before = readFile();
+    const size_t granularity = MemoryMappedFile::getAllocationGranularity();
+    if (granularity >= before.size()) {
+        return;
+    }
+
+    MemoryMappedFile mymap(filename.c_str(), false, true);
+    mymap.setRange(granularity, 100);
+    try {
+        mymap.open();
+    } catch (std::string err) {
+        std::cerr << "ERROR: " << err << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    cb_assert(mymap.getSize() == 100);
+    cb_assert(memcmp(before.data() + granularity, mymap.getRoot(), 100) == 0);
+    mymap.close();
+
+    // Clipped to the end of the file
+    mymap.setRange(granularity, SIZE_MAX);
+    mymap.open();
+    cb_assert(mymap.getSize() == before.size() - granularity);
+    mymap.close();
+
+    mymap.setRange(1, 100);
+    try {
+        mymap.open();
+        std::cerr << "ERROR: the offset must be aligned" << std::endl;
+        exit(EXIT_FAILURE);
+    } catch (std::string err) {
+    }
+}
+
 static void createFile(void) {
     std::vector<uint8_t> buffer;
     buffer.resize(16 * 1024);
@@ -129,7 +409,16 @@ int main(void) {
     testReadonlyMapping();
 #ifndef WIN32
     testPrivateMapping();
+    testPrivateDontNeed();
+    testGrowableMapping();
 #endif
+    testAdvice();
+    testRangeMapping();
+    testSync();
+    testHugePageFileMapping();
+    testAnonymousMapping(MemoryMappedFile::HugePages::None);
+    testAnonymousMapping(MemoryMappedFile::HugePages::Transparent);
+    testAnonymousMapping(MemoryMappedFile::HugePages::HugeTLB);
     testSharedMapping();
     remove(filename.c_str());
     exit(EXIT_SUCCESS);
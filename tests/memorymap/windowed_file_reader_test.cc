@@ -0,0 +1,150 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include <gtest/gtest.h>
+#include <platform/memorymap.h>
+#include <platform/windowed_file_reader.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef WIN32
+#include <process.h>
+#define getpid() _getpid()
+#else
+#include <unistd.h>
+#endif
+
+class WindowedFileReaderTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::stringstream ss;
+        ss << "windowed_file_reader-" << getpid() << ".bin";
+        filename = ss.str();
+
+        // A few windows and a partial one at the end
+        window = Couchbase::MemoryMappedFile::getAllocationGranularity();
+        contents.resize(window * 5 + 123);
+        for (size_t ii = 0; ii < contents.size(); ++ii) {
+            contents[ii] = uint8_t(ii * 7 + ii / 251);
+        }
+        FILE* fp = fopen(filename.c_str(), "wb");
+        ASSERT_NE(nullptr, fp);
+        ASSERT_EQ(contents.size(),
+                  fwrite(contents.data(), 1, contents.size(), fp));
+        fclose(fp);
+    }
+
+    void TearDown() override {
+        remove(filename.c_str());
+    }
+
+    std::string filename;
+    size_t window;
+    std::vector<uint8_t> contents;
+};
+
+TEST_F(WindowedFileReaderTest, Iterate) {
+    Couchbase::WindowedFileReader reader(filename, window, 2);
+    EXPECT_EQ(contents.size(), reader.getFileSize());
+    EXPECT_EQ(window, reader.getWindowSize());
+
+    std::vector<uint8_t> copy;
+    size_t chunks = 0;
+    for (const auto& chunk : reader) {
+        EXPECT_EQ(copy.size(), chunk.offset);
+        EXPECT_LE(chunk.size, window);
+        copy.insert(copy.end(), chunk.data, chunk.data + chunk.size);
+        // The windows behind the cursor are dropped (only the current
+        // one and the one read ahead are mapped)
+        EXPECT_LE(reader.getMappedWindows(), 2u);
+        ++chunks;
+    }
+    EXPECT_EQ(6u, chunks);
+    EXPECT_EQ(contents, copy);
+    EXPECT_EQ(0u, reader.getMappedWindows());
+}
+
+TEST_F(WindowedFileReaderTest, MapIsLimitedToMaxWindows) {
+    Couchbase::WindowedFileReader reader(filename, window, 2);
+    for (uint64_t offset = 1; offset < contents.size(); offset += window) {
+        const auto chunk = reader.map(offset);
+        EXPECT_EQ(offset, chunk.offset);
+        EXPECT_EQ(contents[offset], chunk.data[0]);
+        // The chunk ends at the end of the window (or the file)
+        EXPECT_EQ(std::min(window - 1, contents.size() - offset),
+                  chunk.size);
+        EXPECT_LE(reader.getMappedWindows(), 2u);
+    }
+    EXPECT_EQ(2u, reader.getMappedWindows());
+
+    EXPECT_THROW(reader.map(contents.size()), std::string);
+}
+
+TEST_F(WindowedFileReaderTest, IterateKeepsMappedWindows) {
+    Couchbase::WindowedFileReader reader(filename, window, 4);
+    const auto chunk = reader.map(window + 10);
+
+    size_t chunks = 0;
+    for (const auto& c : reader) {
+        (void)c;
+        ++chunks;
+    }
+    EXPECT_EQ(6u, chunks);
+
+    // The iterator didn't unmap the window map() handed out
+    EXPECT_EQ(1u, reader.getMappedWindows());
+    EXPECT_TRUE(std::equal(chunk.data, chunk.data + chunk.size,
+                           contents.begin() + window + 10));
+}
+
+TEST_F(WindowedFileReaderTest, ReadAcrossWindows) {
+    Couchbase::WindowedFileReader reader(filename, window, 1);
+    std::vector<uint8_t> buffer(window * 2 + 10);
+    const uint64_t offset = window - 5;
+    ASSERT_EQ(buffer.size(), reader.read(offset, buffer.data(),
+                                         buffer.size()));
+    EXPECT_TRUE(std::equal(buffer.begin(), buffer.end(),
+                           contents.begin() + offset));
+
+    // Short read at the end of the file
+    EXPECT_EQ(23u, reader.read(contents.size() - 23, buffer.data(),
+                               buffer.size()));
+    EXPECT_EQ(0u, reader.read(contents.size(), buffer.data(), 10));
+}
+
+TEST_F(WindowedFileReaderTest, WindowSizeIsRounded) {
+    Couchbase::WindowedFileReader reader(filename, window + 1);
+    EXPECT_EQ(window * 2, reader.getWindowSize());
+}
+
+TEST_F(WindowedFileReaderTest, EmptyFile) {
+    FILE* fp = fopen(filename.c_str(), "wb");
+    ASSERT_NE(nullptr, fp);
+    fclose(fp);
+
+    Couchbase::WindowedFileReader reader(filename);
+    EXPECT_EQ(0u, reader.getFileSize());
+    EXPECT_TRUE(reader.begin() == reader.end());
+}
+
+TEST_F(WindowedFileReaderTest, MissingFile) {
+    EXPECT_THROW(Couchbase::WindowedFileReader reader(filename + ".missing"),
+                 std::string);
+}
@@ -0,0 +1,305 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include <cJSON_utils.h>
+#include <gtest/gtest.h>
+#include <platform/adaptive_mutex.h>
+#include <platform/futex.h>
+#include <platform/lock_profiler.h>
+#include <platform/readmostly_rwlock.h>
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+TEST(FutexTest, WaitTimesOut) {
+    std::atomic<uint32_t> word(0);
+    EXPECT_FALSE(Couchbase::futexWait(word, 0, 1000000));
+}
+
+TEST(FutexTest, WaitReturnsOnValueMismatch) {
+    std::atomic<uint32_t> word(1);
+    EXPECT_TRUE(Couchbase::futexWait(word, 0));
+}
+
+TEST(FutexTest, Wake) {
+    std::atomic<uint32_t> word(0);
+    std::thread waiter([&word]() {
+        while (word.load() == 0) {
+            Couchbase::futexWait(word, 0);
+        }
+    });
+    word.store(1);
+    Couchbase::futexWakeAll(word);
+    waiter.join();
+}
+
+TEST(AdaptiveMutexTest, TryLock) {
+    Couchbase::AdaptiveMutex mutex;
+    EXPECT_TRUE(mutex.try_lock());
+    EXPECT_FALSE(mutex.try_lock());
+    mutex.unlock();
+    EXPECT_TRUE(mutex.try_lock());
+    mutex.unlock();
+}
+
+TEST(AdaptiveMutexTest, Contended) {
+    Couchbase::AdaptiveMutex mutex;
+    uint64_t counter = 0;
+    const int iterations = 100000;
+
+    std::vector<std::thread> threads;
+    for (int ii = 0; ii < 4; ++ii) {
+        threads.emplace_back([&mutex, &counter]() {
+            for (int jj = 0; jj < iterations; ++jj) {
+                std::lock_guard<Couchbase::AdaptiveMutex> guard(mutex);
+                ++counter;
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    EXPECT_EQ(4 * iterations, counter);
+}
+
+TEST(AdaptiveMutexTest, CInterface) {
+    cb_adaptive_mutex_t mutex;
+    cb_adaptive_mutex_initialize(&mutex);
+    cb_adaptive_mutex_enter(&mutex);
+    EXPECT_EQ(-1, cb_adaptive_mutex_try_enter(&mutex));
+    cb_adaptive_mutex_exit(&mutex);
+    EXPECT_EQ(0, cb_adaptive_mutex_try_enter(&mutex));
+    cb_adaptive_mutex_exit(&mutex);
+    cb_adaptive_mutex_destroy(&mutex);
+}
+
+TEST(ReadMostlyRWLockTest, TryLock) {
+    Couchbase::ReadMostlyRWLock lock;
+    EXPECT_TRUE(lock.try_lock_shared());
+    EXPECT_TRUE(lock.try_lock_shared());
+    EXPECT_FALSE(lock.try_lock());
+    lock.unlock_shared();
+    lock.unlock_shared();
+
+    EXPECT_TRUE(lock.try_lock());
+    EXPECT_FALSE(lock.try_lock_shared());
+    EXPECT_FALSE(lock.try_lock());
+    lock.unlock();
+    EXPECT_TRUE(lock.try_lock_shared());
+    lock.unlock_shared();
+}
+
+TEST(ReadMostlyRWLockTest, ReadersAndWriters) {
+    Couchbase::ReadMostlyRWLock lock;
+    // The writers keep the two values equal, the readers verify it
+    uint64_t first = 0;
+    uint64_t second = 0;
+    std::atomic<bool> mismatch(false);
+    const int iterations = 20000;
+
+    std::vector<std::thread> threads;
+    for (int ii = 0; ii < 4; ++ii) {
+        threads.emplace_back([&]() {
+            for (int jj = 0; jj < iterations; ++jj) {
+                lock.lock_shared();
+                if (first != second) {
+                    mismatch.store(true);
+                }
+                lock.unlock_shared();
+            }
+        });
+    }
+    for (int ii = 0; ii < 2; ++ii) {
+        threads.emplace_back([&]() {
+            for (int jj = 0; jj < iterations / 10; ++jj) {
+                std::lock_guard<Couchbase::ReadMostlyRWLock> guard(lock);
+                ++first;
+                ++second;
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    EXPECT_FALSE(mismatch.load());
+    EXPECT_EQ(2 * (iterations / 10), first);
+    EXPECT_EQ(first, second);
+}
+
+TEST(ReadMostlyRWLockTest, CInterface) {
+    cb_rm_rwlock_t rw;
+    cb_rm_rw_lock_initialize(&rw);
+    EXPECT_EQ(0, cb_rm_rw_reader_enter(&rw));
+    EXPECT_EQ(0, cb_rm_rw_reader_exit(&rw));
+    EXPECT_EQ(0, cb_rm_rw_writer_enter(&rw));
+    EXPECT_EQ(0, cb_rm_rw_writer_exit(&rw));
+    cb_rm_rw_lock_destroy(&rw);
+}
+
+TEST(LockProfilerTest, RecordsContention) {
+    cb_mutex_t mutex;
+    cb_mutex_initialize(&mutex);
+    Couchbase::LockProfiler::setName(&mutex, "test \"mutex\"");
+    Couchbase::LockProfiler::setBacktraceSampleRate(1);
+    Couchbase::LockProfiler::enable();
+    EXPECT_TRUE(Couchbase::LockProfiler::isEnabled());
+
+    // Hold the lock while another thread tries to get it
+    cb_mutex_enter(&mutex);
+    std::atomic<bool> started(false);
+    std::thread waiter([&mutex, &started]() {
+        started.store(true);
+        cb_mutex_enter(&mutex);
+        cb_mutex_exit(&mutex);
+    });
+    while (!started.load()) {
+        std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    cb_mutex_exit(&mutex);
+    waiter.join();
+
+    Couchbase::LockProfiler::disable();
+    EXPECT_FALSE(Couchbase::LockProfiler::isEnabled());
+
+    unique_cJSON_ptr json(cJSON_Parse(
+        Couchbase::LockProfiler::toJSON().c_str()));
+    ASSERT_TRUE(json);
+    auto* locks = cJSON_GetObjectItem(json.get(), "locks");
+    ASSERT_NE(nullptr, locks);
+
+    cJSON* entry = nullptr;
+    for (int ii = 0; ii < cJSON_GetArraySize(locks); ++ii) {
+        auto* item = cJSON_GetArrayItem(locks, ii);
+        auto* name = cJSON_GetObjectItem(item, "name");
+        if (name != nullptr && std::string("test \"mutex\"") ==
+                                   name->valuestring) {
+            entry = item;
+        }
+    }
+    ASSERT_NE(nullptr, entry);
+    EXPECT_STREQ("mutex", cJSON_GetObjectItem(entry, "type")->valuestring);
+    EXPECT_EQ(2, cJSON_GetObjectItem(entry, "acquisitions")->valueint);
+    EXPECT_EQ(1, cJSON_GetObjectItem(entry, "contended")->valueint);
+    auto* hold = cJSON_GetObjectItem(entry, "hold_usec");
+    EXPECT_LE(10000, cJSON_GetObjectItem(hold, "max")->valueint);
+
+    Couchbase::LockProfiler::reset();
+    cb_mutex_destroy(&mutex);
+}
+
+TEST(LockProfilerTest, NothingRecordedWhenDisabled) {
+    cb_rwlock_t rw;
+    cb_rw_lock_initialize(&rw);
+    cb_rw_reader_enter(&rw);
+    cb_rw_reader_exit(&rw);
+    cb_rw_lock_destroy(&rw);
+
+    char address[32];
+    snprintf(address, sizeof(address), "%p", static_cast<void*>(&rw));
+    EXPECT_EQ(std::string::npos,
+              Couchbase::LockProfiler::toJSON().find(address));
+}
+
+TEST(LockProfilerTest, DestroyWhileDisabledDropsStats) {
+    // A lock destroyed after profiling was disabled must not leave its
+    // statistics (or name) behind for the next lock at the same address
+    cb_mutex_t mutex;
+    cb_mutex_initialize(&mutex);
+    Couchbase::LockProfiler::setName(&mutex, "stale mutex");
+    Couchbase::LockProfiler::enable();
+    cb_mutex_enter(&mutex);
+    cb_mutex_exit(&mutex);
+    Couchbase::LockProfiler::disable();
+    cb_mutex_destroy(&mutex);
+
+    char address[32];
+    snprintf(address, sizeof(address), "%p", static_cast<void*>(&mutex));
+    const auto json = Couchbase::LockProfiler::toJSON();
+    EXPECT_EQ(std::string::npos, json.find("stale mutex"));
+    EXPECT_EQ(std::string::npos, json.find(address));
+}
+
+TEST(CondTest, TimedWaitNsTimesOut) {
+    cb_mutex_t mutex;
+    cb_cond_t cond;
+    cb_mutex_initialize(&mutex);
+    cb_cond_initialize(&cond);
+
+    cb_mutex_enter(&mutex);
+    const uint64_t start = cb_get_monotonic_ns();
+    // Spurious wakeups are allowed, so loop until we time out
+    while (cb_cond_timedwait_ns(&cond, &mutex, 500000) == 0) {
+    }
+    EXPECT_LE(500000u, cb_get_monotonic_ns() - start);
+    cb_mutex_exit(&mutex);
+
+    cb_cond_destroy(&cond);
+    cb_mutex_destroy(&mutex);
+}
+
+TEST(CondTest, WaitUntil) {
+    cb_mutex_t mutex;
+    cb_cond_t cond;
+    cb_mutex_initialize(&mutex);
+    cb_cond_initialize(&cond);
+
+    cb_mutex_enter(&mutex);
+    const uint64_t deadline = cb_get_monotonic_ns() + 2000000;
+    while (cb_cond_wait_until(&cond, &mutex, deadline) == 0) {
+    }
+    EXPECT_LE(deadline, cb_get_monotonic_ns());
+
+    // A deadline in the past returns right away
+    EXPECT_EQ(-1, cb_cond_wait_until(&cond, &mutex, 0));
+    cb_mutex_exit(&mutex);
+
+    cb_cond_destroy(&cond);
+    cb_mutex_destroy(&mutex);
+}
+
+TEST(CondTest, SignalBeforeDeadline) {
+    cb_mutex_t mutex;
+    cb_cond_t cond;
+    cb_mutex_initialize(&mutex);
+    cb_cond_initialize(&cond);
+    bool ready = false;
+
+    std::thread signaller([&]() {
+        cb_mutex_enter(&mutex);
+        ready = true;
+        cb_cond_signal(&cond);
+        cb_mutex_exit(&mutex);
+    });
+
+    cb_mutex_enter(&mutex);
+    const uint64_t deadline = cb_get_monotonic_ns() + 10000000000ULL;
+    int ret = 0;
+    while (!ready && ret == 0) {
+        ret = cb_cond_wait_until(&cond, &mutex, deadline);
+    }
+    cb_mutex_exit(&mutex);
+    signaller.join();
+    // Checked after the join so a failure doesn't terminate the test
+    EXPECT_EQ(0, ret);
+    EXPECT_TRUE(ready);
+
+    cb_cond_destroy(&cond);
+    cb_mutex_destroy(&mutex);
+}
@@ -0,0 +1,186 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// Benchmark the queues handing elements between threads:
+//
+//   * throughput with 1..N producers and consumers, compared to a
+//     std::deque protected by a cb_mutex_t / cb_cond_t
+//   * round trip latency (ping-pong between two threads)
+//
+
+#include <platform/blocking_queue.h>
+#include <platform/mpmc_queue.h>
+#include <platform/platform.h>
+#include <platform/spsc_queue.h>
+
+#include <algorithm>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * The mutex and condition variable queue we want to replace, with the
+ * same interface as BlockingQueue
+ */
+class LockedQueue {
+public:
+    explicit LockedQueue(size_t capacity)
+        : capacity(capacity) {
+        cb_mutex_initialize(&mutex);
+        cb_cond_initialize(&notEmpty);
+        cb_cond_initialize(&notFull);
+    }
+
+    ~LockedQueue() {
+        cb_cond_destroy(&notFull);
+        cb_cond_destroy(&notEmpty);
+        cb_mutex_destroy(&mutex);
+    }
+
+    void push(uint64_t element) {
+        cb_mutex_enter(&mutex);
+        while (queue.size() == capacity) {
+            cb_cond_wait(&notFull, &mutex);
+        }
+        queue.push_back(element);
+        cb_cond_signal(&notEmpty);
+        cb_mutex_exit(&mutex);
+    }
+
+    void pop(uint64_t& element) {
+        cb_mutex_enter(&mutex);
+        while (queue.empty()) {
+            cb_cond_wait(&notEmpty, &mutex);
+        }
+        element = queue.front();
+        queue.pop_front();
+        cb_cond_signal(&notFull);
+        cb_mutex_exit(&mutex);
+    }
+
+private:
+    const size_t capacity;
+    std::deque<uint64_t> queue;
+    cb_mutex_t mutex;
+    cb_cond_t notEmpty;
+    cb_cond_t notFull;
+};
+
+typedef Couchbase::BlockingQueue<Couchbase::MPMCQueue<uint64_t>> MPMC;
+typedef Couchbase::BlockingQueue<Couchbase::SPSCQueue<uint64_t>> SPSC;
+
+static const size_t Capacity = 1024;
+
+template <typename Queue>
+static void throughput(const std::string& name, int producers,
+                       int consumers) {
+    const uint64_t total = 2000000;
+    Queue queue(Capacity);
+    std::vector<std::thread> threads;
+
+    const hrtime_t start = gethrtime();
+    for (int ii = 0; ii < producers; ++ii) {
+        threads.emplace_back([&queue, producers]() {
+            for (uint64_t jj = 0; jj < total / producers; ++jj) {
+                queue.push(jj);
+            }
+        });
+    }
+    for (int ii = 0; ii < consumers; ++ii) {
+        threads.emplace_back([&queue, consumers]() {
+            uint64_t value;
+            for (uint64_t jj = 0; jj < total / consumers; ++jj) {
+                queue.pop(value);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    const hrtime_t duration = gethrtime() - start;
+
+    std::cout << std::setw(10) << name << std::setw(11) << producers
+              << std::setw(11) << consumers << std::setw(16) << std::fixed
+              << std::setprecision(0) << total / (double(duration) / 1e9)
+              << std::endl;
+}
+
+template <typename Queue>
+static void latency(const std::string& name) {
+    const int rounds = 100000;
+    Queue ping(Capacity);
+    Queue pong(Capacity);
+    std::vector<hrtime_t> samples;
+    samples.reserve(rounds);
+
+    std::thread echo([&ping, &pong]() {
+        uint64_t value;
+        for (int ii = 0; ii < rounds; ++ii) {
+            ping.pop(value);
+            pong.push(value);
+        }
+    });
+
+    uint64_t value;
+    for (int ii = 0; ii < rounds; ++ii) {
+        const hrtime_t start = gethrtime();
+        ping.push(ii);
+        pong.pop(value);
+        samples.push_back(gethrtime() - start);
+    }
+    echo.join();
+    std::sort(samples.begin(), samples.end());
+
+    std::cout << std::setw(10) << name
+              << std::setw(12) << samples[rounds / 2]
+              << std::setw(12) << samples[rounds * 99 / 100]
+              << std::setw(12) << samples[rounds * 999 / 1000]
+              << std::setw(12) << samples.back() << std::endl;
+}
+
+int main() {
+    std::vector<int> threads = {1, 2, 4};
+    const int cores = int(std::thread::hardware_concurrency());
+    for (int ii = 8; ii <= cores; ii *= 2) {
+        threads.push_back(ii);
+    }
+
+    std::cout << "Throughput" << std::endl;
+    std::cout << std::setw(10) << "Queue" << std::setw(11) << "Producers"
+              << std::setw(11) << "Consumers" << std::setw(16) << "Elements/s"
+              << std::endl;
+    throughput<SPSC>("spsc", 1, 1);
+    for (auto producers : threads) {
+        for (auto consumers : threads) {
+            throughput<MPMC>("mpmc", producers, consumers);
+            throughput<LockedQueue>("locked", producers, consumers);
+        }
+    }
+
+    std::cout << std::endl << "Round trip latency (ns)" << std::endl;
+    std::cout << std::setw(10) << "Queue" << std::setw(12) << "p50"
+              << std::setw(12) << "p99" << std::setw(12) << "p99.9"
+              << std::setw(12) << "max" << std::endl;
+    latency<SPSC>("spsc");
+    latency<MPMC>("mpmc");
+    latency<LockedQueue>("locked");
+    return 0;
+}
@@ -0,0 +1,140 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include <gtest/gtest.h>
+#include <platform/blocking_queue.h>
+#include <platform/mpmc_queue.h>
+#include <platform/spsc_queue.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+template <typename Queue>
+class QueueTest : public ::testing::Test {
+};
+
+typedef ::testing::Types<Couchbase::MPMCQueue<int>,
+                         Couchbase::SPSCQueue<int>> QueueTypes;
+TYPED_TEST_CASE(QueueTest, QueueTypes);
+
+TYPED_TEST(QueueTest, Fifo) {
+    TypeParam queue(4);
+    EXPECT_EQ(4u, queue.capacity());
+    EXPECT_TRUE(queue.empty());
+
+    int value;
+    EXPECT_FALSE(queue.tryPop(value));
+    for (int ii = 0; ii < 4; ++ii) {
+        EXPECT_TRUE(queue.tryPush(ii));
+    }
+    EXPECT_FALSE(queue.tryPush(4));
+    EXPECT_EQ(4u, queue.sizeGuess());
+
+    for (int ii = 0; ii < 4; ++ii) {
+        ASSERT_TRUE(queue.tryPop(value));
+        EXPECT_EQ(ii, value);
+    }
+    EXPECT_FALSE(queue.tryPop(value));
+    EXPECT_TRUE(queue.empty());
+}
+
+TYPED_TEST(QueueTest, Wraparound) {
+    TypeParam queue(4);
+    int value;
+    for (int ii = 0; ii < 100; ++ii) {
+        EXPECT_TRUE(queue.tryPush(ii));
+        EXPECT_TRUE(queue.tryPush(ii + 1000));
+        ASSERT_TRUE(queue.tryPop(value));
+        EXPECT_EQ(ii, value);
+        ASSERT_TRUE(queue.tryPop(value));
+        EXPECT_EQ(ii + 1000, value);
+    }
+}
+
+TYPED_TEST(QueueTest, ProducerConsumer) {
+    Couchbase::BlockingQueue<TypeParam> queue(16);
+    const int count = 100000;
+
+    std::thread producer([&queue]() {
+        for (int ii = 0; ii < count; ++ii) {
+            queue.push(ii);
+        }
+    });
+
+    // The single consumer sees the elements in order
+    for (int ii = 0; ii < count; ++ii) {
+        int value;
+        queue.pop(value);
+        ASSERT_EQ(ii, value);
+    }
+    producer.join();
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(MPMCQueueTest, MoveOnly) {
+    Couchbase::MPMCQueue<std::unique_ptr<int>> queue(2);
+    std::unique_ptr<int> element(new int(42));
+    EXPECT_TRUE(queue.tryPush(std::move(element)));
+    EXPECT_FALSE(element);
+
+    // A failing push doesn't move from the element
+    EXPECT_TRUE(queue.tryPush(std::unique_ptr<int>(new int(1))));
+    element.reset(new int(2));
+    EXPECT_FALSE(queue.tryPush(std::move(element)));
+    EXPECT_TRUE(element);
+
+    std::unique_ptr<int> value;
+    ASSERT_TRUE(queue.tryPop(value));
+    EXPECT_EQ(42, *value);
+}
+
+TEST(MPMCQueueTest, MultipleProducersAndConsumers) {
+    Couchbase::BlockingQueue<Couchbase::MPMCQueue<uint64_t>> queue(64);
+    const int producers = 4;
+    const int consumers = 4;
+    const uint64_t count = 50000;
+
+    std::vector<std::thread> threads;
+    for (int ii = 0; ii < producers; ++ii) {
+        threads.emplace_back([&queue]() {
+            for (uint64_t jj = 1; jj <= count; ++jj) {
+                queue.push(jj);
+            }
+        });
+    }
+
+    std::vector<uint64_t> sums(consumers);
+    for (int ii = 0; ii < consumers; ++ii) {
+        threads.emplace_back([&queue, &sums, ii]() {
+            for (uint64_t jj = 0; jj < count * producers / consumers; ++jj) {
+                uint64_t value;
+                queue.pop(value);
+                sums[ii] += value;
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    uint64_t total = 0;
+    for (auto sum : sums) {
+        total += sum;
+    }
+    EXPECT_EQ(producers * (count * (count + 1) / 2), total);
+    EXPECT_TRUE(queue.empty());
+}
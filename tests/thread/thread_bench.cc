@@ -0,0 +1,109 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// Benchmark the latency of starting a Couchbase::Thread:
+//
+//   * spawn to run: from the call to start() until the run() method is
+//     entered
+//   * start: until start() returns (the run() method called setRunning)
+//   * total: start, run and reap an empty thread
+//
+// with and without the thread cache, and with startAsync().
+//
+
+#include <platform/platform.h>
+#include <platform/thread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+class EmptyThread : public Couchbase::Thread {
+public:
+    EmptyThread()
+        : Couchbase::Thread("bench"),
+          entered(0) {
+    }
+
+    ~EmptyThread() {
+        joinFor(std::chrono::nanoseconds::max());
+    }
+
+    std::atomic<hrtime_t> entered;
+
+protected:
+    void run() override {
+        entered = gethrtime();
+        setRunning();
+    }
+};
+
+static void report(const std::string& name, std::vector<hrtime_t>& samples) {
+    std::sort(samples.begin(), samples.end());
+    const size_t n = samples.size();
+    std::cout << std::setw(26) << name
+              << std::setw(12) << samples[n / 2]
+              << std::setw(12) << samples[n * 99 / 100]
+              << std::setw(12) << samples.back() << std::endl;
+}
+
+static void measure(const std::string& name, bool async) {
+    const int rounds = 5000;
+    std::vector<hrtime_t> spawn;
+    std::vector<hrtime_t> started;
+    std::vector<hrtime_t> total;
+    spawn.reserve(rounds);
+    started.reserve(rounds);
+    total.reserve(rounds);
+
+    for (int ii = 0; ii < rounds; ++ii) {
+        EmptyThread thread;
+        const hrtime_t start = gethrtime();
+        if (async) {
+            thread.startAsync();
+        } else {
+            thread.start();
+        }
+        started.push_back(gethrtime() - start);
+        thread.joinFor(std::chrono::nanoseconds::max());
+        total.push_back(gethrtime() - start);
+        spawn.push_back(thread.entered - start);
+    }
+
+    report(name + " spawn to run", spawn);
+    report(name + " start", started);
+    report(name + " total", total);
+}
+
+int main() {
+    std::cout << std::setw(26) << "Latency (ns)" << std::setw(12) << "p50"
+              << std::setw(12) << "p99" << std::setw(12) << "max"
+              << std::endl;
+    measure("new", false);
+    measure("new async", true);
+
+    Couchbase::Thread::setThreadCacheSize(4);
+    measure("cached", false);
+    measure("cached async", true);
+    Couchbase::Thread::setThreadCacheSize(0);
+    return 0;
+}
@@ -16,7 +16,15 @@
  */
 #include <gtest/gtest.h>
 #include <platform/thread.h>
+#include <platform/thread_local.h>
+#include <platform/thread_registry.h>
+
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
 
 class TestThread : public Couchbase::Thread {
 public:
@@ -74,3 +82,500 @@ TEST(ThreadnameTest, ThreadName) {
     EXPECT_EQ(0, cb_get_thread_name(buffer, sizeof(buffer)));
     EXPECT_EQ(std::string("test"), std::string(buffer));
 }
+
+TEST(ThreadTopologyTest, Topology) {
+    const int cpus = cb_get_num_cpus();
+    EXPECT_LT(0, cpus);
+    const int nodes = cb_get_num_numa_nodes();
+    EXPECT_LT(0, nodes);
+
+    // Every online CPU belongs to a node
+    cb_cpuset_t all;
+    cb_cpuset_zero(&all);
+    for (int node = 0; node < nodes; ++node) {
+        cb_cpuset_t set;
+        if (cb_get_numa_node_cpus(node, &set) == 0) {
+            // Nodes without CPUs are reported as errors
+            EXPECT_LT(0, cb_cpuset_count(&set));
+            for (int ii = 0; ii < CB_MAX_CPUS / 64; ++ii) {
+                all.bits[ii] |= set.bits[ii];
+            }
+        }
+    }
+    EXPECT_LE(cpus, cb_cpuset_count(&all));
+    EXPECT_EQ(-1, cb_get_numa_node_cpus(nodes, &all));
+}
+
+TEST(ThreadTopologyTest, CpuSet) {
+    cb_cpuset_t set;
+    cb_cpuset_zero(&set);
+    EXPECT_EQ(0, cb_cpuset_count(&set));
+    EXPECT_EQ(0, cb_cpuset_set(&set, 0));
+    EXPECT_EQ(0, cb_cpuset_set(&set, 65));
+    EXPECT_EQ(-1, cb_cpuset_set(&set, CB_MAX_CPUS));
+    EXPECT_TRUE(cb_cpuset_isset(&set, 0));
+    EXPECT_TRUE(cb_cpuset_isset(&set, 65));
+    EXPECT_FALSE(cb_cpuset_isset(&set, 1));
+    EXPECT_EQ(2, cb_cpuset_count(&set));
+}
+
+class AffinityThread : public Couchbase::Thread {
+public:
+    AffinityThread(const cb_thread_options_t& options)
+        : Couchbase::Thread("affinity", options) {
+        cb_cpuset_zero(&affinity);
+    }
+
+    ~AffinityThread() {
+        waitForState(Couchbase::ThreadState::Zombie);
+    }
+
+    cb_cpuset_t affinity;
+    int rv = -1;
+
+protected:
+    virtual void run() override {
+        rv = cb_get_thread_affinity(&affinity);
+        setRunning();
+    }
+};
+
+TEST(ThreadTopologyTest, ThreadAffinity) {
+    cb_cpuset_t current;
+    if (cb_get_thread_affinity(&current) != 0) {
+        // Not supported on this platform
+        return;
+    }
+
+    // Pin the thread to the first CPU we're allowed to run on
+    int cpu = 0;
+    while (!cb_cpuset_isset(&current, cpu)) {
+        ++cpu;
+    }
+
+    cb_thread_options_t options;
+    cb_thread_options_initialize(&options);
+    options.stack_size = 256 * 1024;
+    cb_cpuset_set(&options.affinity, cpu);
+
+    AffinityThread thread(options);
+    thread.start();
+    EXPECT_EQ(Couchbase::ThreadState::Zombie,
+              thread.waitForState(Couchbase::ThreadState::Zombie));
+    EXPECT_EQ(0, thread.rv);
+    EXPECT_EQ(1, cb_cpuset_count(&thread.affinity));
+    EXPECT_TRUE(cb_cpuset_isset(&thread.affinity, cpu));
+}
+
+TEST(ThreadTopologyTest, InvalidNumaNode) {
+    cb_thread_options_t options;
+    cb_thread_options_initialize(&options);
+    options.numa_node = cb_get_num_numa_nodes();
+
+    AffinityThread thread(options);
+    EXPECT_THROW(thread.start(), std::bad_alloc);
+    EXPECT_EQ(Couchbase::ThreadState::Stopped, thread.getState());
+}
+
+class IdleThread : public Couchbase::Thread {
+public:
+    IdleThread(std::chrono::nanoseconds interval_)
+        : Couchbase::Thread("idle"),
+          interval(interval_),
+          wakeups(0) {
+    }
+
+    const std::chrono::nanoseconds interval;
+    std::atomic<int> wakeups;
+
+protected:
+    void run() override {
+        setRunning();
+        while (!waitForStop(interval)) {
+            ++wakeups;
+        }
+    }
+};
+
+TEST(ThreadStopTest, RequestStop) {
+    IdleThread worker(std::chrono::nanoseconds::max());
+    worker.start();
+    EXPECT_FALSE(worker.isStopRequested());
+    EXPECT_FALSE(worker.joinFor(std::chrono::milliseconds(10)));
+    EXPECT_EQ(Couchbase::ThreadState::Running, worker.getState());
+
+    worker.requestStop();
+    EXPECT_TRUE(worker.isStopRequested());
+    EXPECT_TRUE(worker.joinFor(std::chrono::seconds(30)));
+    EXPECT_EQ(Couchbase::ThreadState::Stopped, worker.getState());
+    EXPECT_EQ(0, worker.wakeups.load());
+
+    // The thread may be restarted, which resets the stop token
+    worker.start();
+    EXPECT_FALSE(worker.isStopRequested());
+    worker.requestStop();
+    EXPECT_TRUE(worker.joinFor(std::chrono::nanoseconds::max()));
+}
+
+TEST(ThreadStopTest, WaitForStopTimeout) {
+    IdleThread worker(std::chrono::milliseconds(1));
+    worker.start();
+    while (worker.wakeups.load() < 3) {
+        std::this_thread::yield();
+    }
+    worker.requestStop();
+    EXPECT_TRUE(worker.joinFor(std::chrono::seconds(30)));
+}
+
+TEST(ThreadStopTest, JoinNotStarted) {
+    IdleThread worker(std::chrono::nanoseconds::max());
+    EXPECT_TRUE(worker.joinFor(std::chrono::nanoseconds(0)));
+}
+
+TEST(ThreadStopTest, StopMany) {
+    std::vector<std::unique_ptr<IdleThread>> workers;
+    for (int ii = 0; ii < 16; ++ii) {
+        workers.emplace_back(new IdleThread(std::chrono::nanoseconds::max()));
+        workers.back()->start();
+    }
+    for (auto& worker : workers) {
+        worker->requestStop();
+    }
+    for (auto& worker : workers) {
+        EXPECT_TRUE(worker->joinFor(std::chrono::seconds(30)));
+    }
+}
+
+/**
+ * Counts the number of runs on the underlying thread (thread_local
+ * variables aren't reset when a cached thread is reused)
+ */
+class CountingThread : public Couchbase::Thread {
+public:
+    CountingThread()
+        : Couchbase::Thread("counting"),
+          runs(0) {
+    }
+
+    CountingThread(const std::string& name)
+        : Couchbase::Thread(name),
+          runs(0) {
+    }
+
+    CountingThread(const cb_thread_options_t& options)
+        : Couchbase::Thread("counting", options),
+          runs(0) {
+    }
+
+    ~CountingThread() {
+        waitForState(Couchbase::ThreadState::Zombie);
+    }
+
+    int runs;
+
+protected:
+    void run() override {
+        static thread_local int counter = 0;
+        runs = ++counter;
+        setRunning();
+    }
+};
+
+TEST(ThreadCacheTest, StartAsync) {
+    IdleThread worker(std::chrono::nanoseconds::max());
+    worker.startAsync();
+    EXPECT_EQ(Couchbase::ThreadState::Running,
+              worker.waitForState(Couchbase::ThreadState::Running));
+    worker.requestStop();
+    EXPECT_TRUE(worker.joinFor(std::chrono::seconds(30)));
+}
+
+TEST(ThreadCacheTest, ReuseThread) {
+    Couchbase::Thread::setThreadCacheSize(1);
+
+    // The thread is put back in the cache after the Thread object is
+    // released, so the next start may race with it and create a new one
+    int maxRuns = 0;
+    for (int ii = 0; ii < 100; ++ii) {
+        CountingThread worker;
+        worker.start();
+        EXPECT_TRUE(worker.joinFor(std::chrono::seconds(30)));
+        maxRuns = std::max(maxRuns, worker.runs);
+    }
+    EXPECT_LT(1, maxRuns);
+
+    // Threads with explicit options never use the cache
+    cb_thread_options_t options;
+    cb_thread_options_initialize(&options);
+    for (int ii = 0; ii < 10; ++ii) {
+        CountingThread worker(options);
+        worker.start();
+        EXPECT_TRUE(worker.joinFor(std::chrono::seconds(30)));
+        EXPECT_EQ(1, worker.runs);
+    }
+
+    Couchbase::Thread::setThreadCacheSize(0);
+
+    // The thread may be restarted on a cached thread as well
+    Couchbase::Thread::setThreadCacheSize(2);
+    IdleThread worker(std::chrono::nanoseconds::max());
+    for (int ii = 0; ii < 10; ++ii) {
+        worker.start();
+        worker.requestStop();
+        EXPECT_TRUE(worker.joinFor(std::chrono::seconds(30)));
+    }
+    Couchbase::Thread::setThreadCacheSize(0);
+}
+
+TEST(ThreadCacheTest, LongName) {
+    // Names longer than the 15 characters allowed by
+    // cb_create_named_thread must work with the cache as well
+    Couchbase::Thread::setThreadCacheSize(1);
+    for (int ii = 0; ii < 2; ++ii) {
+        CountingThread worker("a thread with a long name");
+        EXPECT_NO_THROW(worker.start());
+        EXPECT_TRUE(worker.joinFor(std::chrono::seconds(30)));
+        EXPECT_LE(1, worker.runs);
+    }
+    Couchbase::Thread::setThreadCacheSize(0);
+}
+
+class BusyThread : public Couchbase::Thread {
+public:
+    BusyThread(const std::string& name = "busy")
+        : Couchbase::Thread(name),
+          spins(0) {
+    }
+
+    std::atomic<uint64_t> spins;
+
+protected:
+    void run() override {
+        setRunning();
+        while (!isStopRequested()) {
+            spins.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
+
+static const Couchbase::ThreadStats* findThread(
+    const std::vector<Couchbase::ThreadStats>& threads,
+    const std::string& name) {
+    for (const auto& thread : threads) {
+        if (thread.name == name) {
+            return &thread;
+        }
+    }
+    return nullptr;
+}
+
+TEST(ThreadRegistryTest, CouchbaseThread) {
+    BusyThread busy;
+    busy.start();
+    while (busy.spins.load() < 1000000) {
+        std::this_thread::yield();
+    }
+
+    auto threads = Couchbase::ThreadRegistry::getStats();
+    const auto* stats = findThread(threads, "busy");
+    ASSERT_NE(nullptr, stats);
+    EXPECT_TRUE(stats->hasState);
+    EXPECT_EQ(Couchbase::ThreadState::Running, stats->state);
+    EXPECT_NE(0u, stats->tid);
+#if defined(__linux__) || defined(__APPLE__)
+    EXPECT_LT(0u, stats->cpuTime);
+#endif
+
+    const auto json = Couchbase::ThreadRegistry::toJSON();
+    EXPECT_NE(std::string::npos, json.find("\"name\":\"busy\""));
+    EXPECT_NE(std::string::npos, json.find("\"state\":\"running\""));
+
+    busy.requestStop();
+    EXPECT_TRUE(busy.joinFor(std::chrono::seconds(30)));
+    threads = Couchbase::ThreadRegistry::getStats();
+    EXPECT_EQ(nullptr, findThread(threads, "busy"));
+}
+
+TEST(ThreadRegistryTest, LongName) {
+    // The OS won't accept the name, but the registry should have it
+    const std::string name("a busy thread with a long name");
+    BusyThread busy(name);
+    busy.start();
+    while (busy.spins.load() == 0) {
+        std::this_thread::yield();
+    }
+
+    const auto threads = Couchbase::ThreadRegistry::getStats();
+    EXPECT_NE(nullptr, findThread(threads, name));
+
+    busy.requestStop();
+    EXPECT_TRUE(busy.joinFor(std::chrono::seconds(30)));
+}
+
+static void registry_thread_main(void* arg) {
+    auto* done = reinterpret_cast<std::atomic<bool>*>(arg);
+    while (!done->load()) {
+        std::this_thread::yield();
+    }
+}
+
+TEST(ThreadRegistryTest, PlatformThread) {
+    std::atomic<bool> done(false);
+    cb_thread_t tid;
+    ASSERT_EQ(0, cb_create_named_thread(&tid, registry_thread_main, &done, 0,
+                                        "plain"));
+
+    const Couchbase::ThreadStats* stats = nullptr;
+    std::vector<Couchbase::ThreadStats> threads;
+    // The thread registers itself when it starts
+    while (stats == nullptr) {
+        std::this_thread::yield();
+        threads = Couchbase::ThreadRegistry::getStats();
+        stats = findThread(threads, "plain");
+    }
+    EXPECT_FALSE(stats->hasState);
+    EXPECT_NE(std::string::npos,
+              Couchbase::ThreadRegistry::toJSON().find("\"name\":\"plain\""));
+
+    done = true;
+    ASSERT_EQ(0, cb_join_thread(tid));
+    threads = Couchbase::ThreadRegistry::getStats();
+    EXPECT_EQ(nullptr, findThread(threads, "plain"));
+}
+
+/**
+ * Counts the live instances so that we can check that they're destroyed
+ */
+struct Tracked {
+    Tracked()
+        : value(0) {
+        ++live;
+    }
+
+    ~Tracked() {
+        --live;
+    }
+
+    uint64_t value;
+    static std::atomic<int> live;
+};
+
+std::atomic<int> Tracked::live(0);
+
+static void thread_local_main(void* arg) {
+    auto* local = reinterpret_cast<Couchbase::ThreadLocal<Tracked>*>(arg);
+    local->get().value = 5;
+}
+
+TEST(ThreadLocalTest, PerThreadInstances) {
+    Couchbase::ThreadLocal<Tracked> local;
+    local->value = 1;
+    EXPECT_EQ(1u, local.get().value);
+
+    std::thread other([&local]() {
+        EXPECT_EQ(0u, local->value);
+        local->value = 2;
+    });
+    other.join();
+
+    EXPECT_EQ(1u, local->value);
+    EXPECT_EQ(1, Tracked::live.load());
+}
+
+TEST(ThreadLocalTest, DestroyedAtThreadExit) {
+    Couchbase::ThreadLocal<Tracked> local;
+    cb_thread_t tid;
+    ASSERT_EQ(0, cb_create_thread(&tid, thread_local_main, &local, 0));
+    ASSERT_EQ(0, cb_join_thread(tid));
+    EXPECT_EQ(0, Tracked::live.load());
+}
+
+TEST(ThreadLocalTest, DestroyedWithThreadLocal) {
+    {
+        Couchbase::ThreadLocal<Tracked> local;
+        local->value = 1;
+        EXPECT_EQ(1, Tracked::live.load());
+    }
+    EXPECT_EQ(0, Tracked::live.load());
+
+    // A new ThreadLocal (which probably reuses the id) starts out fresh
+    Couchbase::ThreadLocal<Tracked> local;
+    EXPECT_EQ(0u, local->value);
+}
+
+TEST(ThreadLocalTest, GetAfterThreadExit) {
+    Couchbase::ThreadLocal<Tracked> local;
+    std::thread other([&local]() {
+        local->value = 1;
+        // The cached element is destroyed, so get() must create a new one
+        Couchbase::ThreadLocalBase::threadExit();
+        EXPECT_EQ(0, Tracked::live.load());
+        EXPECT_EQ(0u, local->value);
+        EXPECT_EQ(1, Tracked::live.load());
+    });
+    other.join();
+    EXPECT_EQ(0, Tracked::live.load());
+}
+
+/**
+ * Uses another ThreadLocal from its destructor
+ */
+struct UsesOtherThreadLocal {
+    ~UsesOtherThreadLocal() {
+        if (other != nullptr) {
+            other->get().value = 1;
+        }
+    }
+
+    Couchbase::ThreadLocal<Tracked>* other = nullptr;
+};
+
+TEST(ThreadLocalTest, DestructorUsesThreadLocal) {
+    Couchbase::ThreadLocal<Tracked> tracked;
+    Couchbase::ThreadLocal<UsesOtherThreadLocal> local;
+    std::thread other([&tracked, &local]() {
+        local->other = &tracked;
+    });
+    other.join();
+    // The element created by the destructor is destroyed as well
+    EXPECT_EQ(0, Tracked::live.load());
+}
+
+TEST(ThreadLocalTest, ForEach) {
+    Couchbase::ThreadLocal<std::atomic<uint64_t>> counter;
+    const int threads = 4;
+    std::atomic<int> done(0);
+    std::atomic<bool> stop(false);
+
+    std::vector<std::thread> workers;
+    for (int ii = 0; ii < threads; ++ii) {
+        workers.emplace_back([&counter, &done, &stop]() {
+            auto& mine = counter.get();
+            for (int jj = 0; jj < 1000; ++jj) {
+                mine.fetch_add(1, std::memory_order_relaxed);
+            }
+            ++done;
+            // Stay alive until the main thread has summed the counters
+            while (!stop.load()) {
+                std::this_thread::yield();
+            }
+        });
+    }
+    while (done.load() != threads) {
+        std::this_thread::yield();
+    }
+
+    uint64_t total = 0;
+    int instances = 0;
+    counter.forEach([&total, &instances](std::atomic<uint64_t>& value) {
+        total += value.load();
+        ++instances;
+    });
+    EXPECT_EQ(threads, instances);
+    EXPECT_EQ(threads * 1000u, total);
+
+    stop.store(true);
+    for (auto& t : workers) {
+        t.join();
+    }
+}